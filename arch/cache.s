@@ -4,6 +4,184 @@
 .cpu cortex-a5
 .arm
 
+// Total size of the data and unified caches up to the point of coherency. A range
+// operation larger than this is cheaper as a set/way walk. This is zero until cache_init
+// has been called, and range operations are then always done line by line
+.data
+.balign 4
+dcache_total_size:
+    .word 0
+
+.text
+
+// Outer cache hooks. A board with an outer cache controller overrides these. The ranges
+// are virtual addresses
+.weak outer_cache_init
+.weak outer_clean_range
+.weak outer_invalidate_range
+.weak outer_clean_invalidate_range
+.weak outer_clean_all
+.weak outer_flush_all
+.weak outer_disable
+.type outer_cache_init, %function
+.type outer_clean_range, %function
+.type outer_invalidate_range, %function
+.type outer_clean_invalidate_range, %function
+.type outer_clean_all, %function
+.type outer_flush_all, %function
+.type outer_disable, %function
+outer_cache_init:
+outer_clean_range:
+outer_invalidate_range:
+outer_clean_invalidate_range:
+outer_clean_all:
+outer_flush_all:
+outer_disable:
+    bx lr
+
+// Returns the smallest data cache line size in bytes of all cache levels in \reg
+.macro dcache_line_size reg, tmp
+    mrc p15, 0, \tmp, c0, c0, 1          // CTR
+    ubfx \tmp, \tmp, #16, #4             // DminLine is log2 of the number of words
+    mov \reg, #4
+    lsl \reg, \reg, \tmp
+.endm
+
+// Runs a set/way operation on every data or unified cache level up to the point of
+// coherency. The cache geometry of each level is read from CCSIDR. The operation is
+// given by the CRm value of the c7 maintenance register. 6 is invalidate, 10 is clean
+// and 14 is clean and invalidate. The last level is read from the CLIDR field at bit
+// \level, which is 24 for the point of coherency and 21 for the point of unification
+// inner shareable. With \stack set to 0 the registers r4-r7 are clobbered instead of
+// saved, so no stack is needed
+.macro dcache_set_way crm, level=24, stack=1
+.if \stack
+    stmdb sp!, {r4-r7}
+.endif
+
+    mrc p15, 1, r0, c0, c0, 1            // CLIDR
+    ubfx r3, r0, #\level, #3             // Last level
+    lsl r3, r3, #1
+    mov r4, #0                           // Level in bits 3..1 as used by CSSELR
+
+1:  cmp r4, r3
+    bhs 5f
+    add r1, r4, r4, lsr #1               // Level times 3
+    lsr r1, r0, r1
+    and r1, r1, #7                       // Cache type of this level
+    cmp r1, #2
+    blo 4f                               // Instruction cache only or no cache
+
+    mcr p15, 2, r4, c0, c0, 0            // Select the cache level in CSSELR
+    isb
+    mrc p15, 1, r1, c0, c0, 0            // CCSIDR
+
+    and r2, r1, #7
+    add r2, r2, #4                       // Set shift is log2 of the line size
+    ubfx r5, r1, #3, #10                 // Highest way number
+    clz r6, r5                           // Way shift
+    ubfx r7, r1, #13, #15                // Highest set number
+
+2:  mov r12, r5
+3:  orr r1, r4, r12, lsl r6
+    orr r1, r1, r7, lsl r2
+    mcr p15, 0, r1, c7, \crm, 2
+    subs r12, r12, #1
+    bge 3b
+    subs r7, r7, #1
+    bge 2b
+
+4:  add r4, r4, #2
+    b 1b
+
+5:  mov r4, #0
+    mcr p15, 2, r4, c0, c0, 0            // Select L1 again
+    dsb
+    isb
+.if \stack
+    ldmia sp!, {r4-r7}
+.endif
+.endm
+
+// Runs a line by line operation on the virtual range r0..r1. The operation is given by
+// the CRm value of the c7 maintenance register. 6 is invalidate, 10 is clean and 14 is
+// clean and invalidate
+.macro dcache_range crm
+    dcache_line_size r2, r3
+    sub r3, r2, #1
+    bic r0, r0, r3                       // Align the start address by a cache line
+1:  mcr p15, 0, r0, c7, \crm, 1
+    add r0, r0, r2
+    cmp r0, r1
+    blo 1b
+    dsb
+.endm
+
+// Branches to \label if the range r0..r1 is larger than the data caches. Set/way
+// operations only affect the local core, so this is never done when the core takes part
+// in SMP coherency. Clobbers r2 and r3
+.macro branch_if_large label
+    ldr r2, =dcache_total_size
+    ldr r2, [r2]
+    cmp r2, #0
+    beq 1f
+    sub r3, r1, r0
+    cmp r3, r2
+    blo 1f
+    mrc p15, 0, r3, c1, c0, 1            // ACTLR
+    tst r3, #(1 << 6)
+    beq \label
+1:
+.endm
+
+// Reads the cache geometry and computes the total size of the data caches. This must be
+// called with the MMU on
+.global cache_init
+.type cache_init, %function
+cache_init:
+
+    stmdb sp!, {r4-r5}
+
+    mrc p15, 1, r0, c0, c0, 1            // CLIDR
+    ubfx r3, r0, #24, #3                 // Level of coherency
+    mov r4, #0                           // Level
+    mov r5, #0                           // Total size
+
+1:  cmp r4, r3
+    bhs 3f
+    add r1, r4, r4, lsl #1
+    lsr r1, r0, r1
+    and r1, r1, #7
+    cmp r1, #2
+    blo 2f
+
+    lsl r1, r4, #1
+    mcr p15, 2, r1, c0, c0, 0            // CSSELR
+    isb
+    mrc p15, 1, r1, c0, c0, 0            // CCSIDR
+
+    and r2, r1, #7
+    add r2, r2, #4                       // log2 of the line size
+    ubfx r12, r1, #3, #10
+    add r12, r12, #1                     // Number of ways
+    lsl r12, r12, r2
+    ubfx r1, r1, #13, #15
+    add r1, r1, #1                       // Number of sets
+    mla r5, r1, r12, r5
+
+2:  add r4, r4, #1
+    b 1b
+
+3:  mov r1, #0
+    mcr p15, 2, r1, c0, c0, 0
+    isb
+
+    ldr r1, =dcache_total_size
+    str r5, [r1]
+
+    ldmia sp!, {r4-r5}
+    bx lr
+
 // Invalidates and enables the instruction cache
 .global icache_enable
 .type icache_enable, %function
@@ -16,6 +194,7 @@ icache_enable:
     mrc p15, 0, r0, c1, c0, 0
     orr r0, r0, #(1 << 12)
     mcr p15, 0, r0, c1, c0, 0    // Enable the instruction cache
+    isb
      
     bx lr
 
@@ -27,6 +206,7 @@ icache_disable:
     mrc p15, 0, r0, c1, c0, 0
     bic r0, r0, #(1 << 12)
     mcr p15, 0, r0, c1, c0, 0    // Disable the instruction cache
+    isb
 
     stmdb sp!, {lr}
     bl icache_invalidate
@@ -34,18 +214,24 @@ icache_disable:
 
     bx lr
 
-// Invalidates all instruction caches to PoU and flushed the target branch cache
+// Invalidates all instruction caches to PoU and flushed the target branch cache. With
+// the multiprocessing extensions this is broadcast to the inner shareable domain
 .global icache_invalidate
 .type icache_invalidate, %function
 icache_invalidate:
 
     mov r0, #0
-    mcr p15, 0, r0, c7, c5, 0
+    mrc p15, 0, r1, c0, c0, 5    // MPIDR
+    tst r1, #(1 << 31)
+    mcrne p15, 0, r0, c7, c1, 0  // ICIALLUIS
+    mcrne p15, 0, r0, c7, c1, 6  // BPIALLIS
+    mcreq p15, 0, r0, c7, c5, 0  // ICIALLU
+    mcreq p15, 0, r0, c7, c5, 6  // BPIALL
     dsb
     isb
     bx lr
 
-// Invalidates and enables the L1 data cache
+// Invalidates and enables the data cache
 .global dcache_enable
 .type dcache_enable, %function
 dcache_enable:
@@ -57,132 +243,108 @@ dcache_enable:
     mrc p15, 0, r0, c1, c0, 0
     orr r0, #(1 << 2)
     mcr p15, 0, r0, c1, c0, 0   // enable the data cache
+    isb
 
     bx lr
 
-// Cleans and disables the entire L1 data cache
+// Cleans and disables the entire data cache
 .global dcache_disable
 .type dcache_disable, %function
 dcache_disable:
 
     stmdb sp!, {lr}
     bl dcache_clean
-    stmia sp!, {lr}
+    ldmia sp!, {lr}
 
     mrc p15, 0, r0, c1, c0, 0
     bic r0, #(1 << 2)
     mcr p15, 0, r0, c1, c0, 0   // Disable the data cache
+    isb
 
     bx lr
 
-// Cleans the entire L1 data cache
+// Cleans the entire data cache including the outer cache
 .global dcache_clean
 .type dcache_clean, %function
 dcache_clean:
 
-    mov r0, #0                  // Way index
-1:  
-    mov r1, #0                  // Set index
-2:  
-    mov r2, #0
-    orr r2, r2, r1, LSL #5
-    orr r2, r2, r0, LSL #30
-    mcr p15, 0, r2, c7, c10, 2
-    add r1, r1, #1
-    cmp r1, #256
-    bne 2b
-    add r0, r0, #1
-    cmp r0, #4
-    bne 1b
-    dsb
-    isb
+    dcache_set_way c10
+    b outer_clean_all
+
+// Cleans the data cache levels known to CLIDR only. This is position independent and is
+// used by the entry code before the kernel is relocated. The stack of the bootloader
+// might be gone by then, so this uses no stack and clobbers r0-r7 and r12
+.global dcache_clean_inner
+.type dcache_clean_inner, %function
+dcache_clean_inner:
+
+    dcache_set_way c10, stack=0
     bx lr
 
-// Clenans the date cache for a virtual range. The start address must be placed in r0
+// Cleans the data cache for a virtual range. The start address must be placed in r0
 // and the end address must be placed in r1. Any address not aligned to a cache line will
 // cause additional bytes to be affected
 .global dcache_clean_virt_range
 .type dcache_clean_virt_range, %function
 dcache_clean_virt_range:
 
-    bic r0, r0, #31              // Align the start address by a cache line
-1:  
-    mcr p15, 0, r0, c7, c10, 1
-    add r0, r0, #32
-    cmp r0, r1
-    blt 1b
-    bx lr
+    branch_if_large dcache_clean
+    stmdb sp!, {r0, r1, lr}
+    dcache_range c10
+    ldmia sp!, {r0, r1, lr}
+    b outer_clean_range
 
-// Invalidates the entrie L1 data cache
+// Invalidates the entrie data cache. This leaves the outer cache untouched
 .global dcache_invalidate
 .type dcache_invalidate, %function
 dcache_invalidate:
 
-    mov r0, #0               // Way index - from 0 to 3
-1:  
-    mov r1, #0               // Set index - from 0 to 255
-2:  
-    mov r2, #0
-    orr r2, r2, r1, LSL #5
-    orr r2, r2, r0, LSL #30
-    mcr p15, 0, r2, c7, c6, 2
-    add r1, r1, #1
-    cmp r1, #256
-    bne 2b
-    add r0, r0, #1
-    cmp r0, #4
-    bne 1b
+    dcache_set_way c6
     bx lr
 
-// Invalidates the date cache for a virtual range. The start address must be placed in r0
+// Invalidates the data caches private to this core. A secondary core uses this before it
+// turns on its caches, since the outer levels are shared with the running cores
+.global dcache_invalidate_local
+.type dcache_invalidate_local, %function
+dcache_invalidate_local:
+
+    dcache_set_way c6, 21
+    bx lr
+
+// Invalidates the data cache for a virtual range. The start address must be placed in r0
 // and the end address must be placed in r1. Any address not aligned to a cache line will
-// cause additional bytes to be affected
+// cause additional bytes to be affected. This is always done line by line, since a full
+// invalidate would throw away dirty data outside the range. The outer cache is
+// invalidated first so the inner cache can't refill with stale lines from it
 .global dcache_invalidate_virt_range
 .type dcache_invalidate_virt_range, %function
 dcache_invalidate_virt_range:
    
-    bic r0, r0, #31          // Align by cache line
-1:  
-    mcr p15, 0, r0, c7, c6, 1
-    add r0, r0, #32
-    cmp r0, r1
-    blt 1b
-    dsb
-    isb
+    stmdb sp!, {r0, r1, lr}
+    bl outer_invalidate_range
+    ldmia sp!, {r0, r1, lr}
+    dcache_range c6
     bx lr
 
-// Cleans and invalidates the entire data cache
+// Cleans and invalidates the entire data cache including the outer cache
 .global dcache_clean_invalidate
 .type dcache_clean_invalidate, %function
 dcache_clean_invalidate:
 
-    mov r0, #0               // Way index
-1:  
-    mov r1, #0               // Set index
-2:  
-    mov r2, #0
-    orr r2, r2, r1, LSL #5
-    orr r2, r2, r0, LSL #30
-    mcr p15, 0, r2, c7, c14, 2
-    add r1, r1, #1
-    cmp r1, #256
-    bne 2b
-    add r0, r0, #1
-    cmp r0, #4
-    bne 1b
-    bx lr
+    dcache_set_way c14
+    b outer_flush_all
 
-// Cleans and invalidates the date cache for a virtual range. The start address must be 
+// Cleans and invalidates the data cache for a virtual range. The start address must be 
 // placed in r0 and the end address must be placed in r1. Any address not aligned to a
 // cache line will cause additional bytes to be affected
 .global dcache_clean_invalidate_virt_range
 .type dcache_clean_invalidate_virt_range, %function
 dcache_clean_invalidate_virt_range:
 
-    bic r0, r0, #31          // Align the start address by a cache line
-1:  
-    mcr p15, 0, r0, c7, c14, 1
-    add r0, r0, #32
-    cmp r0, r1
-    blt 1b
-    bx lr
+    branch_if_large dcache_clean_invalidate
+    stmdb sp!, {r0, r1, lr}
+    dcache_range c14
+    ldmia sp!, {r0, r1, lr}
+    b outer_clean_invalidate_range
+
+.ltorg
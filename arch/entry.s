@@ -7,123 +7,230 @@
 .extern main
 
 // Extern variables from the linker script
-.extern _svc_stack_e
-.extern _kernel_bin_size
+.extern _fiq_stack_s
+.extern _irq_stack_s
+.extern _abort_stack_s
+.extern _svc_stack_s
+.extern _undef_stack_s
+.extern FIQ_STACK
+.extern IRQ_STACK
+.extern ABORT_STACK
+.extern SVC_STACK
+.extern UNDEF_STACK
+.extern _kernel_size
+.extern _kernel_s
+.extern _bss_s
+.extern _bss_e
+.extern _sram_load
+.extern _sram_phys
+.extern _sram_s
+.extern _sram_e
 
 // Extern variables from the targer configuration file
 .extern ddr_size
 .extern ddr_start
 
+.extern mmu_early_init
+.extern cache_init
+.extern outer_cache_init
+.extern dcache_clean_inner
+
 // This is where u-boot (or any bootloader) will hand off execution. This will run 
 // completly position independent. It will relocate itself to the beginning of DDR memory
 // and setup early page tables for the kernel. Finally it will enable caches and MMU and 
 // switch to the virtual memory layout. This will place the kernel at virtual address
 // 0x80000000, and the kernel should be linked at the same address
 .section .kernel_entry, "ax", %progbits
+.global kernel_entry
 kernel_entry:
 
+    // Keep the boot arguments in the image. They are moved along with the kernel, and the
+    // relocation continues below, so they are only stored once
+    adr r3, boot_args
+    stmia r3, {r0-r2}
+    b kernel_relocated
+
+    // The relocation copy jumps here. It turned the instruction cache on, so the system
+    // control register of the bootloader is put back from r11
+kernel_copied:
+    mcr p15, 0, r11, c1, c0, 0
+    isb
+
+kernel_relocated:
     // Get the program load address
-    sub r0, pc, #8
-    ldr r1, =ddr_start
+    adr r0, kernel_entry
+
+    // Drop stale instruction cache lines. The bootloader or the relocation below might
+    // have left the instruction cache holding lines of the old copy of the kernel
+    mov r2, #0
+    mcr p15, 0, r2, c7, c5, 0        // ICIALLU
+    mcr p15, 0, r2, c7, c5, 6        // BPIALL
+    isb
 
     // Turn off all interrupts
     cpsid afi
 
+    // The bootloader might have left the MMU and the data cache on. In that case the
+    // image might still be in the data cache, so it is cleaned before both are turned
+    // off. An outer cache left on by the bootloader is handled by its driver. The stack
+    // of the bootloader cannot be trusted, so the clean uses registers only and the load
+    // address is kept in r8
+    mrc p15, 0, r2, c1, c0, 0
+    tst r2, #(1 << 2)
+    beq 1f
+    mov r8, r0
+    bl dcache_clean_inner
+    mov r0, r8
+1:  mrc p15, 0, r2, c1, c0, 0
+    bic r2, r2, #(1 << 0)
+    bic r2, r2, #(1 << 2)
+    mcr p15, 0, r2, c1, c0, 0
+    isb
+
     // Check if a relocation is needed
+    ldr r1, =ddr_start
     cmp r0, r1
     beq skip_kernel_relocation
 
 relocate_kernel:
-    // Check if the relocation will overwrite executing code
-    ldr r2, =_kernel_bin_size
-    add r2, r2, #4
-    add r4, r1, r2                     // r4 hold the old kernel end address
-    cmp r0, r4
-    blo .
-
-    lsr r2, r2, #2
-    add r2, r2, #1                     // Kernel size in words
-
-    // Relocate the kernel to the start of DDR memory
-1:  ldr r3, [r0], #4
-    str r3, [r1], #4
-    subs r2, r2, #1
-    bne 1b
-    b skip_invalidate_icache
-
-    // Check if the dcache is enabled
-    mrc p15, 0, r0, c1, c0, 0
-    tst r0, #(1 << 2)
-    beq skip_disable_dcache
-
-    // Get the cache size
-    mrc p15, 1, r5, c0, c0, 0
-    lsr r3, r5, #3
-    mov r6, #0x3FF
-    and r3, r3, r6
-    add r3, r3, #1                     // Number of ways
-
-    mov r6, #0x7FFF
-    lsr r4, r5, #13
-    and r4, r4, r6
-    add r4, r4, #1                     // Number of sets
-
-    // Disable and clean the dcache
-    mov r0, #0                         // Way index
-1:  mov r1, #0                         // Set index
-2:  mov r2, #0
-    orr r2, r2, r1, LSL #5
-    orr r2, r2, r0, LSL #30
-    mcr p15, 0, r2, c7, c10, 2
-    add r1, r1, #1
-    cmp r1, r4
-    bne 2b
-    add r0, r0, #1
-    cmp r0, r3
-    bne 1b
-    dsb
-    isb
-
-    // Disable the D-cache
-    mrc p15, 0, r0, c1, c0, 0
-    bic r0, #(1 << 2)
-    mcr p15, 0, r0, c1, c0, 0
-    dmb
-    isb
-    
-skip_disable_dcache:
-    // Check if the icache is enabled
-    mrc p15, 0, r0, c1, c0, 0
-    tst r0, #(1 << 12)
-    beq skip_invalidate_icache
-
-    // Invalidate the icache
-    mov r0, #0
-    mcr p15, 0, r0, c7, c5, 0
-    dsb
+    // Everything used after the copy must be in registers, since the copy may overwrite
+    // the literal pool. The size is rounded up to whole 32-byte bursts
+    ldr r2, =_kernel_size
+    add r2, r2, #31
+    bic r2, r2, #31
+    add r12, r1, #(kernel_copied - kernel_entry)
+
+    // Run the copy loop from the instruction cache. With the MMU off all data accesses
+    // are uncached, so the bursts are what makes the copy fast. The copy does not use
+    // r11, so it keeps the old system control register until kernel_copied
+    mrc p15, 0, r11, c1, c0, 0
+    orr r3, r11, #(1 << 12)
+    mcr p15, 0, r3, c1, c0, 0
     isb
 
-skip_invalidate_icache:
-
-    // Relocation is complete so we can jump to the beginning of DDR
-    ldr r1, =ddr_start
-    dsb
-    isb
-    bx r1
+    // If the new location overlaps the old one, the copy direction must be chosen so that
+    // no source data is overwritten before it is read. Copy forwards when moving down and
+    // backwards when moving up. The loop and the final branch sit in one cache line, so
+    // they keep running from the instruction cache even if the copy overwrites them
+    cmp r1, r0
+    bhi copy_backward
+
+.balign 32
+copy_forward:
+    ldmia r0!, {r3-r10}
+    stmia r1!, {r3-r10}
+    subs r2, r2, #32
+    bhi copy_forward
+    bx r12
+
+copy_backward:
+    add r0, r0, r2
+    add r1, r1, r2
+    b 1f
+
+.balign 32
+1:  ldmdb r0!, {r3-r10}
+    stmdb r1!, {r3-r10}
+    subs r2, r2, #32
+    bhi 1b
+    bx r12
 
 skip_kernel_relocation:
     // We are done relocating the kernel. We require that MMU, interrupt and D-cache is
     // disabled at this point. This will be the main entry point for the kernel
 
-    // Setup the stack for the SVC mode
-    ldr sp, =_svc_stack_e
-    isb
+    // We are running at the physical address, but everything is linked at the virtual
+    // address. Adding r11 to a linked address gives the physical address
+    ldr r11, =ddr_start
+    ldr r0, =_kernel_s
+    sub r11, r11, r0
 
-    // Remember to init the .bss
+    // Use the physical address of the stacks until the MMU is on. The boot core is core 0
+    mov r0, #0
+    mov r1, r11
+    bl stacks_init
+
+    // Copy the SRAM code and data from the load image. The load image lies where the
+    // .bss will be, so this must be done first. This is small, so a word copy will do
+    ldr r0, =_sram_load
+    ldr r1, =_sram_phys
+    ldr r2, =_sram_s
+    ldr r3, =_sram_e
+    sub r2, r3, r2
+1:  subs r2, r2, #4
+    ldrhs r3, [r0], #4
+    strhs r3, [r1], #4
+    bhi 1b
+
+    // Zero the .bss with 32-byte bursts. This includes the page tables
+    ldr r0, =_bss_s
+    ldr r1, =_bss_e
+    add r0, r0, r11
+    add r1, r1, r11
+    mov r2, #0
+    mov r3, #0
+    mov r4, #0
+    mov r5, #0
+    mov r6, #0
+    mov r7, #0
+    mov r8, #0
+    mov r9, #0
+    add r10, r0, #32
+1:  cmp r10, r1
+    stmials r0!, {r2-r9}
+    addls r10, r10, #32
+    bls 1b
+2:  cmp r0, r1
+    strlo r2, [r0], #4
+    blo 2b
+
+    // Setup early kernel pagetables for upper 2 GB and enable the MMU
+    mov r0, r11
+    bl mmu_early_init
+
+    // Switch to the virtual address of the kernel
+    ldr r0, =kernel_virtual_entry
+    bx r0
 
-    // Setup early kernel pagetables for upper 2 GB
+kernel_virtual_entry:
+    // Setup the stacks of core 0 at the virtual address
+    mov r0, #0
+    mov r1, #0
+    bl stacks_init
 
-    // Might have to do a physical to virtual address switch before the branch
+    // Read the cache geometry used by the cache maintenance routines and enable the
+    // outer cache if the board has one
+    bl cache_init
+    bl outer_cache_init
 
     ldr r0, =main
     bx r0
+
+// Sets the stack pointer of each exception mode for core r0. The value in r1 is added to
+// every stack, so this can be used before the MMU is on. This returns in SVC mode and
+// clobbers r2 and r3
+.macro mode_stack mode, base, size
+    cps #\mode
+    ldr r2, =\size
+    mul r2, r2, r3
+    ldr sp, =\base
+    add sp, sp, r2
+    add sp, sp, r1
+.endm
+
+.global stacks_init
+.type stacks_init, %function
+stacks_init:
+    add r3, r0, #1
+    mode_stack 0x11, _fiq_stack_s, FIQ_STACK
+    mode_stack 0x12, _irq_stack_s, IRQ_STACK
+    mode_stack 0x17, _abort_stack_s, ABORT_STACK
+    mode_stack 0x1B, _undef_stack_s, UNDEF_STACK
+    mode_stack 0x13, _svc_stack_s, SVC_STACK
+    bx lr
+
+// Registers r0-r2 given to the kernel entry. See include/chaos/boot_args.h
+.balign 4
+.global boot_args
+boot_args:
+    .word 0, 0, 0
@@ -0,0 +1,260 @@
+// Decompressor stub for the LZ4 compressed kernel image
+
+.syntax unified
+.cpu cortex-a5
+.arm
+
+.extern lz4_decompress
+
+// The stub is linked at address 0, so a linked address is the offset from the start of
+// the image. It is followed by the image header and the LZ4 payload. The header layout
+// must match struct lz4_image_header in include/chaos/lz4.h
+.equ LZ4_IMAGE_MAGIC,   0x345A4C43
+.equ HEADER_MAGIC,      0
+.equ HEADER_DEST,       4
+.equ HEADER_IMAGE_SIZE, 8
+.equ HEADER_PAYLOAD,    12
+.equ HEADER_DDR_SIZE,   16
+.equ HEADER_SIZE,       20
+
+// Section descriptor for normal write-back memory. See include/chaos/mmu.h
+.equ MMU_NORMAL, 0x140E
+
+// The work area holds a 16 KiB translation table followed by the stack
+.equ WORK_TABLE_SIZE, 0x4000
+.equ WORK_STACK_SIZE, 0x1000
+
+// Runs a set/way operation on every data or unified cache level up to the point of
+// coherency. This is the same walk as in arch/cache.s, but without a stack. Clobbers
+// r0-r3 and r7-r12
+.macro dcache_set_way crm
+    mrc p15, 1, r0, c0, c0, 1            // CLIDR
+    ubfx r3, r0, #24, #3                 // Level of coherency
+    lsl r3, r3, #1
+    mov r7, #0                           // Level in bits 3..1 as used by CSSELR
+
+1:  cmp r7, r3
+    bhs 5f
+    add r1, r7, r7, lsr #1
+    lsr r1, r0, r1
+    and r1, r1, #7
+    cmp r1, #2
+    blo 4f
+
+    mcr p15, 2, r7, c0, c0, 0            // CSSELR
+    isb
+    mrc p15, 1, r1, c0, c0, 0            // CCSIDR
+
+    and r2, r1, #7
+    add r2, r2, #4                       // Set shift
+    ubfx r8, r1, #3, #10                 // Highest way number
+    clz r9, r8                           // Way shift
+    ubfx r10, r1, #13, #15               // Highest set number
+
+2:  mov r12, r8
+3:  orr r11, r7, r12, lsl r9
+    orr r11, r11, r10, lsl r2
+    mcr p15, 0, r11, c7, \crm, 2
+    subs r12, r12, #1
+    bge 3b
+    subs r10, r10, #1
+    bge 2b
+
+4:  add r7, r7, #2
+    b 1b
+
+5:  mov r7, #0
+    mcr p15, 2, r7, c0, c0, 0
+    dsb
+    isb
+.endm
+
+// The image is loaded anywhere in DDR and entered here with the MMU off, or with the
+// MMU and caches on if the bootloader left them on. The stub decompresses the kernel
+// straight to its final address at the start of DDR and jumps to it. r0-r2 from the
+// bootloader are passed on to the kernel
+.section .lz4_stub_entry, "ax", %progbits
+.global lz4_stub_entry
+lz4_stub_entry:
+
+    sub r4, pc, #8
+
+    // Keep the boot arguments in the image. They are moved along with the stub
+    adr r3, boot_args
+    stmia r3, {r0-r2}
+
+    cpsid afi
+    mov r0, #0
+    mcr p15, 0, r0, c7, c5, 0            // ICIALLU
+    mcr p15, 0, r0, c7, c5, 6            // BPIALL
+    isb
+
+    // Write back the image if the bootloader left the data cache on. Then run with the
+    // MMU and the data cache off and the instruction cache on
+    mrc p15, 0, r0, c1, c0, 0
+    tst r0, #(1 << 2)
+    blne dcache_flush_all
+    mrc p15, 0, r0, c1, c0, 0
+    bic r0, r0, #(1 << 0)
+    bic r0, r0, #(1 << 2)
+    orr r0, r0, #(1 << 12)
+    mcr p15, 0, r0, c1, c0, 0
+    isb
+
+    // r5 points to the header and r10 to the end of the payload
+    ldr r5, =lz4_stub_end
+    add r5, r5, r4
+    ldr r0, [r5, #HEADER_MAGIC]
+    ldr r1, =LZ4_IMAGE_MAGIC
+    cmp r0, r1
+    bne hang
+    ldr r6, [r5, #HEADER_DEST]
+    ldr r7, [r5, #HEADER_IMAGE_SIZE]
+    ldr r8, [r5, #HEADER_PAYLOAD]
+    ldr r9, [r5, #HEADER_DDR_SIZE]
+    add r10, r5, #HEADER_SIZE
+    add r10, r10, r8
+
+    // If the decompressed kernel would overwrite the stub or the payload, the image is
+    // first moved above both. The new location never overlaps the old one, so a plain
+    // forward copy is fine and no cached instruction can be stale
+    add r11, r6, r7
+    cmp r4, r11
+    bhs 2f
+    cmp r10, r6
+    bls 2f
+
+    cmp r10, r11
+    movhi r11, r10
+    add r11, r11, #31
+    bic r11, r11, #31
+    mov r0, r4
+    mov r1, r11
+1:  ldmia r0!, {r2, r3, r7, r8}
+    stmia r1!, {r2, r3, r7, r8}
+    cmp r0, r10
+    blo 1b
+
+    mov r0, #0
+    mcr p15, 0, r0, c7, c5, 0            // ICIALLU
+    mcr p15, 0, r0, c7, c5, 6            // BPIALL
+    dsb
+    isb
+    ldr r0, =lz4_stub_entry_moved
+    add r0, r0, r11
+    bx r0
+
+lz4_stub_entry_moved:
+    // Same as above, but for the new location
+    sub r4, pc, #8
+    ldr r0, =lz4_stub_entry_moved
+    sub r4, r4, r0
+    ldr r5, =lz4_stub_end
+    add r5, r5, r4
+    ldr r7, [r5, #HEADER_IMAGE_SIZE]
+    ldr r8, [r5, #HEADER_PAYLOAD]
+    add r10, r5, #HEADER_SIZE
+    add r10, r10, r8
+
+2:  // The work area follows both the kernel and the image, aligned for the table
+    add r11, r6, r7
+    cmp r10, r11
+    movhi r11, r10
+    ldr r0, =(WORK_TABLE_SIZE - 1)
+    add r11, r11, r0
+    bic r11, r11, r0
+
+    // Identity map the DDR as normal write-back memory. Everything else faults, so no
+    // speculative access can reach a peripheral
+    mov r0, r11
+    mov r1, #0
+    mov r2, #4096
+1:  str r1, [r0], #4
+    subs r2, r2, #1
+    bne 1b
+
+    lsr r0, r6, #20
+    add r0, r11, r0, lsl #2
+    lsr r1, r6, #20
+    lsl r1, r1, #20
+    ldr r2, =MMU_NORMAL
+    orr r1, r1, r2
+    ldr r2, =0xFFFFF
+    add r2, r9, r2
+    lsr r2, r2, #20
+1:  str r1, [r0], #4
+    add r1, r1, #0x100000
+    subs r2, r2, #1
+    bne 1b
+
+    // Decompression is byte oriented and far too slow on uncached memory, so the MMU
+    // and the data cache are turned on. The table walks are non-cacheable since the
+    // table was written with the cache off
+    bl dcache_invalidate_all
+    mov r0, #0
+    mcr p15, 0, r0, c8, c7, 0            // TLBIALL
+    mcr p15, 0, r0, c7, c5, 6            // BPIALL
+    mcr p15, 0, r0, c2, c0, 2            // TTBCR
+    mcr p15, 0, r11, c2, c0, 0           // TTBR0
+    mov r0, #1
+    mcr p15, 0, r0, c3, c0, 0            // DACR
+    dsb
+    isb
+    mrc p15, 0, r0, c1, c0, 0
+    bic r0, r0, #(1 << 1)
+    bic r0, r0, #(3 << 28)
+    orr r0, r0, #(1 << 0)
+    orr r0, r0, #(1 << 2)
+    orr r0, r0, #(1 << 11)
+    mcr p15, 0, r0, c1, c0, 0
+    isb
+
+    add sp, r11, #(WORK_TABLE_SIZE + WORK_STACK_SIZE)
+    add r0, r5, #HEADER_SIZE
+    mov r1, r8
+    mov r2, r6
+    ldr r3, [r5, #HEADER_IMAGE_SIZE]
+    bl lz4_decompress
+    ldr r1, [r5, #HEADER_IMAGE_SIZE]
+    cmp r0, r1
+    bne hang
+
+    // The kernel expects to be entered with the MMU and the data cache off
+    bl dcache_flush_all
+    mrc p15, 0, r0, c1, c0, 0
+    bic r0, r0, #(1 << 0)
+    bic r0, r0, #(1 << 2)
+    mcr p15, 0, r0, c1, c0, 0
+    isb
+
+    mov r0, #0
+    mcr p15, 0, r0, c8, c7, 0            // TLBIALL
+    mcr p15, 0, r0, c7, c5, 0            // ICIALLU
+    mcr p15, 0, r0, c7, c5, 6            // BPIALL
+    dsb
+    isb
+
+    ldr r3, =boot_args
+    add r3, r3, r4
+    ldmia r3, {r0-r2}
+    bx r6
+
+// There is no console this early. A corrupt image stops here
+hang:
+    b hang
+
+// Cleans and invalidates the data caches
+dcache_flush_all:
+    dcache_set_way c14
+    bx lr
+
+// Invalidates the data caches
+dcache_invalidate_all:
+    dcache_set_way c6
+    bx lr
+
+.ltorg
+
+.balign 4
+boot_args:
+    .word 0, 0, 0
@@ -0,0 +1,365 @@
+// Early MMU setup for the ARMv7-A kernel
+
+.syntax unified
+.cpu cortex-a5
+.arm
+
+// Section attributes. These must match include/chaos/mmu.h. With several cores the normal
+// memory is shareable, so the cores keep it coherent
+.ifdef SMP
+.equ MMU_NORMAL,   0x1140E
+.else
+.equ MMU_NORMAL,   0x140E
+.endif
+.equ MMU_UNCACHED, 0x1402
+.equ MMU_NG,       (1 << 17)
+
+// SRAM windows. These must match include/chaos/mmu.h
+.equ SRAM_VIRT,          0xD0000000
+.equ SRAM_UNCACHED_VIRT, 0xD0100000
+
+// Extern variables from the linker script
+.extern _kernel_s
+.extern _dma_coherent_s
+.extern _dma_coherent_e
+.extern ddr_start
+.extern ddr_size
+.extern sram_start
+.extern sram_size
+
+// Board specific table of peripheral windows
+.extern mmu_io_regions
+.extern mmu_io_region_count
+
+// The kernel translation table is used by TTBR1 and covers the upper 2 GiB. Its entries
+// are global. The boot table is used by TTBR0 and identity maps DDR. Its entries are
+// non-global and tagged with ASID 0, so they never match while a server address space
+// is active. With TTBCR.N = 1 the TTBR0 table is only 8 KiB. Both tables are zeroed
+// together with the .bss
+.section .bss.page_tables, "aw", %nobits
+.balign 16384
+.global kernel_page_table
+kernel_page_table:
+    .space 16384
+
+.global boot_page_table
+boot_page_table:
+    .space 8192
+
+.text
+
+// Writes section descriptors into the table in r0. It maps r3 bytes from virtual address
+// r1 to physical address r2 using the attributes in r6. Clobbers r1, r2, r3 and r7
+map_sections:
+    lsr r1, r1, #20
+    add r1, r0, r1, lsl #2       // First entry
+    lsr r2, r2, #20              // First physical section
+
+    ldr r7, =0xFFFFF
+    add r3, r3, r7
+    lsrs r3, r3, #20             // Number of sections
+    bxeq lr
+
+1:  orr r7, r6, r2, lsl #20
+    str r7, [r1], #4
+    add r2, r2, #1
+    subs r3, r3, #1
+    bne 1b
+    bx lr
+
+// Builds the early page tables and enables the MMU and the caches. This must be called
+// with the MMU off from the physical load address. The value to add to a linked address
+// to get the physical address must be in r0. This returns to the physical address, which
+// stays valid through the identity mapping in TTBR0
+.global mmu_early_init
+.type mmu_early_init, %function
+mmu_early_init:
+
+    stmdb sp!, {r4-r11, lr}
+    mov r11, r0
+
+    ldr r4, =kernel_page_table
+    add r4, r4, r11
+    ldr r5, =boot_page_table
+    add r5, r5, r11
+
+    // Map DDR at the link address and identity map it in the boot table
+    mov r0, r4
+    ldr r1, =_kernel_s
+    ldr r2, =ddr_start
+    ldr r3, =ddr_size
+    ldr r6, =MMU_NORMAL
+    bl map_sections
+
+    mov r0, r5
+    ldr r1, =ddr_start
+    ldr r2, =ddr_start
+    ldr r3, =ddr_size
+    ldr r6, =(MMU_NORMAL | MMU_NG)
+    bl map_sections
+
+    // The DMA descriptor region is remapped as non-cacheable
+    mov r0, r4
+    ldr r1, =_dma_coherent_s
+    add r2, r1, r11
+    ldr r3, =_dma_coherent_e
+    sub r3, r3, r1
+    ldr r6, =MMU_UNCACHED
+    bl map_sections
+
+    // Map the section holding the on-chip SRAM into the cached and the non-cacheable
+    // window. A board without SRAM has a size of zero
+    ldr r1, =sram_start
+    ldr r3, =sram_size
+    cmp r3, #0
+    beq 1f
+    lsr r2, r1, #20
+    lsl r2, r2, #20
+    sub r1, r1, r2
+    add r8, r3, r1               // Size from the start of the section
+    mov r9, r2
+
+    mov r0, r4
+    ldr r1, =SRAM_VIRT
+    mov r3, r8
+    ldr r6, =MMU_NORMAL
+    bl map_sections
+
+    mov r0, r4
+    ldr r1, =SRAM_UNCACHED_VIRT
+    mov r2, r9
+    mov r3, r8
+    ldr r6, =MMU_UNCACHED
+    bl map_sections
+1:
+    // Map the peripheral windows of this board
+    ldr r8, =mmu_io_regions
+    add r8, r8, r11
+    ldr r9, =mmu_io_region_count
+    add r9, r9, r11
+    ldr r9, [r9]
+1:  cmp r9, #0
+    beq 2f
+    mov r0, r4
+    ldmia r8!, {r1, r2, r3, r6}
+    bl map_sections
+    sub r9, r9, #1
+    b 1b
+2:
+    // The tables are written with the caches off. Invalidate any stale cache, TLB and
+    // branch predictor contents before the MMU is turned on
+    bl dcache_invalidate
+    b mmu_enable
+
+// Enables the MMU and the caches of a secondary core with the tables built by the boot
+// core. This must be called with the MMU off, and the physical offset in r0 as for
+// mmu_early_init. Only the caches private to this core are invalidated, since the outer
+// levels hold data of the running cores
+.global mmu_secondary_init
+.type mmu_secondary_init, %function
+mmu_secondary_init:
+
+    stmdb sp!, {r4-r11, lr}
+    mov r11, r0
+
+    ldr r4, =kernel_page_table
+    add r4, r4, r11
+    ldr r5, =boot_page_table
+    add r5, r5, r11
+
+    bl dcache_invalidate_local
+
+mmu_enable:
+    mov r0, #0
+    mcr p15, 0, r0, c8, c7, 0    // TLBIALL
+    mcr p15, 0, r0, c7, c5, 0    // ICIALLU
+    mcr p15, 0, r0, c7, c5, 6    // BPIALL
+    dsb
+
+    // Select cacheable write-back table walks. The bit layout of TTBR depends on whether
+    // the core implements the multiprocessing extensions
+    mrc p15, 0, r0, c0, c0, 5
+    tst r0, #(1 << 31)
+.ifdef SMP
+    movne r1, #0x4A              // IRGN = RGN = write-back write-allocate, shareable
+.else
+    movne r1, #0x48              // IRGN = RGN = write-back write-allocate
+.endif
+    moveq r1, #0x09              // Inner cacheable, RGN = write-back write-allocate
+
+    // TTBR0 translates the lower 2 GiB and TTBR1 the upper 2 GiB
+    mov r0, #1
+    mcr p15, 0, r0, c2, c0, 2    // TTBCR
+    orr r0, r5, r1
+    mcr p15, 0, r0, c2, c0, 0    // TTBR0
+    orr r0, r4, r1
+    mcr p15, 0, r0, c2, c0, 1    // TTBR1
+
+    // Domain 0 is client, so the access permissions are checked
+    mov r0, #1
+    mcr p15, 0, r0, c3, c0, 0
+
+    // The boot mapping uses ASID 0
+    mov r0, #0
+    mcr p15, 0, r0, c13, c0, 1   // CONTEXTIDR
+    isb
+
+.ifdef SMP
+    // Join the coherency domain before the caches are turned on. The bit is only written
+    // if it is clear, since the non-secure side might not be allowed to write it
+    mrc p15, 0, r0, c1, c0, 1    // ACTLR
+    tst r0, #(1 << 6)
+    orreq r0, r0, #(1 << 6)
+    mcreq p15, 0, r0, c1, c0, 1
+    isb
+.endif
+
+    // Enable the MMU, the caches and branch prediction. Disable alignment checks, TEX
+    // remap and the access flag, and use the low exception vectors
+    mrc p15, 0, r0, c1, c0, 0
+    bic r0, r0, #(1 << 1)
+    bic r0, r0, #(1 << 13)
+    bic r0, r0, #(3 << 28)
+    orr r0, r0, #(1 << 0)
+    orr r0, r0, #(1 << 2)
+    orr r0, r0, #(1 << 11)
+    orr r0, r0, #(1 << 12)
+    mcr p15, 0, r0, c1, c0, 0
+    isb
+
+    ldmia sp!, {r4-r11, lr}
+    bx lr
+
+// Cleans the data cache, turns off the MMU and the caches, and jumps to the physical
+// address in r0 with r1 passed in r0. This is used to start a new kernel, which expects
+// to be entered with the MMU off
+.global kernel_jump
+.type kernel_jump, %function
+kernel_jump:
+
+    cpsid if
+    mov r4, r0
+    mov r5, r1
+
+    // Write back everything, including the new kernel image. The new kernel starts with
+    // the caches off, so the outer cache must be off as well
+    bl dcache_clean
+    bl outer_disable
+
+    // A server address space might be active. Go back to the boot identity mapping
+    ldr r0, =boot_page_table
+    ldr r1, =_kernel_s
+    ldr r2, =ddr_start
+    sub r0, r0, r1
+    add r0, r0, r2
+    mov r1, #0
+    bl mmu_switch_ttbr0
+
+    // Continue on the physical alias of this code, which is identity mapped in TTBR0
+    ldr r0, =kernel_jump_phys
+    ldr r1, =_kernel_s
+    ldr r2, =ddr_start
+    sub r0, r0, r1
+    add r0, r0, r2
+    bx r0
+
+kernel_jump_phys:
+    mrc p15, 0, r0, c1, c0, 0
+    bic r0, r0, #(1 << 0)
+    bic r0, r0, #(1 << 2)
+    bic r0, r0, #(1 << 11)
+    bic r0, r0, #(1 << 12)
+    mcr p15, 0, r0, c1, c0, 0
+    isb
+
+    mov r0, #0
+    mcr p15, 0, r0, c8, c7, 0    // TLBIALL
+    mcr p15, 0, r0, c7, c5, 0    // ICIALLU
+    mcr p15, 0, r0, c7, c5, 6    // BPIALL
+    dsb
+    isb
+
+    // No device tree is passed on. It might have been overwritten by the new kernel
+    mov r0, r5
+    mov r1, #0
+    mov r2, #0
+    bx r4
+
+// Installs the translation table at physical address r0 in TTBR0 together with the ASID
+// in r1. The table walk attributes are taken from TTBR1. TTBR0 walks are disabled while
+// the two registers are updated, so no walk can see the new ASID with the old table
+.global mmu_switch_ttbr0
+.type mmu_switch_ttbr0, %function
+mmu_switch_ttbr0:
+
+    mrc p15, 0, r2, c2, c0, 1    // TTBR1
+    and r2, r2, #0x7F
+    orr r0, r0, r2
+
+    mrc p15, 0, r2, c2, c0, 2    // TTBCR
+    orr r3, r2, #(1 << 4)        // PD0
+    mcr p15, 0, r3, c2, c0, 2
+    isb
+    and r1, r1, #0xFF
+    mcr p15, 0, r1, c13, c0, 1   // CONTEXTIDR
+    isb
+    mcr p15, 0, r0, c2, c0, 0    // TTBR0
+    isb
+    mcr p15, 0, r2, c2, c0, 2    // TTBCR
+    isb
+    bx lr
+
+// TLB maintenance. With the multiprocessing extensions the inner shareable forms are
+// used, so all cores in the cluster see the operation
+
+// Invalidates the entire unified TLB
+.global tlb_invalidate_all
+.type tlb_invalidate_all, %function
+tlb_invalidate_all:
+
+    mov r0, #0
+    mrc p15, 0, r1, c0, c0, 5    // MPIDR
+    tst r1, #(1 << 31)
+    dsb
+    mcrne p15, 0, r0, c8, c3, 0  // TLBIALLIS
+    mcreq p15, 0, r0, c8, c7, 0  // TLBIALL
+    mcrne p15, 0, r0, c7, c1, 6  // BPIALLIS
+    mcreq p15, 0, r0, c7, c5, 6  // BPIALL
+    dsb
+    isb
+    bx lr
+
+// Invalidates all non-global entries tagged with the ASID in r0
+.global tlb_invalidate_asid
+.type tlb_invalidate_asid, %function
+tlb_invalidate_asid:
+
+    and r0, r0, #0xFF
+    mrc p15, 0, r1, c0, c0, 5
+    tst r1, #(1 << 31)
+    dsb
+    mcrne p15, 0, r0, c8, c3, 2  // TLBIASIDIS
+    mcreq p15, 0, r0, c8, c7, 2  // TLBIASID
+    dsb
+    isb
+    bx lr
+
+// Invalidates the entry for the virtual address in r0 tagged with the ASID in r1
+.global tlb_invalidate_page
+.type tlb_invalidate_page, %function
+tlb_invalidate_page:
+
+    bic r0, r0, #0xFF0
+    bic r0, r0, #0x00F
+    and r1, r1, #0xFF
+    orr r0, r0, r1
+    mrc p15, 0, r1, c0, c0, 5
+    tst r1, #(1 << 31)
+    dsb
+    mcrne p15, 0, r0, c8, c3, 1  // TLBIMVAIS
+    mcreq p15, 0, r0, c8, c7, 1  // TLBIMVA
+    dsb
+    isb
+    bx lr
+
+.ltorg
@@ -0,0 +1,112 @@
+// Secondary core entry for SMP boards
+
+.syntax unified
+.cpu cortex-a7
+.arm
+.arch_extension sec
+.arch_extension virt
+
+.extern stacks_init
+.extern mmu_secondary_init
+.extern smp_secondary_main
+
+// The board code releases a secondary core here at the physical address, with the MMU and
+// the caches off. The core sets up its own stacks, turns on the MMU with the tables built
+// by the boot core and continues in smp_secondary_main at the virtual address
+.text
+.global secondary_entry
+.type secondary_entry, %function
+secondary_entry:
+
+    cpsid afi
+
+    // The core number is the lowest affinity level. All cores are in one cluster
+    mrc p15, 0, r4, c0, c0, 5    // MPIDR
+    and r4, r4, #0xFF
+
+    // Adding r11 to a linked address gives the physical address
+    adr r0, secondary_entry
+    ldr r1, =secondary_entry
+    sub r11, r0, r1
+
+    // Use the physical address of the stacks until the MMU is on
+    mov r0, r4
+    mov r1, r11
+    bl stacks_init
+
+    mov r0, r11
+    bl mmu_secondary_init
+
+    ldr r0, =secondary_virtual_entry
+    bx r0
+
+secondary_virtual_entry:
+    mov r0, r4
+    mov r1, #0
+    bl stacks_init
+
+    mov r0, r4
+    ldr r1, =smp_secondary_main
+    bx r1
+
+// Stops this core for good. The data cache is turned off, its contents are written back
+// and the core leaves the coherency domain. Then 1 is written to the word at r0, which
+// must have a cache line of its own. Nothing is left on the stack, since the cache might
+// be written back on top of it, and the core never returns
+.global cpu_park
+.type cpu_park, %function
+cpu_park:
+
+    mrc p15, 0, r1, c1, c0, 0
+    bic r1, r1, #(1 << 2)
+    mcr p15, 0, r1, c1, c0, 0
+    isb
+
+    // Clean and invalidate the L1 data cache by set/way. The L2 is shared and is written
+    // back by the boot core
+    mov r1, #0
+    mcr p15, 2, r1, c0, c0, 0    // CSSELR
+    isb
+    mrc p15, 1, r1, c0, c0, 0    // CCSIDR
+    and r2, r1, #7
+    add r2, r2, #4               // Set shift
+    ubfx r5, r1, #3, #10         // Highest way number
+    clz r6, r5                   // Way shift
+    ubfx r7, r1, #13, #15        // Highest set number
+
+1:  mov r3, r5
+2:  lsl r1, r3, r6
+    orr r1, r1, r7, lsl r2
+    mcr p15, 0, r1, c7, c14, 2   // DCCISW
+    subs r3, r3, #1
+    bge 2b
+    subs r7, r7, #1
+    bge 1b
+    dsb
+
+    mrc p15, 0, r1, c1, c0, 1    // ACTLR
+    bic r1, r1, #(1 << 6)
+    mcr p15, 0, r1, c1, c0, 1
+    isb
+
+    mov r1, #1
+    str r1, [r0]
+    dsb
+
+3:  wfi
+    b 3b
+
+// Calls the PSCI firmware with the function ID in r0 and the arguments in r1-r3. The
+// result is returned in r0. The firmware either sits in the secure monitor or in the
+// hypervisor, and the device tree tells which
+.global psci_call_smc
+.type psci_call_smc, %function
+psci_call_smc:
+    smc #0
+    bx lr
+
+.global psci_call_hvc
+.type psci_call_hvc, %function
+psci_call_hvc:
+    hvc #0
+    bx lr
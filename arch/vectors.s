@@ -0,0 +1,58 @@
+// Exception vectors for the ARMv7-A kernel
+
+.syntax unified
+.cpu cortex-a5
+.arm
+
+.extern irq_dispatch
+.extern panic
+
+// Only IRQs are used. Every other exception is a bug and ends in a panic. The table and
+// the IRQ entry live in the cached SRAM window, which is mapped before vectors_init runs.
+// VBAR needs the table on a 32-byte boundary, which the .sram output section keeps
+.section .ramfunc, "ax"
+.balign 32
+vector_table:
+    b vector_unhandled    // Reset
+    b vector_unhandled    // Undefined instruction
+    b vector_unhandled    // Supervisor call
+    b vector_unhandled    // Prefetch abort
+    b vector_unhandled    // Data abort
+    b vector_unhandled    // Reserved
+    b vector_irq
+    b vector_unhandled    // FIQ
+
+// Runs on the IRQ stack of the core. The handlers are plain C functions, so only the
+// registers the calling convention lets them clobber are saved. Six registers keep the
+// stack 8-byte aligned. The kernel is out of branch range from SRAM, so C is called
+// through a register
+vector_irq:
+    sub lr, lr, #4
+    push {r0-r3, r12, lr}
+    ldr r12, =irq_dispatch
+    blx r12
+    ldm sp!, {r0-r3, r12, pc}^
+
+vector_unhandled:
+    ldr r0, =unhandled_message
+    ldr r1, =panic
+    blx r1
+1:  b 1b
+
+.text
+// Points VBAR at the table of this kernel and turns off the high vectors the bootloader
+// might have selected
+.global vectors_init
+.type vectors_init, %function
+vectors_init:
+    mrc p15, 0, r0, c1, c0, 0
+    bic r0, r0, #(1 << 13)
+    mcr p15, 0, r0, c1, c0, 0
+    ldr r0, =vector_table
+    mcr p15, 0, r0, c12, c0, 0    // VBAR
+    isb
+    bx lr
+
+.section .rodata
+unhandled_message:
+    .asciz "Unhandled exception"
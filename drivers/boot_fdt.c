@@ -0,0 +1,42 @@
+// Device tree passed by the bootloader
+
+#include <chaos/fdt.h>
+#include <chaos/boot_args.h>
+#include <chaos/initcall.h>
+#include <chaos/kprint.h>
+#include <chaos/mmu.h>
+
+static struct fdt fdt;
+static struct fdt_index fdt_index;
+static u32 fdt_valid;
+
+// Returns the device tree from the bootloader, or NULL if there is none
+struct fdt* boot_fdt() {
+    return fdt_valid ? &fdt : NULL;
+}
+
+// Forgets the tree. This is called before anything might overwrite it, such as a soft
+// reboot staging the next kernel
+void boot_fdt_drop() {
+    fdt_valid = 0;
+}
+
+// The tree is used if r2 points into the DDR. A kernel started by a soft reboot gets none
+static i32 boot_fdt_init() {
+    u32 phys = boot_args[BOOT_ARG_DTB];
+    u32 ddr_end = (u32)ddr_start + (u32)ddr_size;
+
+    if (phys < (u32)ddr_start || phys >= ddr_end || (phys & 3)) {
+        return 0;
+    }
+    if (fdt_init(&fdt, phys_to_virt(phys), ddr_end - phys, &fdt_index)) {
+        return 0;
+    }
+    fdt_valid = 1;
+
+    const char* model = fdt_prop(&fdt, fdt_path(&fdt, "/"), "model", NULL);
+    kprint("Device tree at {p}: {s}\n", phys, model ? model : "unknown model");
+    return 0;
+}
+
+INITCALL(fdt, boot_fdt_init, NULL);
@@ -9,7 +9,15 @@
 
 static char boot_message_buf[BOOT_BUF_SIZE];
 
+// Added to the timer, so that a kernel started by a soft reboot continues the timestamps
+// of the old kernel
+static u32 boot_time_offset;
+static u32 boot_timer_running;
+
 void boot_start_timer() {
+    boot_time_offset = 0;
+    boot_timer_running = 1;
+
     const struct timer_iface* timer = get_timer();
     if (!timer) {
         panic("Wrong");
@@ -24,12 +32,30 @@ void boot_start_timer() {
     }
 }
 
+// Makes the boot time continue from `time` ms. A running timer is not restarted, so
+// anyone timing an interval with the timer itself is not affected
+void boot_resume_timer(u32 time) {
+    if (boot_timer_running == 0) {
+        boot_start_timer();
+    }
+    boot_time_offset = time - get_timer()->get_time();
+}
+
+// Returns the time in ms since the timer was started, or 0 if there is no timer
+u32 boot_get_time() {
+    const struct timer_iface* timer = get_timer();
+    if (timer && timer->get_time) {
+        return boot_time_offset + timer->get_time();
+    }
+    return 0;
+}
+
 void boot_message(const char* message, ...) {
     // Log the timestamp
     const struct timer_iface* timer = get_timer();
     if (timer) {
         if (timer->get_time) {
-            u32 time = timer->get_time();
+            u32 time = boot_get_time();
             kprint("[{3:u}.{0:3:u}] ", time / 1000, time % 1000);
         }
     }
@@ -0,0 +1,136 @@
+// PL310 L2 cache controller driver (kernel driver)
+
+#include <chaos/cache.h>
+#include <chaos/mmu.h>
+
+#ifdef ZYNQ
+#include <zynq/regmap.h>
+#else
+#include <sama5d2/regmap.h>
+#endif
+
+#define L2_LINE_SIZE 32
+
+// Mask with one bit per way. The controller has either 8 or 16 ways
+static u32 way_mask;
+
+// Total cache size. A clean of a range larger than this is done by way
+static u32 cache_size;
+
+static u32 enabled;
+
+// Drains the write buffers of the controller
+static void pl310_sync() {
+    struct l2cache_reg* const hw = L2CAHCE_REG;
+    hw->csr = 0;
+    while (hw->csr & 1);
+}
+
+// Starts a background operation on all ways and waits for it to complete
+static void pl310_way_op(_rw u32* reg) {
+    *reg = way_mask;
+    while (*reg & way_mask);
+    pl310_sync();
+}
+
+// Runs an operation by physical address on every line in the virtual range start..end
+static void pl310_range_op(_rw u32* reg, u32 start, u32 end) {
+    u32 addr = virt_to_phys((void *)start) & ~(L2_LINE_SIZE - 1);
+    u32 stop = virt_to_phys((void *)end);
+
+    while (addr < stop) {
+        *reg = addr;
+        addr += L2_LINE_SIZE;
+    }
+    pl310_sync();
+}
+
+// Invalidates and enables the L2 cache with instruction and data prefetch, double
+// linefill and early write response
+void outer_cache_init() {
+    struct l2cache_reg* const hw = L2CAHCE_REG;
+
+    way_mask = (hw->acr & (1 << 16)) ? 0xFFFF : 0xFF;
+
+    // The bootloader might have left the cache on
+    if (hw->cr & 1) {
+        pl310_way_op(&hw->ciwr);
+        hw->cr = 0;
+    }
+
+#ifndef ZYNQ
+    // Give SRAM1 to the L2 cache as data RAM
+    SFR_REG->l2cc_hramc = 1;
+#endif
+
+    // The way size field gives 16 KiB << (n - 1)
+    u32 way_size = (16 * 1024) << (((hw->acr >> 17) & 0b111) - 1);
+    cache_size = way_size * ((way_mask == 0xFF) ? 8 : 16);
+
+    // Enable instruction and data prefetch and early BRESP
+    hw->acr |= (1 << 28) | (1 << 29) | (1 << 30);
+
+    // Double linefill on both wrapping and incrementing reads, prefetch drop and a
+    // prefetch offset of 7 lines. The prefetch enable bits mirror the ones in ACR
+    hw->pcr = (1 << 30) | (1 << 29) | (1 << 28) | (1 << 24) | (1 << 23) | 7;
+
+    // Clear and mask all interrupts
+    hw->icr = 0x1FF;
+
+    pl310_way_op(&hw->iwr);
+    hw->cr = 1;
+    enabled = 1;
+}
+
+void outer_clean_range(u32 start, u32 end) {
+    if (enabled == 0) {
+        return;
+    }
+    if (end - start >= cache_size) {
+        pl310_way_op(&L2CAHCE_REG->cwr);
+    } else {
+        pl310_range_op(&L2CAHCE_REG->cpalr, start, end);
+    }
+}
+
+// Invalidates a range. This is always done by line, since invalidating a way would throw
+// away dirty data outside the range
+void outer_invalidate_range(u32 start, u32 end) {
+    if (enabled) {
+        pl310_range_op(&L2CAHCE_REG->ipalr, start, end);
+    }
+}
+
+void outer_clean_invalidate_range(u32 start, u32 end) {
+    if (enabled == 0) {
+        return;
+    }
+    if (end - start >= cache_size) {
+        pl310_way_op(&L2CAHCE_REG->ciwr);
+    } else {
+        pl310_range_op(&L2CAHCE_REG->cipalr, start, end);
+    }
+}
+
+void outer_clean_all() {
+    if (enabled) {
+        pl310_way_op(&L2CAHCE_REG->cwr);
+    }
+}
+
+void outer_flush_all() {
+    if (enabled) {
+        pl310_way_op(&L2CAHCE_REG->ciwr);
+    }
+}
+
+// Cleans, invalidates and disables the L2 cache. This must be done before jumping to a
+// new kernel with the caches off
+void outer_disable() {
+    if (enabled) {
+        pl310_way_op(&L2CAHCE_REG->ciwr);
+        L2CAHCE_REG->cr = 0;
+        pl310_sync();
+        enabled = 0;
+    }
+}
@@ -0,0 +1,149 @@
+// Runs the initcalls collected in the .initcall section
+
+#include <chaos/initcall.h>
+#include <chaos/boot_message.h>
+#include <chaos/timer.h>
+#include <chaos/kprint.h>
+#include <chaos/panic.h>
+
+#define INITCALL_MAX 32
+
+// Initcall states
+#define INITCALL_WAITING 0
+#define INITCALL_RUNNING 1
+#define INITCALL_DONE    2
+#define INITCALL_FAILED  3
+#define INITCALL_SKIPPED 4
+
+// Symbols from the linker script
+extern const struct initcall _initcall_s[];
+extern const struct initcall _initcall_e[];
+
+// Run state of each initcall. The times are in ms from the boot timer
+struct initcall_state {
+    u32 state;
+    i32 status;
+    u32 start;
+    u32 end;
+};
+
+static struct initcall_state states[INITCALL_MAX];
+static u32 initcall_count;
+
+// Returns the time in ms since initcall_run_all started the timer. This reads the timer
+// directly, since an initcall might move the boot time when it resumes after a soft reboot
+static u32 initcall_time() {
+    const struct timer_iface* timer = get_timer();
+    if (timer && timer->get_time) {
+        return timer->get_time();
+    }
+    return 0;
+}
+
+static u32 initcall_index(const struct initcall* call) {
+    return call - _initcall_s;
+}
+
+// Returns INITCALL_DONE if all dependencies are done, INITCALL_SKIPPED if any of them
+// failed or was skipped, and INITCALL_WAITING otherwise
+static u32 initcall_deps_state(const struct initcall* call) {
+    u32 result = INITCALL_DONE;
+    for (u32 i = 0; i < call->dep_count; i++) {
+        u32 state = states[initcall_index(call->deps[i])].state;
+        if (state == INITCALL_FAILED || state == INITCALL_SKIPPED) {
+            return INITCALL_SKIPPED;
+        }
+        if (state != INITCALL_DONE) {
+            result = INITCALL_WAITING;
+        }
+    }
+    return result;
+}
+
+static void initcall_complete(u32 index, i32 status) {
+    states[index].end = initcall_time();
+    states[index].status = status;
+    states[index].state = status ? INITCALL_FAILED : INITCALL_DONE;
+}
+
+// Runs all initcalls. Each pass starts the initcalls whose dependencies are done and
+// polls the running ones, so slow initcalls overlap with everything that does not need
+// them. This returns when no initcall can make more progress
+void initcall_run_all() {
+    initcall_count = _initcall_e - _initcall_s;
+    if (initcall_count > INITCALL_MAX) {
+        panic("Too many initcalls");
+    }
+
+    // The report is timed from here if the board has a timer
+    if (get_timer()) {
+        boot_start_timer();
+    }
+
+    u32 active = 1;
+    while (active) {
+        active = 0;
+
+        for (u32 i = 0; i < initcall_count; i++) {
+            const struct initcall* call = &_initcall_s[i];
+            struct initcall_state* state = &states[i];
+
+            if (state->state == INITCALL_WAITING) {
+                u32 deps = initcall_deps_state(call);
+                if (deps == INITCALL_SKIPPED) {
+                    state->state = INITCALL_SKIPPED;
+                    active = 1;
+                } else if (deps == INITCALL_DONE) {
+                    state->start = initcall_time();
+                    i32 status = call->start();
+                    if (status == 0 && call->poll) {
+                        state->state = INITCALL_RUNNING;
+                    } else {
+                        initcall_complete(i, status);
+                    }
+                    active = 1;
+                }
+            } else if (state->state == INITCALL_RUNNING) {
+                i32 status = call->poll();
+                if (status != INITCALL_PENDING) {
+                    initcall_complete(i, status);
+                }
+                active = 1;
+            }
+        }
+    }
+
+    // Anything still waiting is part of a dependency cycle
+    for (u32 i = 0; i < initcall_count; i++) {
+        if (states[i].state == INITCALL_WAITING) {
+            states[i].state = INITCALL_SKIPPED;
+        }
+    }
+}
+
+// Prints the start time, the duration and the result of each initcall
+void initcall_report() {
+    static const char* const names[] = {
+        [INITCALL_WAITING] = "waiting",
+        [INITCALL_RUNNING] = "running",
+        [INITCALL_DONE]    = "done",
+        [INITCALL_FAILED]  = "failed",
+        [INITCALL_SKIPPED] = "skipped",
+    };
+
+    kprint("Boot report:\n");
+    for (u32 i = 0; i < initcall_count; i++) {
+        const struct initcall_state* state = &states[i];
+        u32 time = 0;
+        if (state->state == INITCALL_DONE || state->state == INITCALL_FAILED) {
+            time = state->end - state->start;
+        }
+
+        kprint("  {<:16:s}{6:u} ms {6:u} ms  {s}", _initcall_s[i].name, state->start,
+            time, names[state->state]);
+        if (state->state == INITCALL_FAILED) {
+            kprint(" ({i})", state->status);
+        }
+        kprint("\n");
+    }
+}
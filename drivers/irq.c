@@ -0,0 +1,59 @@
+// IRQ dispatch on top of the interrupt controller of the board
+
+#include <chaos/irq.h>
+#include <chaos/initcall.h>
+#include <chaos/kprint.h>
+#include <chaos/status.h>
+
+static void (*irq_handlers[IRQ_COUNT])();
+static const struct irq_iface* irq_ctrl;
+
+// Interrupts that had no handler, or that were gone by the time they were acknowledged
+static u32 irq_spurious;
+
+// Called from the IRQ vector in arch/vectors.s with IRQs masked
+void irq_dispatch() {
+    u32 irq = irq_ctrl->ack();
+    if (irq < IRQ_COUNT && irq_handlers[irq]) {
+        irq_handlers[irq]();
+    } else {
+        irq_spurious++;
+    }
+
+    if (irq != IRQ_SPURIOUS) {
+        irq_ctrl->eoi(irq);
+    }
+}
+
+i32 irq_init() {
+    irq_ctrl = get_irq();
+    if (irq_ctrl == NULL) {
+        return -ERR_NOT_FOUND;
+    }
+
+    irq_ctrl->init();
+    vectors_init();
+    irq_local_enable();
+    return 0;
+}
+
+i32 irq_register(u32 irq, void (*handler)()) {
+    if (irq_ctrl == NULL || irq >= IRQ_COUNT) {
+        return -ERR_NOT_FOUND;
+    }
+
+    irq_handlers[irq] = handler;
+    irq_ctrl->enable(irq);
+    return 0;
+}
+
+// A board without an interrupt controller is not an error. The drivers see that
+// irq_register fails and keep polling
+static i32 irq_initcall() {
+    if (irq_init()) {
+        kprint("No interrupt controller - drivers will poll\n");
+    }
+    return 0;
+}
+
+INITCALL(irq, irq_initcall, NULL);
@@ -0,0 +1,67 @@
+// Interrupt controller driver for SAMA5D2 chips (kernel driver)
+
+#include <chaos/irq.h>
+#include <sama5d2/regmap.h>
+
+// The AIC serves the non-secure interrupts on nIRQ. Each source is selected through the
+// source select register before it is configured
+#define AIC_SOURCES 128
+
+// Internal sources are level sensitive. All sources share one priority, so the AIC never
+// nests interrupts
+#define AIC_PRIORITY 1
+
+void aic_init() {
+    struct apic_reg* const aic = APIC_REG;
+
+    // End the interrupts the bootloader might have left in service. The AIC keeps a
+    // stack of eight priority levels
+    for (u32 i = 0; i < 8; i++) {
+        aic->eoicr = 0;
+    }
+
+    aic->spu = IRQ_SPURIOUS;
+    aic->dcr = 0;
+
+    // The source number is used as the vector, so the IVR gives the interrupt number
+    for (u32 i = 0; i < AIC_SOURCES; i++) {
+        aic->ssr = i;
+        aic->svr = i;
+        aic->idcr = 1;
+        aic->iccr = 1;
+    }
+}
+
+void aic_enable(u32 irq) {
+    struct apic_reg* const aic = APIC_REG;
+    aic->ssr = irq;
+    aic->smr = AIC_PRIORITY;
+    aic->iecr = 1;
+}
+
+// Reading the IVR starts the service of the interrupt. If the interrupt is gone again the
+// read still pushes a level, so it must be ended here
+u32 aic_ack() {
+    struct apic_reg* const aic = APIC_REG;
+    u32 irq = aic->ivr;
+    if (aic->isr == 0) {
+        aic->eoicr = 0;
+        return IRQ_SPURIOUS;
+    }
+    return irq;
+}
+
+void aic_eoi(u32 irq) {
+    APIC_REG->eoicr = 0;
+}
+
+const struct irq_iface sama5d2_irq_iface = {
+    .init = aic_init,
+    .enable = aic_enable,
+    .ack = aic_ack,
+    .eoi = aic_eoi
+};
+
+const struct irq_iface* get_irq() {
+    return &sama5d2_irq_iface;
+}
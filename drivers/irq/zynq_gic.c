@@ -0,0 +1,59 @@
+// Interrupt controller driver for Xilinx Zynq-7000 chips (kernel driver)
+
+#include <chaos/irq.h>
+#include <zynq/regmap.h>
+
+// Interrupt IDs from 1020 and up mean that nothing is pending
+#define GIC_SPURIOUS 1020
+
+// Every interrupt gets the same priority, above the priority mask. The shared interrupts
+// all go to core 0, which runs the bottom halves
+#define GIC_PRIORITY 0xA0
+#define GIC_PRIORITY_MASK 0xF0
+
+void gic_init() {
+    struct gic_dist_reg* const dist = GIC_DIST_REG;
+    struct gic_cpu_reg* const cpu = GIC_CPU_REG;
+
+    dist->dcr = 0;
+
+    // Disable and clear every interrupt. The first 32 are private to each core
+    u32 lines = ((dist->ictr & 0x1F) + 1) * 32;
+    for (u32 i = 0; i < lines / 32; i++) {
+        dist->icer[i] = 0xFFFFFFFF;
+        dist->icpr[i] = 0xFFFFFFFF;
+    }
+
+    dist->dcr = 1;
+
+    cpu->pmr = GIC_PRIORITY_MASK;
+    cpu->bpr = 0;
+    cpu->icr = 1;
+}
+
+void gic_enable(u32 irq) {
+    struct gic_dist_reg* const dist = GIC_DIST_REG;
+    dist->ipr[irq] = GIC_PRIORITY;
+    dist->iptr[irq] = 1;
+    dist->iser[irq / 32] = 1 << (irq % 32);
+}
+
+u32 gic_ack() {
+    u32 irq = GIC_CPU_REG->iar & 0x3FF;
+    return (irq >= GIC_SPURIOUS) ? IRQ_SPURIOUS : irq;
+}
+
+void gic_eoi(u32 irq) {
+    GIC_CPU_REG->eoir = irq;
+}
+
+const struct irq_iface zynq_irq_iface = {
+    .init = gic_init,
+    .enable = gic_enable,
+    .ack = gic_ack,
+    .eoi = gic_eoi
+};
+
+const struct irq_iface* get_irq() {
+    return &zynq_irq_iface;
+}
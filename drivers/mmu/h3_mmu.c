@@ -0,0 +1,10 @@
+// Peripheral memory map for Allwinner H3 chips
+
+#include <chaos/mmu.h>
+
+const struct mmu_region mmu_io_regions[] = {
+    // System peripherals, CPU configuration and the R_ domain
+    { IO_LOW(0x01C00000), 0x01C00000, 0x00400000, MMU_DEVICE },
+};
+
+const u32 mmu_io_region_count = sizeof(mmu_io_regions) / sizeof(struct mmu_region);
@@ -0,0 +1,17 @@
+// Peripheral memory map for SAMA5D2 chips
+
+#include <chaos/mmu.h>
+
+const struct mmu_region mmu_io_regions[] = {
+    // L2 cache controller
+    { IO_LOW(0x00A00000), 0x00A00000, 0x00100000, MMU_DEVICE },
+
+    // SDMMC0 and SDMMC1
+    { 0xA0000000, 0xA0000000, 0x00100000, MMU_DEVICE },
+    { 0xB0000000, 0xB0000000, 0x00100000, MMU_DEVICE },
+
+    // Peripheral bridges and system controller
+    { 0xF0000000, 0xF0000000, 0x10000000, MMU_DEVICE },
+};
+
+const u32 mmu_io_region_count = sizeof(mmu_io_regions) / sizeof(struct mmu_region);
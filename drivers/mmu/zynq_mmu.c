@@ -0,0 +1,10 @@
+// Peripheral memory map for Xilinx Zynq-7000 chips
+
+#include <chaos/mmu.h>
+
+const struct mmu_region mmu_io_regions[] = {
+    // I/O peripherals, SLCR and the private CPU peripherals including the L2 controller
+    { 0xE0000000, 0xE0000000, 0x19000000, MMU_DEVICE },
+};
+
+const u32 mmu_io_region_count = sizeof(mmu_io_regions) / sizeof(struct mmu_region);
@@ -0,0 +1,97 @@
+// Statistics counters for the NIC drivers and the kernel network stack
+
+#include <chaos/net_stats.h>
+#include <chaos/netbuf.h>
+#include <chaos/kprint.h>
+#include <chaos/mem.h>
+#include <chaos/nic.h>
+
+struct proto_stats proto_stats;
+
+// Clears both the protocol counters and the NIC counters
+void net_stats_reset() {
+    mem_set(&proto_stats, 0, sizeof(struct proto_stats));
+    nic_clear_stats();
+}
+
+// Takes a snapshot of all the counters. This will fold the NIC hardware counters first
+void net_stats_snapshot(struct net_stats_snapshot* snapshot) {
+    snapshot->magic = NET_STATS_MAGIC;
+    snapshot->version = NET_STATS_VERSION;
+    snapshot->size = sizeof(struct net_stats_snapshot);
+    snapshot->reserved = 0;
+
+    nic_get_stats(&snapshot->nic);
+    mem_copy(&proto_stats, &snapshot->proto, sizeof(struct proto_stats));
+}
+
+// The print format only handles 32-bit numbers, so 64-bit counters are converted to a
+// string first. The string must be at least 21 characters
+static void u64_to_string(char* str, u64 val) {
+    char tmp[20];
+    u32 index = 0;
+
+    do {
+        tmp[index++] = (val % 10) + '0';
+        val /= 10;
+    } while (val);
+
+    while (index) {
+        *str++ = tmp[--index];
+    }
+    *str = 0;
+}
+
+static void print_counter(const char* name, u64 val) {
+    char str[21];
+    u64_to_string(str, val);
+    kprint("  {<:24:s}{s}\n", name, str);
+}
+
+void net_stats_print() {
+    struct net_stats_snapshot snapshot;
+    net_stats_snapshot(&snapshot);
+
+    const struct nic_stats* nic = &snapshot.nic;
+    kprint("NIC counters:\n");
+    print_counter("rx frames", nic->rx_frames);
+    print_counter("tx frames", nic->tx_frames);
+    print_counter("rx octets", nic->rx_octets);
+    print_counter("tx octets", nic->tx_octets);
+    print_counter("rx fcs errors", nic->rx_fcs_errors);
+    print_counter("rx length errors", nic->rx_length_errors);
+    print_counter("rx alignment errors", nic->rx_alignment_errors);
+    print_counter("rx symbol errors", nic->rx_symbol_errors);
+    print_counter("rx overruns", nic->rx_overruns);
+    print_counter("rx resource errors", nic->rx_resource_errors);
+    print_counter("rx undersize", nic->rx_undersize);
+    print_counter("rx oversize", nic->rx_oversize);
+    print_counter("rx checksum errors", nic->rx_checksum_errors);
+    print_counter("tx underruns", nic->tx_underruns);
+    print_counter("tx collisions", nic->tx_collisions);
+    print_counter("tx late collisions", nic->tx_late_collisions);
+    print_counter("poll interrupts", nic->poll_interrupts);
+    print_counter("poll budget full", nic->poll_budget_full);
+
+    const struct proto_stats* proto = &snapshot.proto;
+    kprint("Protocol counters:\n");
+    print_counter("rx packets", proto->rx_packets);
+    print_counter("rx runts", proto->rx_runts);
+    print_counter("rx unknown ethertype", proto->rx_unknown_ethertype);
+    print_counter("rx arp", proto->rx_arp);
+    print_counter("tx arp replies", proto->tx_arp_replies);
+    print_counter("arp retransmits", proto->arp_retransmits);
+    print_counter("arp dropped", proto->arp_dropped);
+    print_counter("rx ip dropped", proto->rx_ip_dropped);
+    print_counter("rx udp bad port", proto->rx_udp_bad_port);
+    print_counter("tftp rx blocks", proto->tftp_rx_blocks);
+    print_counter("tftp rx bytes", proto->tftp_rx_bytes);
+    print_counter("tftp duplicates", proto->tftp_duplicates);
+    print_counter("tftp out of order", proto->tftp_out_of_order);
+    print_counter("tftp bad opcode", proto->tftp_bad_opcode);
+    print_counter("tftp tx acks", proto->tftp_tx_acks);
+    print_counter("rx no buffer", proto->rx_no_buffer);
+    print_counter("tx no buffer", proto->tx_no_buffer);
+
+    netbuf_print_stats();
+}
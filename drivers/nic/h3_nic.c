@@ -1,15 +1,56 @@
 // NIC driver for Allwinner H3 chips (kernel driver)
 
 #include <chaos/nic.h>
+#include <chaos/mem.h>
 
 void nic_init() {
     
 }
 
+void nic_init_start() {
+
+}
+
+u32 nic_init_poll() {
+    return 0;
+}
+
+void nic_resume(const struct handoff* handoff) {
+    nic_init();
+}
+
+void nic_save_link(struct handoff* handoff) {
+
+}
+
+void nic_stop() {
+
+}
+
 struct netbuf* nic_receive() {
     return NULL;
 }
 
 void nic_send(struct netbuf* buf) {
+    free_netbuf(buf);
+}
+
+u32 nic_poll(u32 budget, void (*handler)(struct netbuf* buf)) {
+    return 0;
+}
+
+void nic_wait() {
+
+}
+
+void nic_get_stats(struct nic_stats* stats) {
+    mem_set(stats, 0, sizeof(struct nic_stats));
+}
+
+void nic_clear_stats() {
+
+}
+
+void nic_set_loopback(u32 enable) {
 
 }
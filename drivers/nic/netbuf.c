@@ -3,43 +3,312 @@
 #include <chaos/netbuf.h>
 #include <chaos/assert.h>
 #include <chaos/kprint.h>
+#include <chaos/timer.h>
+#include <chaos/initcall.h>
+#include <chaos/pool.h>
+#include <chaos/smp.h>
 #include <stdalign.h>
 
-// This is the maximum possible header size. The netbuf allocator will reserve some space
-// in the beginning of the buffer. This allows protocol layers to insert required
-// network headers
-#define MAX_HEADER_SIZE 134
-
-// This indicates how many packets can be stored in the system at any time. For normal 
-// TFTP / UDP / IP this number can be lower than 256
+// This indicates how many packets can be stored in the system at any time. For normal
+// TFTP / UDP / IP this number can be lower than 256. It can be overridden from the config
+// file, and the high watermark tells how many buffers the workload actually needed
+#ifndef NIC_MAX_BUF
 #define NIC_MAX_BUF 256
-static alignas(32) struct netbuf buffers[NIC_MAX_BUF];
+#endif
+
+// Number of small netbufs. Most packets the kernel sends are small
+#ifndef NIC_MAX_SMALL_BUF
+#define NIC_MAX_SMALL_BUF 128
+#endif
+
+// Number of clones. A clone only takes metadata, so these are cheap
+#ifndef NIC_MAX_CLONE
+#define NIC_MAX_CLONE 32
+#endif
+
+#define NETBUF_TOTAL (NIC_MAX_SMALL_BUF + NIC_MAX_BUF + NIC_MAX_CLONE)
+
+// Metadata of all netbufs, the small ones first and the clones last. The pools and the
+// protocol code mostly touch this dense array, and it is kept apart from the data, so the
+// cache maintenance done for the DMA never hits a metadata line
+static alignas(NETBUF_ALIGN) struct netbuf netbufs[NETBUF_TOTAL];
+
+// Packet data. Each buffer starts on a cache line, which is also a whole number of DMA
+// bursts
+static alignas(NETBUF_ALIGN) u8 small_data[NIC_MAX_SMALL_BUF][NETBUF_SMALL_SIZE];
+static alignas(NETBUF_ALIGN) u8 large_data[NIC_MAX_BUF][NETBUF_SIZE];
+
+// Free netbufs are kept in per-core magazines, so a core only touches shared state when
+// it trades a whole magazine with the depot. Each class has a pool of its own
+static struct pool netbuf_pools[NETBUF_CLASSES];
+static struct pool_magazine large_magazines[POOL_MAGAZINES(NIC_MAX_BUF)];
+static struct pool_magazine small_magazines[POOL_MAGAZINES(NIC_MAX_SMALL_BUF)];
+static struct pool_magazine clone_magazines[POOL_MAGAZINES(NIC_MAX_CLONE)];
+static struct pool_cpu netbuf_cpu[NETBUF_CLASSES] __percpu;
+
+static const char* const class_names[NETBUF_CLASSES] = {
+    [NETBUF_SMALL] = "small",
+    [NETBUF_LARGE] = "large",
+    [NETBUF_CLONE] = "clone",
+};
 
-// This list keeps track of all unused netbuffers
-static struct list_node netbuf_pool;
+static const u32 class_counts[NETBUF_CLASSES] = {
+    [NETBUF_SMALL] = NIC_MAX_SMALL_BUF,
+    [NETBUF_LARGE] = NIC_MAX_BUF,
+    [NETBUF_CLONE] = NIC_MAX_CLONE,
+};
+
+// Returns netbuf number `index` of a class
+static struct netbuf* netbuf_at(u32 class, u32 index) {
+    if (class == NETBUF_SMALL) {
+        return &netbufs[index];
+    }
+    if (class == NETBUF_LARGE) {
+        return &netbufs[NIC_MAX_SMALL_BUF + index];
+    }
+    return &netbufs[NIC_MAX_SMALL_BUF + NIC_MAX_BUF + index];
+}
+
+#ifdef NETBUF_DEBUG
+// Returns the current time in milliseconds, or zero if the board has no timer
+static u32 netbuf_time() {
+    const struct timer_iface* timer = get_timer();
+    if (timer && timer->get_time) {
+        return timer->get_time();
+    }
+    return 0;
+}
+#endif
 
 // Initializes the netbuffers
 void netbuf_init() {
-    list_init(&netbuf_pool);
+    pool_init(&netbuf_pools[NETBUF_LARGE], &netbuf_cpu[NETBUF_LARGE], large_magazines,
+        POOL_MAGAZINES(NIC_MAX_BUF));
+    pool_init(&netbuf_pools[NETBUF_SMALL], &netbuf_cpu[NETBUF_SMALL], small_magazines,
+        POOL_MAGAZINES(NIC_MAX_SMALL_BUF));
+    pool_init(&netbuf_pools[NETBUF_CLONE], &netbuf_cpu[NETBUF_CLONE], clone_magazines,
+        POOL_MAGAZINES(NIC_MAX_CLONE));
 
-    // Insert all the buffers into the list
-    for (u32 i = 0; i < NIC_MAX_BUF; i++) {
-        list_push_front(&buffers[i].node, &netbuf_pool);
+    for (u32 class = 0; class < NETBUF_CLASSES; class++) {
+        for (u32 i = 0; i < class_counts[class]; i++) {
+            struct netbuf* buf = netbuf_at(class, i);
+            if (class == NETBUF_SMALL) {
+                buf->buf = small_data[i];
+                buf->size = NETBUF_SMALL_SIZE;
+            } else if (class == NETBUF_LARGE) {
+                buf->buf = large_data[i];
+                buf->size = NETBUF_SIZE;
+            } else {
+                buf->buf = NULL;
+                buf->size = 0;
+            }
+            buf->class = class;
+#ifdef NETBUF_DEBUG
+            buf->allocated = 0;
+#endif
+            pool_add(&netbuf_pools[class], buf);
+        }
     }
 }
 
-struct netbuf* alloc_netbuf() {
-    // Get the first free netbuf list node
-    struct list_node* node = list_pop_front(&netbuf_pool);
-    assert(node);
+static i32 netbuf_initcall() {
+    netbuf_init();
+    return 0;
+}
+
+INITCALL(netbuf, netbuf_initcall, NULL);
+
+// Takes a netbuf from the pool of a class. `owner` is the caller of the public allocation
+// function, and is only recorded with NETBUF_DEBUG
+static struct netbuf* netbuf_alloc_class(u32 class, u32 owner) {
+    struct netbuf* buf = pool_alloc(&netbuf_pools[class]);
+    if (buf == NULL) {
+        return NULL;
+    }
+    buf->ptr = buf->buf + NETBUF_HEADROOM;
+    buf->len = 0;
+    buf->next = NULL;
+    buf->refs = 1;
+    buf->origin = NULL;
+
+#ifdef NETBUF_DEBUG
+    buf->owner = owner;
+    buf->timestamp = netbuf_time();
+    buf->allocated = 1;
+#endif
+    return buf;
+}
+
+#ifdef NETBUF_DEBUG
+// Tells who is holding the buffers the first time a pool runs dry
+static void netbuf_report_failure(u32 class) {
+    struct pool_stats stats;
+    pool_get_stats(&netbuf_pools[class], &stats);
+    if (stats.fails == 1) {
+        netbuf_print_stats();
+        netbuf_leak_report(0);
+    }
+}
+#endif
 
-    // Convert the list node to a netbuf and return it
-    struct netbuf* buf = list_get_struct(node, struct netbuf, node);
-    buf->ptr = buf->buf + MAX_HEADER_SIZE;
+struct netbuf* alloc_netbuf() {
+    struct netbuf* buf = netbuf_alloc_class(NETBUF_LARGE,
+        (u32)__builtin_return_address(0));
+#ifdef NETBUF_DEBUG
+    if (buf == NULL) {
+        netbuf_report_failure(NETBUF_LARGE);
+    }
+#endif
     return buf;
 }
 
+struct netbuf* alloc_netbuf_len(u32 len) {
+    if (len > NETBUF_SIZE - NETBUF_HEADROOM) {
+        return NULL;
+    }
+
+    u32 class = (len <= NETBUF_SMALL_SIZE - NETBUF_HEADROOM) ? NETBUF_SMALL : NETBUF_LARGE;
+    for (; class <= NETBUF_LARGE; class++) {
+        struct netbuf* buf = netbuf_alloc_class(class, (u32)__builtin_return_address(0));
+        if (buf) {
+            return buf;
+        }
+#ifdef NETBUF_DEBUG
+        netbuf_report_failure(class);
+#endif
+    }
+    return NULL;
+}
+
+// The last reference to a clone also drops its reference to the data
+void netbuf_put_ref(struct netbuf* buf) {
+#ifdef NETBUF_DEBUG
+    // Catch double free
+    assert(buf->allocated && buf->refs);
+#endif
+    if (__atomic_sub_fetch(&buf->refs, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+
+    struct netbuf* origin = buf->origin;
+#ifdef NETBUF_DEBUG
+    buf->allocated = 0;
+#endif
+    pool_free(&netbuf_pools[buf->class], buf);
+
+    if (origin) {
+        netbuf_put_ref(origin);
+    }
+}
+
 void free_netbuf(struct netbuf* buf) {
-    // Get the first free netbuf list node
-    list_push_back(&buf->node, &netbuf_pool);
+    while (buf) {
+        struct netbuf* next = buf->next;
+        netbuf_put_ref(buf);
+        buf = next;
+    }
+}
+
+struct netbuf* netbuf_clone(struct netbuf* buf) {
+    struct netbuf* head = NULL;
+    struct netbuf** link = &head;
+
+    for (; buf; buf = buf->next) {
+        struct netbuf* clone = netbuf_alloc_class(NETBUF_CLONE,
+            (u32)__builtin_return_address(0));
+        if (clone == NULL) {
+#ifdef NETBUF_DEBUG
+            netbuf_report_failure(NETBUF_CLONE);
+#endif
+            free_netbuf(head);
+            return NULL;
+        }
+
+        // A clone of a clone shares the data of the same origin
+        struct netbuf* origin = buf->origin ? buf->origin : buf;
+        __atomic_add_fetch(&origin->refs, 1, __ATOMIC_RELAXED);
+
+        clone->buf = buf->buf;
+        clone->size = buf->size;
+        clone->ptr = buf->ptr;
+        clone->len = buf->len;
+        clone->origin = origin;
+
+        *link = clone;
+        link = &clone->next;
+    }
+    return head;
+}
+
+// Copies the current pool statistics of one class to `dest`
+void netbuf_get_stats(enum netbuf_class class, struct netbuf_stats* dest) {
+    struct pool_stats stats;
+    pool_get_stats(&netbuf_pools[class], &stats);
+
+    dest->total = stats.total;
+    dest->in_use = stats.in_use;
+    dest->high_watermark = stats.high_watermark;
+    dest->low_watermark = stats.total - stats.high_watermark;
+    dest->alloc_count = stats.allocs;
+    dest->free_count = stats.frees;
+    dest->alloc_failed = stats.fails;
+}
+
+void netbuf_print_stats() {
+    for (u32 class = 0; class < NETBUF_CLASSES; class++) {
+        struct netbuf_stats stats;
+        netbuf_get_stats(class, &stats);
+
+        kprint("Netbuf pool {s}: {u} of {u} in use\n", class_names[class], stats.in_use,
+            stats.total);
+        kprint("  high watermark {u} - low watermark {u} free\n", stats.high_watermark,
+            stats.low_watermark);
+        kprint("  allocations {u} - frees {u} - failed {u}\n", stats.alloc_count,
+            stats.free_count, stats.alloc_failed);
+    }
+}
+
+void netbuf_leak_report(u32 threshold) {
+#ifdef NETBUF_DEBUG
+    u32 now = netbuf_time();
+
+    kprint("Netbufs held longer than {u} ms:\n", threshold);
+    for (u32 i = 0; i < NETBUF_TOTAL; i++) {
+        struct netbuf* buf = &netbufs[i];
+        u32 age = now - buf->timestamp;
+
+        if (buf->allocated && age >= threshold) {
+            kprint("  {p} {s} owner {p} age {u} ms\n", buf, class_names[buf->class],
+                buf->owner, age);
+        }
+    }
+
+    // Count the buffers per owner. Only the first buffer with a given owner will print
+    // the total, so this does not need any extra memory
+    kprint("Netbufs per owner:\n");
+    for (u32 i = 0; i < NETBUF_TOTAL; i++) {
+        if (netbufs[i].allocated == 0) {
+            continue;
+        }
+        u32 owner = netbufs[i].owner;
+        u32 first = 1;
+        u32 count = 0;
+
+        for (u32 j = 0; j < NETBUF_TOTAL; j++) {
+            if (netbufs[j].allocated && netbufs[j].owner == owner) {
+                if (j < i) {
+                    first = 0;
+                    break;
+                }
+                count++;
+            }
+        }
+
+        if (first) {
+            kprint("  owner {p} holds {u}\n", owner, count);
+        }
+    }
+#else
+    kprint("Netbuf leak report requires NETBUF_DEBUG\n");
+#endif
 }
@@ -6,11 +6,23 @@
 #include <chaos/assert.h>
 #include <chaos/panic.h>
 #include <chaos/nic.h>
+#include <chaos/mem.h>
+#include <chaos/mmu.h>
+#include <chaos/net_stats.h>
 #include <stdalign.h>
 
+#ifdef NIC_IRQ
+#include <chaos/irq.h>
+#endif
+
+// The Zynq GEM is the same IP, so this driver also runs on the QEMU xilinx-zynq-a9 machine
+#ifdef ZYNQ
+#include <zynq/regmap.h>
+#else
 #include <sama5d2/sama5d2_clk.h>
 #include <sama5d2/sama5d2_gpio.h>
 #include <sama5d2/regmap.h>
+#endif
 
 // The NIC RX descriptor is read by the NIC DMA both during and in between transfers.
 // After a transfer the DMA will update the status word according to the last transaction
@@ -89,30 +101,60 @@ struct nic_link_setting {
 // Note that even though we don't use the queues, we still have to configure them. 
 // Otherwise the DMA will not work properly
 #define NIC_NUM_RX_DESC 4
-#define NIC_NUM_TX_DESC 4
+#define NIC_NUM_TX_DESC 16
 #define NIC_NUM_UNUSED_TX_DESC 2
 #define NIC_NUM_UNUSED_RX_DESC 2
 #define NIC_QUEUES 4
 
-// Setup static descriptors aligned on a cache line
-static alignas(8) struct nic_rx_desc rx_descs[NIC_NUM_RX_DESC];
-static alignas(8) struct nic_tx_desc tx_descs[NIC_NUM_TX_DESC];
-static alignas(8) struct nic_rx_desc rx_descs_q1[NIC_NUM_UNUSED_RX_DESC];
-static alignas(8) struct nic_tx_desc tx_descs_q1[NIC_NUM_UNUSED_TX_DESC];
-static alignas(8) struct nic_rx_desc rx_descs_q2[NIC_NUM_UNUSED_RX_DESC];
-static alignas(8) struct nic_tx_desc tx_descs_q2[NIC_NUM_UNUSED_TX_DESC];
-static alignas(8) struct nic_rx_desc rx_descs_q3[NIC_NUM_UNUSED_RX_DESC];
-static alignas(8) struct nic_tx_desc tx_descs_q3[NIC_NUM_UNUSED_TX_DESC];
+// Status reads nic_stop waits for the last frame to go out. A full frame takes about
+// 120 us at 100 Mbps
+#define NIC_STOP_POLLS 100000
+
+// Setup static descriptors in the non-cacheable SRAM window. This way the descriptor
+// updates from the DMA and the CPU are always visible to each other, and the descriptor
+// fetches don't compete with the frame data for DDR bandwidth
+static __sram_dma alignas(8) struct nic_rx_desc rx_descs[NIC_NUM_RX_DESC];
+static __sram_dma alignas(8) struct nic_tx_desc tx_descs[NIC_NUM_TX_DESC];
+static __sram_dma alignas(8) struct nic_rx_desc rx_descs_q1[NIC_NUM_UNUSED_RX_DESC];
+static __sram_dma alignas(8) struct nic_tx_desc tx_descs_q1[NIC_NUM_UNUSED_TX_DESC];
+static __sram_dma alignas(8) struct nic_rx_desc rx_descs_q2[NIC_NUM_UNUSED_RX_DESC];
+static __sram_dma alignas(8) struct nic_tx_desc tx_descs_q2[NIC_NUM_UNUSED_TX_DESC];
+static __sram_dma alignas(8) struct nic_rx_desc rx_descs_q3[NIC_NUM_UNUSED_RX_DESC];
+static __sram_dma alignas(8) struct nic_tx_desc tx_descs_q3[NIC_NUM_UNUSED_TX_DESC];
+
+// These keep track of the current active TX / RX descriptor. They are used on every
+// packet, so they are placed in SRAM together with nic_receive and nic_send
+static __sram_data u32 rx_index = 0;
+static __sram_data u32 tx_index = 0;
+
+// The oldest TX descriptor that is not reclaimed yet, and the number of descriptors from
+// there that hold a netbuf
+static __sram_data u32 tx_clean = 0;
+static __sram_data u32 tx_pending = 0;
+
+static __sram_data struct netbuf* rx_desc_map[NIC_NUM_RX_DESC];
+static __sram_data struct netbuf* tx_desc_map[NIC_NUM_TX_DESC];
+
+// Holds the address of our connected ethernet phy and the negotiated link
+static u8 phy_addr;
+static struct nic_link_setting link;
+
+// 64-bit totals of the GMAC statistics registers
+static struct nic_stats stats;
 
-// These keep track of the current active TX / RX descriptor
-static u32 rx_index = 0;
-static u32 tx_index = 0;
+#ifdef NIC_IRQ
+// Receive complete, RX used bit read, transmit complete and receive overrun. Any of them
+// means that nic_poll has work
+#define NIC_IRQ_MASK ((1 << 1) | (1 << 2) | (1 << 7) | (1 << 10))
 
-static struct netbuf* rx_desc_map[NIC_NUM_RX_DESC];
-static struct netbuf* tx_desc_map[NIC_NUM_TX_DESC];
+// Set while the interrupts are on. The interrupt handler turns them off and clears this,
+// which tells the caller to run nic_poll. It stays clear while the NIC is polled under
+// load
+static volatile u32 nic_irq_armed;
 
-// Holds the address of our connected ethernet phy
-static u8 phy_addr;
+// Set once the interrupt is registered. Otherwise the NIC is only polled
+static u32 nic_irq_ok;
+#endif
 
 // Contains a mapping between the RX descriptor, TX descriptor and both sizes for a given
 // queue. This is to avoid a mess when configuring the hardware
@@ -155,9 +197,16 @@ static const struct nic_queue queues[NIC_QUEUES] = {
     }
 };
 
-// Configures all the NIC queues (rings). This will allocate a netbuf for each DMA 
-// descriptor and link the DMA descriptor to the netbuf->buf. This also configures the 
-// hardware registers for each queue
+// Hands a receive buffer to the DMA. Any dirty cache line in the buffer could otherwise be
+// written back on top of the received data
+static void nic_rx_buf_to_dma(struct netbuf* netbuf) {
+    u32 start = (u32)netbuf->buf;
+    dcache_clean_invalidate_virt_range(start, start + netbuf->size);
+}
+
+// Configures all the NIC queues (rings). This will allocate a netbuf for each RX DMA 
+// descriptor and link the DMA descriptor to the netbuf->buf. The TX descriptors get a
+// netbuf when a packet is sent. This also configures the hardware registers for each queue
 void nic_setup_dma_queues() {
     for (u32 i = 0; i < NIC_QUEUES; i++) {
         
@@ -166,15 +215,12 @@ void nic_setup_dma_queues() {
 
         // Configure the TX queue
         for (u32 j = 0; j < queue->tx_count; j++) {
-            netbuf = alloc_netbuf();
             if (i == 0) {
-                tx_desc_map[j] = netbuf;
+                tx_desc_map[j] = NULL;
             }
             struct nic_tx_desc* tx = &queue->tx[j];
 
-            // Link the descriptor to the netbuf
-            // TODO: when the MMU is on we must convert to physical address
-            tx->addr = (u32)netbuf;
+            tx->addr = 0;
             tx->status_word = 0;
 
             // This will make sure the DMA can't use the buffer
@@ -184,20 +230,23 @@ void nic_setup_dma_queues() {
         // Configure the RX queue
         for (u32 j = 0; j < queue->rx_count; j++) {
             netbuf = alloc_netbuf();
+            if (netbuf == NULL) {
+                panic("Not enough netbufs for the RX ring");
+            }
             if (i == 0) {
                 rx_desc_map[j] = netbuf;
             }
             struct nic_rx_desc* rx = &queue->rx[j];
 
-            // Link the descriptor to the netbuf
-            // TODO: when the MMU is on we must convert to physical address
-            assert(((u32)netbuf & 0b11) == 0);
+            // Link the descriptor to the netbuf. The DMA uses physical addresses
+            assert(((u32)netbuf->buf & 0b11) == 0);
+            nic_rx_buf_to_dma(netbuf);
 
             rx->addr_word = 0;
             rx->status_word = 0;
 
             // The address is in bits 32..2
-            rx->addr = (u32)netbuf >> 2;
+            rx->addr = virt_to_phys(netbuf->buf) >> 2;
         }
 
         // Mark the end descriptor with the wrap bit, causing the DMA to fetch the base
@@ -209,18 +258,20 @@ void nic_setup_dma_queues() {
     // Map in the queues in the NIC hardware
     struct nic_reg* const nic_reg = NIC_REG;
 
-    nic_reg->rbqb       = (u32)rx_descs;
-    nic_reg->tbqb       = (u32)tx_descs;
-    nic_reg->rbqbapq[0] = (u32)rx_descs_q1;
-    nic_reg->tbqbapq[0] = (u32)tx_descs_q1;
-    nic_reg->rbqbapq[1] = (u32)rx_descs_q2;
-    nic_reg->tbqbapq[1] = (u32)tx_descs_q2;
-    nic_reg->rbqbapq[2] = (u32)rx_descs_q3;
-    nic_reg->tbqbapq[2] = (u32)tx_descs_q3;
+    nic_reg->rbqb       = virt_to_phys(rx_descs);
+    nic_reg->tbqb       = virt_to_phys(tx_descs);
+    nic_reg->rbqbapq[0] = virt_to_phys(rx_descs_q1);
+    nic_reg->tbqbapq[0] = virt_to_phys(tx_descs_q1);
+    nic_reg->rbqbapq[1] = virt_to_phys(rx_descs_q2);
+    nic_reg->tbqbapq[1] = virt_to_phys(tx_descs_q2);
+    nic_reg->rbqbapq[2] = virt_to_phys(rx_descs_q3);
+    nic_reg->tbqbapq[2] = virt_to_phys(tx_descs_q3);
 
     // Make sure we start reading from the base descriptor
     rx_index = 0;
     tx_index = 0;
+    tx_clean = 0;
+    tx_pending = 0;
 }
 
 // Reads a 16-bit register from the addressed ethernet PHY. Both the register address and 
@@ -263,9 +314,9 @@ u8 ethernet_phy_scan() {
     return 0;
 }
 
-// Configures the ethernet PHY for full-duplex, 100 Mbps opration and returns when the 
-// auto-negotiation is complete and the link is up 
-void phy_establish_link(u8 addr) {
+// Configures the ethernet PHY for full-duplex, 100 Mbps opration and restarts the
+// auto-negotiation unless it is already complete
+static void phy_start_link(u8 addr) {
     // Check if the link is already up
     if ((ethernet_phy_read(addr, 1) & (1 << 5)) == 0) {
 
@@ -274,11 +325,20 @@ void phy_establish_link(u8 addr) {
 
         // Restart the auto-negotiation
         ethernet_phy_write(addr, 0, ethernet_phy_read(addr, 0) | (1 << 9));
-        while ((ethernet_phy_read(addr, 1) & (1 << 5)) == 0);
     }
+}
 
-    // Wait for the link-up status
-    while ((ethernet_phy_read(addr, 1) & (1 << 2)) == 0);
+// Returns 1 when the auto-negotiation is complete and the link is up
+static u32 phy_link_up(u8 addr) {
+    u16 status = ethernet_phy_read(addr, 1);
+    return (status & (1 << 5)) && (status & (1 << 2));
+}
+
+// Configures the ethernet PHY for full-duplex, 100 Mbps opration and returns when the 
+// auto-negotiation is complete and the link is up 
+void phy_establish_link(u8 addr) {
+    phy_start_link(addr);
+    while (phy_link_up(addr) == 0);
 }
 
 // Get the speed and duplex setting from the link partner
@@ -297,6 +357,7 @@ void get_phy_settings(u8 addr, struct nic_link_setting* link_setting) {
 
 // Configure the NIC pins
 void nic_pin_init() {
+#ifndef ZYNQ
     sama5d2_gpio_set_func(GPIOD_REG,  9, GPIO_FUNC_D);
     sama5d2_gpio_set_func(GPIOD_REG, 10, GPIO_FUNC_D);
     sama5d2_gpio_set_func(GPIOD_REG, 11, GPIO_FUNC_D);
@@ -307,53 +368,182 @@ void nic_pin_init() {
     sama5d2_gpio_set_func(GPIOD_REG, 16, GPIO_FUNC_D);
     sama5d2_gpio_set_func(GPIOD_REG, 17, GPIO_FUNC_D);
     sama5d2_gpio_set_func(GPIOD_REG, 18, GPIO_FUNC_D);
+#endif
+}
+
+// Drops the references the NIC holds to the netbufs of the frames the DMA has sent. The
+// GMAC only sets the used bit in the first descriptor of a frame, so the rest of the
+// frame is marked here. This keeps every descriptor the DMA can reach after the last
+// frame marked as used
+static __sram_func void nic_tx_reclaim() {
+    while (tx_pending && tx_descs[tx_clean].used) {
+        u32 last;
+        do {
+            struct nic_tx_desc* tx_desc = &tx_descs[tx_clean];
+            last = tx_desc->last;
+            tx_desc->used = 1;
+
+            netbuf_put_ref(tx_desc_map[tx_clean]);
+            tx_desc_map[tx_clean] = NULL;
+            tx_pending--;
+
+            if (++tx_clean >= NIC_NUM_TX_DESC) {
+                tx_clean = 0;
+            }
+        } while (!last);
+    }
+}
+
+// Gives the current RX descriptor back to the DMA and moves on to the next one
+static inline void nic_rx_next(struct nic_rx_desc* rx_desc) {
+    rx_desc->owner = 0;
+    if (++rx_index >= NIC_NUM_RX_DESC) {
+        rx_index = 0;
+    }
 }
 
 // Tries to receive a IEEE 802.3 ethernet packet from the NIC hardware. This will either
 // return a netbuf with the packet data, or NULL. The netbuf will be completely unlinked 
 // adfter this call, so the user must free the netbuf manually when done reading 
-struct netbuf* nic_receive() {
+__sram_func struct netbuf* nic_receive() {
     struct nic_rx_desc* rx_desc = &rx_descs[rx_index];
 
     // Read and clear the status flags
     u32 reg = NIC_REG->rsr;
     NIC_REG->rsr = reg;
 
+    // Release the sent frames as soon as possible, so that a sender waiting for the
+    // last reference to a netbuf does not have to wait for the next send
+    if (tx_pending) {
+        nic_tx_reclaim();
+    }
+
     if (rx_desc->owner) {
         // Convert the DMA descriptor address pointer 32..2 into a netbuf
         struct netbuf* netbuf = rx_desc_map[rx_index];
 
         // We don't support packet linking
         assert(rx_desc->sof && rx_desc->eof);
+        u32 len = rx_desc->len;
+
+        // Drop any lines the CPU speculatively fetched while the DMA owned the buffer
+        u32 start = (u32)netbuf->buf;
+        dcache_invalidate_virt_range(start, start + len);
+
+        // A short frame is copied to a small netbuf, and the large one goes straight back
+        // to the DMA. The copy only reads the buffer, so no cache line of it is dirty
+        struct netbuf* new;
+        if (len <= NETBUF_COPYBREAK && (new = alloc_netbuf_len(len))) {
+            mem_copy(netbuf->buf, netbuf_put(new, len), len);
+            nic_rx_next(rx_desc);
+            return new;
+        }
+
+        // Otherwise the current netbuf is returned, so we must allocate a new one and
+        // replace the old one. If the pool is empty the frame is dropped and the same
+        // buffer goes back to the DMA, so the ring never loses a descriptor
+        new = alloc_netbuf();
+        if (new == NULL) {
+            proto_stats.rx_no_buffer++;
+            nic_rx_next(rx_desc);
+            return NULL;
+        }
+        nic_rx_buf_to_dma(new);
+        rx_desc_map[rx_index] = new;
+        rx_desc->addr = virt_to_phys(new->buf) >> 2;
+        nic_rx_next(rx_desc);
 
         // Save the length and reset the netbuf pointers
-        netbuf->len = rx_desc->len;
+        netbuf->len = len;
         netbuf->ptr = netbuf->buf;
+        return netbuf;
+    }
 
-        // Since the current netbuf should be returned, we must allocate a new one and 
-        // replace the old one
-        struct netbuf* new = alloc_netbuf();
-        rx_desc_map[rx_index] = new;
-        rx_desc->addr = (u32)new->buf >> 2;
-        rx_desc->owner = 0;
+    // Any error handling?
+    return NULL;
+}
+
+#ifdef NIC_IRQ
+// Top half of the NIC interrupt. This only turns the interrupts off and leaves the frames
+// to nic_poll, so nothing is allocated in IRQ mode
+static void nic_irq_handler() {
+    struct nic_reg* const nic_reg = NIC_REG;
+    nic_reg->idr = NIC_IRQ_MASK;
+    (void)nic_reg->isr;
+
+    nic_irq_armed = 0;
+    stats.poll_interrupts++;
+}
+
+// Turns the interrupts back on once the RX ring is empty. The status bits are cleared
+// first, so a frame that came in after the last check of the ring raises no interrupt.
+// The ring is therefore checked again once the interrupts are on
+static __sram_func void nic_irq_arm() {
+    struct nic_reg* const nic_reg = NIC_REG;
+    nic_irq_armed = 1;
+    (void)nic_reg->isr;
+    nic_reg->ier = NIC_IRQ_MASK;
+
+    if (rx_descs[rx_index].owner) {
+        nic_reg->idr = NIC_IRQ_MASK;
+        nic_irq_armed = 0;
+    }
+}
+#endif
+
+// Bottom half of the NIC interrupt. This passes up to `budget` received frames to
+// `handler` and releases the sent frames. If the budget is used up, more frames are
+// likely waiting, so the interrupts stay off and the caller polls again. Otherwise the
+// NIC is idle and the interrupts are turned back on. This gives an interrupt per frame
+// under light traffic, and no interrupts at all while the NIC is busy
+__sram_func u32 nic_poll(u32 budget, void (*handler)(struct netbuf* buf)) {
+    if (tx_pending) {
+        nic_tx_reclaim();
+    }
 
-        if (++rx_index >= NIC_NUM_RX_DESC) {
-            rx_index = 0;
+    // A frame dropped for lack of a netbuf still counts against the budget
+    u32 done = 0;
+    while (done < budget && rx_descs[rx_index].owner) {
+        struct netbuf* buf = nic_receive();
+        if (buf) {
+            handler(buf);
         }
+        done++;
+    }
 
-        // TODO: invalidate the cache before returning !!!!!!!!!!
-        return netbuf;
+#ifdef NIC_IRQ
+    if (nic_irq_ok) {
+        if (done == budget) {
+            stats.poll_budget_full++;
+        } else if (nic_irq_armed == 0) {
+            nic_irq_arm();
+        }
+    }
+#endif
+    return done;
+}
+
+// Sleeps until the NIC interrupt fires. This returns at once while the NIC is polled
+void nic_wait() {
+#ifdef NIC_IRQ
+    if (nic_irq_ok == 0) {
+        return;
     }
 
-    // Any error handling?
-    return NULL;
+    irq_local_disable();
+    if (nic_irq_armed) {
+        irq_wait();
+    }
+    irq_local_enable();
+#endif
 }
 
 // Sends a IEEE 802.3 network packet from the NIC. This should be called with an allocated
-// netbuf. This function will take care of freeing the netbuffers after they have been
-// transmitted
-void nic_send(struct netbuf* buf) {
-    struct nic_tx_desc* tx_desc = &tx_descs[tx_index];
+// netbuf. A chained packet is sent as one frame with a descriptor per buffer, so headers
+// and payload do not have to be copied together. The NIC takes over the reference of the
+// caller to each buffer and drops it once the frame is sent. A caller that wants to keep
+// the data sends a clone
+__sram_func void nic_send(struct netbuf* buf) {
     struct nic_reg* const nic_reg = NIC_REG;
 
     // Check the transmit status
@@ -363,44 +553,125 @@ void nic_send(struct netbuf* buf) {
 
     nic_reg->tsr = nic_reg->tsr;
 
-    // This buffer should be owned by us, if not, we have saturated the network card. In 
-    // this case we wait for the packet to be transmitted
-    if (tx_desc->used == 0) {
-        panic("Warning: network card saturated\n");
-        while (tx_desc->used == 0);
+    u32 count = 0;
+    for (struct netbuf* seg = buf; seg; seg = seg->next) {
+        count++;
+    }
+    if (count > NIC_NUM_TX_DESC) {
+        panic("Netbuf chain longer than the TX ring");
     }
 
-    // The NIC transmit ring should always contain a linked netbuf on each node
-    struct netbuf* netbuf = tx_desc_map[tx_index];
-    free_netbuf(netbuf);
+    // If the ring is full we have saturated the network card. In this case we wait for
+    // the oldest frames to be transmitted
+    nic_tx_reclaim();
+    while (NIC_NUM_TX_DESC - tx_pending < count) {
+        nic_tx_reclaim();
+    }
 
-    // Map in the new descriptor
-    tx_desc_map[tx_index] = buf;
+    // Each descriptor owns the reference to one buffer of the chain, and reclaim drops
+    // them one by one. The chain itself is left alone, since another holder might share
+    // it. The first descriptor is given to the DMA last, so it never starts on a frame
+    // that is only partly written
+    u32 first = tx_index;
+    while (buf) {
+        struct netbuf* next = buf->next;
+        struct nic_tx_desc* tx_desc = &tx_descs[tx_index];
+
+        tx_desc_map[tx_index] = buf;
+
+        tx_desc->addr = virt_to_phys(buf->ptr);
+        tx_desc->len = buf->len;
+        tx_desc->ignore_crc = 0;
+        tx_desc->last = (next == NULL);
+
+        // Write the frame back to memory before the DMA is given the descriptor
+        u32 start = (u32)buf->ptr;
+        dcache_clean_virt_range(start, start + buf->len);
+        if (tx_index != first) {
+            tx_desc->used = 0;
+        }
 
-    tx_desc->addr = (u32)buf->ptr;
-    tx_desc->len = buf->len;
-    tx_desc->ignore_crc = 0;
-    tx_desc->last = 1;
+        // Get the next entry in the ring
+        if (++tx_index >= NIC_NUM_TX_DESC) {
+            tx_index = 0;
+        }
+        buf = next;
+    }
+    tx_pending += count;
 
-    // Clean any cached regions here !!!!!!
-    tx_desc->used = 0;
+    asm volatile ("dmb" : : : "memory");
+    tx_descs[first].used = 0;
 
     // If the NIC is idle we start a new transfer
     nic_reg->ncr |= (1 << 9);
+}
 
-    // Get the next entry in the ring
-    if (++tx_index >= NIC_NUM_TX_DESC) {
-        tx_index = 0;
-    }
+// Reads the GMAC statistics registers and adds them to the 64-bit totals. The registers
+// are cleared on read, so each event is only counted once. The 32-bit frame counters
+// will wrap after a few hours at line rate, so this should be called now and then
+static void nic_fold_stats() {
+    struct nic_reg* const nic_reg = NIC_REG;
+
+    // The high octet registers must be read after the low ones
+    u64 tx_octets = nic_reg->otlo;
+    tx_octets |= (u64)(nic_reg->othi & 0xFFFF) << 32;
+    u64 rx_octets = nic_reg->orlo;
+    rx_octets |= (u64)(nic_reg->orhi & 0xFFFF) << 32;
+
+    stats.tx_octets           += tx_octets;
+    stats.rx_octets           += rx_octets;
+    stats.tx_frames           += nic_reg->ft;
+    stats.rx_frames           += nic_reg->fr;
+    stats.rx_fcs_errors       += nic_reg->fcse & 0x3FF;
+    stats.rx_length_errors    += nic_reg->lffe & 0x3FF;
+    stats.rx_alignment_errors += nic_reg->ae & 0x3FF;
+    stats.rx_symbol_errors    += nic_reg->rse & 0x3FF;
+    stats.rx_overruns         += nic_reg->roe & 0x3FF;
+    stats.rx_resource_errors  += nic_reg->rre & 0x3FFFF;
+    stats.rx_undersize        += nic_reg->ufr & 0x3FF;
+    stats.rx_oversize         += nic_reg->ofr & 0x3FF;
+    stats.rx_checksum_errors  += (nic_reg->ihce & 0xFF) + (nic_reg->tce & 0xFF) +
+                                 (nic_reg->uce & 0xFF);
+    stats.tx_underruns        += nic_reg->tur & 0x3FF;
+    stats.tx_collisions       += (nic_reg->scf & 0x3FFFF) + (nic_reg->mcf & 0x3FFFF) +
+                                 (nic_reg->ec & 0x3FF);
+    stats.tx_late_collisions  += nic_reg->lc & 0x3FF;
 }
 
-// Configures the NIC hardware and enables the NIC interface. This will setup the NIC in
-// a non-interrupt driven mode. Polling is the only way of sending / receiving packets
-void nic_init() {
-    kprint("Starting kernel NIC driver for SAMA5D2\n");
+void nic_get_stats(struct nic_stats* dest) {
+    nic_fold_stats();
+    mem_copy(&stats, dest, sizeof(struct nic_stats));
+}
+
+// Clears both the hardware counters and the totals
+void nic_clear_stats() {
+    NIC_REG->ncr |= (1 << 5);
+    mem_set(&stats, 0, sizeof(struct nic_stats));
+}
 
-    // Enable clock and pins
+// Enables or disables local loopback. In loopback every transmitted frame is received by
+// our own receiver, and nothing is sent on the wire
+void nic_set_loopback(u32 enable) {
+    struct nic_reg* const nic_reg = NIC_REG;
+
+    // The loopback bit must only be changed while the receiver and transmitter is off
+    u32 ncr = nic_reg->ncr;
+    nic_reg->ncr = ncr & ~((1 << 2) | (1 << 3));
+
+    if (enable) {
+        ncr |= (1 << 1);
+    } else {
+        ncr &= ~(1 << 1);
+    }
+    nic_reg->ncr = ncr;
+}
+
+// Resets the NIC and enables the PHY management interface
+static void nic_reset() {
+    // Enable clock and pins. The emulated Zynq GEM is always clocked
+#ifndef ZYNQ
     sama5d2_per_clk_en(5);
+#endif
     nic_pin_init();
 
     // Reset the interface
@@ -412,6 +683,9 @@ void nic_init() {
     nic_reg->idr = ~0;
     nic_reg->idrpq[0] = ~0;
     nic_reg->idrpq[1] = ~0;
+#ifdef NIC_IRQ
+    nic_irq_armed = 0;
+#endif
 
     // Clear interrupts
     (void)nic_reg->isr;
@@ -424,14 +698,11 @@ void nic_init() {
     // Enable the PHY management interface and set the bus speed
     nic_reg->ncfgr = (nic_reg->ncfgr & ~(0x7 << 18)) | (5 << 18);
     nic_reg->ncr |= (1 << 4);
-    
-    // Wait for the link-up status
-    phy_addr = ethernet_phy_scan();
-    phy_establish_link(phy_addr);
+}
 
-    // Get the highest link setting
-    struct nic_link_setting link_setting;
-    get_phy_settings(phy_addr, &link_setting);
+// Configures the MAC once the link is up and enables the receiver and transmitter
+static void nic_start() {
+    struct nic_reg* const nic_reg = NIC_REG;
 
     // Copy all frames, 100Mbps and full-duplex configuration
     nic_reg->ncfgr = (1 << 0) | (1 << 1) | (1 << 4);
@@ -445,9 +716,110 @@ void nic_init() {
     // DMA configuration
     nic_reg->dcfgr = (4 << 0) | (3 << 8) | (1 << 10) | (1 << 11) | (0x18 << 16);
 
-    // Ignore interrupts
+    // Keep the interrupts off until the NIC is running
     nic_reg->idr = 0xFFFFFFFF;
 
+    // Start the statistics from zero
+    nic_clear_stats();
+
     // Enable receiver and transmitter
     nic_reg->ncr |= (1 << 2) | (1 << 3);
+
+#ifdef NIC_IRQ
+    // Start in interrupt mode. The interrupt is only registered the first time
+    if (nic_irq_ok == 0 && irq_register(NIC_IRQ_ID, nic_irq_handler) == 0) {
+        nic_irq_ok = 1;
+    }
+    if (nic_irq_ok) {
+        nic_irq_arm();
+    }
+#endif
+}
+
+// Configures the NIC hardware and enables the NIC interface. With NIC_IRQ the RX and TX
+// interrupts tell when to call nic_poll. Otherwise polling is the only way of sending /
+// receiving packets
+void nic_init() {
+    nic_init_start();
+    while (nic_init_poll());
+}
+
+// Starts the NIC bring up. The auto-negotiation can take seconds, so this returns as soon
+// as it is started, and nic_init_poll completes the bring up once the link is up
+void nic_init_start() {
+    kprint("Starting kernel NIC driver for SAMA5D2\n");
+    nic_reset();
+
+    phy_addr = ethernet_phy_scan();
+    phy_start_link(phy_addr);
+}
+
+// Returns 1 while the link is still coming up, and 0 once the NIC is running
+u32 nic_init_poll() {
+    if (phy_link_up(phy_addr) == 0) {
+        return 1;
+    }
+
+    // Get the highest link setting
+    get_phy_settings(phy_addr, &link);
+
+    nic_start();
+    return 0;
+}
+
+// The PHY keeps its link across a soft reboot, so the scan and the autonegotiation are
+// skipped. A single read of the link status makes sure it is still up
+void nic_resume(const struct handoff* handoff) {
+    if ((handoff->flags & HANDOFF_LINK) == 0 || handoff->phy_addr >= 32) {
+        nic_init();
+        return;
+    }
+
+    kprint("Resuming kernel NIC driver for SAMA5D2\n");
+    nic_reset();
+
+    // The link status bit latches low, so the first read might report an old link loss
+    phy_addr = handoff->phy_addr;
+    ethernet_phy_read(phy_addr, 1);
+    if ((ethernet_phy_read(phy_addr, 1) & (1 << 2)) == 0) {
+        phy_establish_link(phy_addr);
+        get_phy_settings(phy_addr, &link);
+    } else {
+        link.speed = (handoff->link_speed == 100) ? NIC_100Mbps : NIC_10Mbps;
+        link.duplex = handoff->link_full_duplex ? NIC_DUPLEX_FULL : NIC_DUPLEX_HALF;
+    }
+
+    nic_start();
+}
+
+// Stops the NIC before the kernel is replaced. A frame received after the jump would
+// otherwise be written by the DMA into the netbufs of this kernel, which the new kernel
+// overwrites. Only the link is kept up for the next kernel
+void nic_stop() {
+    struct nic_reg* const nic_reg = NIC_REG;
+
+    // Let the frame being sent finish. Clearing TE stops the transmitter at once
+    for (u32 i = 0; i < NIC_STOP_POLLS && (nic_reg->tsr & (1 << 3)); i++);
+
+    nic_reg->ncr &= ~((1 << 2) | (1 << 3));
+
+    nic_reg->idr = ~0;
+    nic_reg->idrpq[0] = ~0;
+    nic_reg->idrpq[1] = ~0;
+#ifdef NIC_IRQ
+    nic_irq_armed = 0;
+#endif
+
+    (void)nic_reg->isr;
+    (void)nic_reg->isrpq[0];
+    (void)nic_reg->isrpq[1];
+    nic_reg->rsr = nic_reg->rsr;
+    nic_reg->tsr = nic_reg->tsr;
+}
+
+void nic_save_link(struct handoff* handoff) {
+    handoff->phy_addr = phy_addr;
+    handoff->link_speed = (link.speed == NIC_100Mbps) ? 100 : 10;
+    handoff->link_full_duplex = (link.duplex == NIC_DUPLEX_FULL);
+    handoff->flags |= HANDOFF_LINK;
 }
@@ -0,0 +1,23 @@
+// Serial driver for Xilinx Zynq-7000 chips (kernel driver)
+
+#include <chaos/kprint.h>
+#include <zynq/regmap.h>
+
+void kprint_from_buf(const char* buf, u32 size) {
+    struct zynq_uart_reg* const hw = ZYNQ_UART0_REG;
+
+    // The transmitter is disabled out of reset. Enable both directions
+    if ((hw->cr & ((1 << 4) | (1 << 5))) != (1 << 4)) {
+        hw->cr = (1 << 4) | (1 << 2);
+    }
+
+    while (size--) {
+        // Make sure we terminatie the line with CR-LF
+        if (*buf == '\n') {
+            while (hw->sr & (1 << 4));
+            hw->fifo = '\r';
+        }
+        while (hw->sr & (1 << 4));
+        hw->fifo = *buf++;
+    }
+}
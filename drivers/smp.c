@@ -0,0 +1,288 @@
+// Secondary core startup and calls across cores
+
+#include <chaos/smp.h>
+#include <chaos/initcall.h>
+#include <chaos/kprint.h>
+#include <chaos/timer.h>
+#include <chaos/cache.h>
+#include <chaos/mmu.h>
+#include <chaos/fdt.h>
+#include <chaos/mem.h>
+#include <chaos/status.h>
+
+// How long the boot core waits for the secondary cores to come up. Boards without a timer
+// count the polls instead
+#define SMP_BOOT_TIMEOUT 100
+#define SMP_BOOT_POLLS   0x100000
+
+// PSCI function IDs of version 0.2 and later
+#define PSCI_CPU_OFF       0x84000002
+#define PSCI_CPU_ON        0x84000003
+#define PSCI_AFFINITY_INFO 0x84000004
+
+#define PSCI_AFFINITY_OFF 1
+
+// Mailbox of each core. A caller claims the mailbox, fills in the call and increments the
+// sequence number. The core runs the call, copies the sequence number to `done` and
+// releases the mailbox
+struct smp_mailbox {
+    volatile u32 busy;
+    volatile u32 seq;
+    volatile u32 done;
+    void (*volatile fn)(void*);
+    void* volatile arg;
+    volatile u32 online;
+};
+
+static struct smp_mailbox mailbox __percpu;
+
+// Written by a parking core with its data cache off. Each flag has a cache line of its
+// own, so the boot core can invalidate it without losing other data
+struct smp_park_flag {
+    volatile u32 parked;
+} __attribute__((aligned(64)));
+
+static struct smp_park_flag park_flags[SMP_MAX_CPUS];
+
+// Firmware call used to start and stop the cores. This is NULL if the device tree has no
+// PSCI node, and the board code is used instead
+static u32 (*psci_call)(u32 fn, u32 arg0, u32 arg1, u32 arg2);
+static u32 psci_cpu_on;
+
+static u32 boot_time;
+static u32 boot_polls;
+
+// From arch/smp.s
+extern void secondary_entry();
+extern void cpu_park(volatile u32* flag) __attribute__((noreturn));
+extern u32 psci_call_smc(u32 fn, u32 arg0, u32 arg1, u32 arg2);
+extern u32 psci_call_hvc(u32 fn, u32 arg0, u32 arg1, u32 arg2);
+
+static inline void smp_dmb() {
+    asm volatile ("dmb" : : : "memory");
+}
+
+static inline void smp_dsb_sev() {
+    asm volatile ("dsb\n\tsev" : : : "memory");
+}
+
+static inline void smp_wfe() {
+    asm volatile ("wfe" : : : "memory");
+}
+
+// Returns the raw timer value in ms, or 0 if the board has no timer
+static u32 smp_time() {
+    const struct timer_iface* timer = get_timer();
+    if (timer && timer->get_time) {
+        return timer->get_time();
+    }
+    return 0;
+}
+
+u32 smp_cpu_online(u32 cpu) {
+    return cpu < SMP_MAX_CPUS && per_cpu(mailbox, cpu).online;
+}
+
+u32 smp_online_count() {
+    u32 count = 0;
+    for (u32 cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        count += smp_cpu_online(cpu);
+    }
+    return count;
+}
+
+// Main loop of a secondary core. It sleeps until a call is posted to its mailbox
+void smp_secondary_main(u32 cpu) {
+    struct smp_mailbox* box = &per_cpu(mailbox, cpu);
+
+    box->online = 1;
+    smp_dsb_sev();
+
+    while (1) {
+        while (box->done == box->seq) {
+            smp_wfe();
+        }
+        smp_dmb();
+
+        u32 seq = box->seq;
+        box->fn(box->arg);
+
+        smp_dmb();
+        box->done = seq;
+        box->busy = 0;
+        smp_dsb_sev();
+    }
+}
+
+// Posts a call to a core and returns the sequence number to wait for
+static u32 smp_post(struct smp_mailbox* box, void (*fn)(void*), void* arg) {
+    while (__atomic_exchange_n(&box->busy, 1, __ATOMIC_ACQUIRE)) {
+        smp_wfe();
+    }
+
+    box->fn = fn;
+    box->arg = arg;
+    smp_dmb();
+    u32 seq = box->seq + 1;
+    box->seq = seq;
+    smp_dsb_sev();
+    return seq;
+}
+
+static void smp_wait(struct smp_mailbox* box, u32 seq) {
+    while ((i32)(box->done - seq) < 0) {
+        smp_wfe();
+    }
+    smp_dmb();
+}
+
+i32 smp_call_function(u32 cpu, void (*fn)(void*), void* arg, u32 wait) {
+    if (cpu == smp_cpu_id()) {
+        fn(arg);
+        return 0;
+    }
+    if (!smp_cpu_online(cpu)) {
+        return -ERR_NOT_FOUND;
+    }
+
+    struct smp_mailbox* box = &per_cpu(mailbox, cpu);
+    u32 seq = smp_post(box, fn, arg);
+    if (wait) {
+        smp_wait(box, seq);
+    }
+    return 0;
+}
+
+void smp_call_function_others(void (*fn)(void*), void* arg, u32 wait) {
+    u32 seqs[SMP_MAX_CPUS];
+    u32 self = smp_cpu_id();
+
+    for (u32 cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (cpu != self && smp_cpu_online(cpu)) {
+            seqs[cpu] = smp_post(&per_cpu(mailbox, cpu), fn, arg);
+        }
+    }
+    if (!wait) {
+        return;
+    }
+    for (u32 cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (cpu != self && smp_cpu_online(cpu)) {
+            smp_wait(&per_cpu(mailbox, cpu), seqs[cpu]);
+        }
+    }
+}
+
+static void smp_park_psci(void* arg) {
+    psci_call(PSCI_CPU_OFF, 0, 0, 0);
+}
+
+static void smp_park(void* arg) {
+    cpu_park(arg);
+}
+
+// Returns 1 once a parking core has stopped
+static u32 smp_parked(u32 cpu) {
+    if (psci_call) {
+        return psci_call(PSCI_AFFINITY_INFO, cpu, 0, 0) == PSCI_AFFINITY_OFF;
+    }
+    u32 flag = (u32)&park_flags[cpu];
+    dcache_invalidate_virt_range(flag, flag + sizeof(struct smp_park_flag));
+    return park_flags[cpu].parked;
+}
+
+// Stops the secondary cores before a soft reboot. A parked core has written back its
+// caches and is held in reset by the board, or powered off by the firmware
+void smp_stop() {
+    for (u32 cpu = 1; cpu < SMP_MAX_CPUS; cpu++) {
+        if (!smp_cpu_online(cpu)) {
+            continue;
+        }
+
+        // The flag is written with the cache off, so it must not be in the cache
+        u32 flag = (u32)&park_flags[cpu];
+        park_flags[cpu].parked = 0;
+        dcache_clean_invalidate_virt_range(flag, flag + sizeof(struct smp_park_flag));
+
+        smp_call_function(cpu, psci_call ? smp_park_psci : smp_park,
+            (void *)&park_flags[cpu].parked, 0);
+
+        for (u32 i = 0; i < SMP_BOOT_POLLS && !smp_parked(cpu); i++);
+        per_cpu(mailbox, cpu).online = 0;
+
+        if (!psci_call) {
+            smp_stop_cpu(cpu);
+        }
+    }
+}
+
+// Uses PSCI if the device tree has a node for it. Version 0.1 gives the function IDs in
+// the node, while later versions use the standard ones
+static void smp_find_psci() {
+    struct fdt* fdt = boot_fdt();
+    if (fdt == NULL) {
+        return;
+    }
+    i32 node = fdt_path(fdt, "/psci");
+    if (node < 0) {
+        return;
+    }
+
+    u32 len;
+    const char* method = fdt_prop(fdt, node, "method", &len);
+    if (method && len == 4 && mem_cmp(method, "smc", 4)) {
+        psci_call = psci_call_smc;
+    } else if (method && len == 4 && mem_cmp(method, "hvc", 4)) {
+        psci_call = psci_call_hvc;
+    } else {
+        return;
+    }
+
+    if (fdt_prop_u32(fdt, node, "cpu_on", &psci_cpu_on)) {
+        psci_cpu_on = PSCI_CPU_ON;
+    }
+}
+
+// Starts all secondary cores. They come up in the background while the other initcalls
+// run
+static i32 smp_start() {
+    smp_find_psci();
+
+    per_cpu(mailbox, 0).online = 1;
+
+    // The secondary cores read the page tables with their caches off
+    dcache_clean_virt_range((u32)kernel_page_table,
+        (u32)kernel_page_table + sizeof(kernel_page_table) + sizeof(boot_page_table));
+
+    u32 entry = virt_to_phys(secondary_entry);
+    for (u32 cpu = 1; cpu < SMP_MAX_CPUS; cpu++) {
+        i32 status;
+        if (psci_call) {
+            status = (i32)psci_call(psci_cpu_on, cpu, entry, 0);
+        } else {
+            status = smp_boot_cpu(cpu, entry);
+        }
+        if (status) {
+            kprint("Core {u} did not start ({i})\n", cpu, status);
+        }
+    }
+
+    boot_time = smp_time();
+    boot_polls = 0;
+    return 0;
+}
+
+// Waits for the secondary cores. A core that does not come up in time is left out
+static i32 smp_poll() {
+    u32 online = smp_online_count();
+    if (online < SMP_MAX_CPUS && smp_time() - boot_time < SMP_BOOT_TIMEOUT &&
+        ++boot_polls < SMP_BOOT_POLLS) {
+        return INITCALL_PENDING;
+    }
+
+    kprint("SMP: {u} of {u} cores online{s}\n", online, SMP_MAX_CPUS,
+        psci_call ? " (PSCI)" : "");
+    return 0;
+}
+
+DECLARE_INITCALL(fdt);
+INITCALL(smp, smp_start, smp_poll, &initcall_fdt);
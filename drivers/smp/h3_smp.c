@@ -0,0 +1,63 @@
+// Secondary core startup for Allwinner H3 chips (kernel driver)
+
+#include <chaos/smp.h>
+#include <chaos/status.h>
+#include <h3/regmap.h>
+
+// Busy wait used while a core powers up. The H3 has no timer driver yet, so this is only
+// roughly a microsecond per count at the boot clock
+static void h3_smp_delay(u32 count) {
+    for (volatile u32 i = 0; i < count; i++);
+}
+
+// Powers up core `cpu` and releases it from reset at the physical address `entry`. The
+// sequence is the one used by the boot ROM and by u-boot
+i32 smp_boot_cpu(u32 cpu, u32 entry) {
+    struct cpucfg_reg* const cpucfg = CPUCFG_REG;
+    struct prcm_reg* const prcm = PRCM_REG;
+
+    if (cpu == 0 || cpu >= 4) {
+        return -ERR_NOT_FOUND;
+    }
+
+    cpucfg->entry_addr = entry;
+
+    // Hold the core and its L1 cache in reset, and block external debug until it runs
+    cpucfg->cpu[cpu].rst_ctrl = 0;
+    cpucfg->gen_ctrl &= ~(1 << cpu);
+    cpucfg->dbg_ctrl1 &= ~(1 << cpu);
+
+    // Release the power clamp in steps to limit the inrush current, then remove the
+    // power gate
+    prcm->cpu_pwr_clamp[cpu] = 0xFF;
+    h3_smp_delay(10000);
+    prcm->cpu_pwr_clamp[cpu] = 0xFE;
+    prcm->cpu_pwr_clamp[cpu] = 0xF8;
+    prcm->cpu_pwr_clamp[cpu] = 0xF0;
+    prcm->cpu_pwr_clamp[cpu] = 0x00;
+    prcm->cpu_pwroff &= ~(1 << cpu);
+    h3_smp_delay(1000);
+
+    // Start the core
+    cpucfg->cpu[cpu].rst_ctrl = 3;
+    cpucfg->dbg_ctrl1 |= (1 << cpu);
+    return 0;
+}
+
+// Holds a parked core in reset and powers it down. QEMU does not model the power down,
+// so there the core stays parked in its wait loop
+void smp_stop_cpu(u32 cpu) {
+    struct cpucfg_reg* const cpucfg = CPUCFG_REG;
+    struct prcm_reg* const prcm = PRCM_REG;
+
+    if (cpu == 0 || cpu >= 4) {
+        return;
+    }
+
+    cpucfg->cpu[cpu].rst_ctrl = 0;
+    cpucfg->gen_ctrl &= ~(1 << cpu);
+
+    prcm->cpu_pwroff |= (1 << cpu);
+    h3_smp_delay(10);
+    prcm->cpu_pwr_clamp[cpu] = 0xFF;
+}
@@ -2,10 +2,25 @@
 
 #include <chaos/tftp.h>
 #include <chaos/mem.h>
+#include <chaos/mmu.h>
 #include <chaos/nic.h>
 #include <chaos/kprint.h>
 #include <chaos/panic.h>
 #include <chaos/status.h>
+#include <chaos/net_stats.h>
+#include <chaos/boot_image.h>
+#include <chaos/timer.h>
+#include <chaos/boot_message.h>
+#include <chaos/handoff.h>
+#include <chaos/boot_args.h>
+#include <chaos/fdt.h>
+#include <chaos/initcall.h>
+#include <chaos/smp.h>
+
+#ifdef DELTA_REBOOT
+#include <chaos/delta.h>
+#include <chaos/crc32.h>
+#endif
 
 // Settings for the TFTP interface. These settings can be overridden in the config file
 #ifndef TFTP_CLIENT_IP
@@ -28,6 +43,33 @@
 #define TFTP_FILE_NAME "none.bin"
 #endif
 
+#ifndef DELTA_PORT
+#define DELTA_PORT 6970
+#endif
+
+// The delta server gets this long to answer before the full image is read instead
+#define DELTA_TIMEOUT_MS 2000
+
+// Boards without a timer count idle polls of the NIC instead
+#define TFTP_POLLS_PER_MS 1000
+
+// A UDP packet with this payload to the control port starts the prefetched kernel
+#ifndef TFTP_CONTROL_PORT
+#define TFTP_CONTROL_PORT 6971
+#endif
+
+#define TFTP_SWITCH_COMMAND "switch"
+
+// States of the staging of the next kernel
+#define STAGE_IDLE    0
+#define STAGE_RUNNING 1
+#define STAGE_READY   2
+#define STAGE_FAILED  3
+
+// The file being read into the staging area
+#define STAGE_DELTA 0
+#define STAGE_FULL  1
+
 struct __attribute__((packed)) mac_header {
     u8  dest_mac[6];
     u8  source_mac[6];
@@ -87,168 +129,56 @@ struct __attribute__((packed)) tftp_ack {
 
 #define IP_PROTOCOL_UDP 0x11
 
-#define TFTP_OPCODE_ACK  4
-#define TFTP_OPCODE_OACK 6
-#define TFTP_OPCODE_DATA 3
-#define TFTP_OPCODE_READ 1
+#define TFTP_OPCODE_ACK   4
+#define TFTP_OPCODE_OACK  6
+#define TFTP_OPCODE_DATA  3
+#define TFTP_OPCODE_READ  1
+#define TFTP_OPCODE_ERROR 5
+
+// Transfer states
+#define TFTP_RUNNING 0
+#define TFTP_DONE    1
+#define TFTP_FAILED  2
 
 #define MAC_TYPE_IPv4   0x0800
 #define MAC_TYPE_ARP    0x0806
 
+// Each transfer uses the next client port in this range as its transfer ID, so a late
+// packet of an abandoned transfer goes to a port that is no longer listened on
+#define TFTP_CLIENT_PORT_FIRST 313
+#define TFTP_CLIENT_PORT_COUNT 64
+
 static u8 mac_addr[6];
 static u8 tftp_server_mac[6];
-static u32 tftp_client_port = 313;
+static u32 tftp_client_port = TFTP_CLIENT_PORT_FIRST;
 static u32 tftp_server_port;
 static u32 packet_size;
-static u8* tftp_tmp_dest;
-static u32 tftp_server_ip;
-static u32 tftp_server_port;
-static u32 tftp_client_ip;
-static u32 tftp_done;
-
-// Hex lookup table for use in MAC address conversion
-static const char hex_lookup[] = "0123456789ABCDEF";
-
-// Converts a string into network IP representation. This returns 0 if success and
-// -ERR_NET if failure
-i32 string_to_ip(const char* str, u32* ip_addr) {
-    u32 ip = 0;
-    for (u32 i = 0; i < 4; i++) {
-        // We use two variables for tracking if the segment has right format
-        u32 num = 0;
-        u32 prev = 0;
-
-        while (*str >= '0' && *str <= '9') {
-            prev = num;
-            num = num * 10 + (*str++ - '0');
-
-            if ((prev | num) == 0 || num > 0xFF) {
-                return -ERR_NET;
-            }
-        }
-        
-        // Check the formatting
-        if ((i == 3 && *str != '\0') || (i != 3 && *str != '.')) {
-            return -ERR_NET;
-        }
-
-        // Skip the . charcater
-        str++;
-
-        // Update the network IP variable
-        ip = (ip << 8) | (num & 0xFF);
-    }
-
-    *ip_addr = ip;
-    return 0;
-}
-
-// Converts a network IP address into a string. The string must be at least 16 
-// characters
-void ip_to_string(char* str, u32 addr) {
-    for (u32 i = 4; i --> 0;) {
-        // Get a new byte-segment of the IP address
-        u8 segment = (addr >> (i * 8)) & 0xFF;
-        u8 base = 100;
-
-        // Prevent any starting zeros
-        while (base > segment) {
-            base /= 10;
-        }
+static struct boot_image tftp_image;
 
-        // The current segment is zero
-        if (base == 0) {
-            *str++ = '0';
-        }
+// Receiver of the file data
+static void (*tftp_write)(const u8* data, u32 size);
 
-        // Print the number to the buffer
-        while (base) {
-            *str++ = (segment / base) + '0';
-            segment = segment % base;
-            base = base / 10;
-        }
+// Staging of the next kernel. This is shared by the blocking read and the prefetch
+static u32 stage_state;
+static u32 stage_file;
+static u8* stage_dest;
+static u32 stage_entry;
 
-        // Add the delimiter
-        if (i) {
-            *str++ = '.';
-        }
-    }
-    *str = 0;
-}
-
-// Check is a given character is a hexadecimal character
-static inline u8 is_hex(char c) {
-    if ((c >= '0' && c <= '9') || (c >= 'A' && c <= 'F') || (c >= 'a' && c <= 'f')) {
-        return 1;
-    } else {
-        return 0;
-    }
-}
-
-// Converts a hexadecimal character to a number in range 0..15
-static inline u8 hex_to_num(char hex) {
-    if ((hex >= '0' && hex <= '9')) {
-        return hex - '0';
-    }
-
-    // Try to clear bit 5 to convert to uppercase
-    hex &= ~(1 << 5);
-
-    if ((hex >= 'A' && hex <= 'F')) {
-        return hex - 'A' + 10;
-    }
-
-    return 0;
-}
-
-// Converts a string into a network MAC address. This returns 0 if success and -ERR_NET if
-// failure
-i32 string_to_mac(const char* str, u8* mac) {
-    for (u32 i = 0; i < 6; i++) {
-        // We use two variables for tracking if the segment has right format
-        u32 num = 0;
-        u32 index = 2;
-
-        while (is_hex(*str)) {
-            num = num * 16 + hex_to_num(*str++);
-
-            if (num > 0xFF || !index--) {
-                return -ERR_NET;
-            }
-        }
-        
-        // Check the formatting
-        if ((i == 5 && *str != '\0') || (i != 5 && *str != ':')) {
-            return -ERR_NET;
-        }
-
-        // Skip the . charcater
-        str++;
-
-        // Update the network IP variable
-        *mac++ = (u8)num;
-    }
-    return 0;
-}
-
-// Converts a network MAC address into a string. The string must be at least 18 
-// characters
-void mac_to_string(char* str, u8* mac, u8 lowercase) {
-    u8 lower = (lowercase) ? (1 << 5) : 0;
-    for (u32 i = 6; i --> 0;) {
-        // Get a new byte-segment of the IP address
-        u8 segment = *mac++;
+#ifdef DELTA_REBOOT
+// Time of the last packet from the delta server
+static u32 stage_last_packet;
+static u32 stage_idle_polls;
+#endif
 
-        *str++ = hex_lookup[(segment >> 4) & 0xF] | lower;        
-        *str++ = hex_lookup[(segment >> 0) & 0xF] | lower;        
+// Set when the control port asks for the prefetched kernel
+static u32 switch_requested;
 
-        // Add the delimiter
-        if (i) {
-            *str++ = ':';
-        }
-    }
-    *str = 0;
-}
+// Handoff block from the previous kernel, or NULL after a cold boot
+static const struct handoff* handoff;
+static u32 tftp_server_ip;
+static u32 tftp_server_port;
+static u32 tftp_client_ip;
+static u32 tftp_done;
 
 // Copies a MAC address from `source` to `dest` 
 void copy_mac_addr(const u8* source, u8* dest) {
@@ -271,11 +201,8 @@ void update_mac_addr(const u8* new_mac) {
 // MAC header. 
 static void mac_send(struct netbuf* buf, const u8* dest_mac, u16 type) {
     // Append the MAC header before the current pointer
-    buf->len += sizeof(struct mac_header);
-    buf->ptr -= sizeof(struct mac_header);
-
-    // Get a pointer to the MAC header
-    struct mac_header* header = (struct mac_header *)buf->ptr;
+    struct mac_header* header = (struct mac_header *)netbuf_push(buf,
+        sizeof(struct mac_header));
 
     store_be16(type, &header->type);
     get_mac_addr(header->source_mac);
@@ -288,16 +215,13 @@ static void mac_send(struct netbuf* buf, const u8* dest_mac, u16 type) {
 // Sends an IP packet to the TFTP server identified by the global address configuration
 static void ip_send(struct netbuf* buf) {
     // Append the IPv4 header
-    buf->ptr -= sizeof(struct ip_header);
-    buf->len += sizeof(struct ip_header);
-
-    // Get a pointer to the IP header
-    struct ip_header* ipv4_header = (struct ip_header *)buf->ptr;
+    struct ip_header* ipv4_header = (struct ip_header *)netbuf_push(buf,
+        sizeof(struct ip_header));
 
-    // Fill in the fields
+    // Fill in the fields. The payload might continue in chained buffers
     ipv4_header->version_ihl = (4 << 4) | 5;
     ipv4_header->dscp_ecn = 0;
-    store_be16(buf->len, &ipv4_header->len);
+    store_be16(netbuf_chain_len(buf), &ipv4_header->len);
     store_be16(0, &ipv4_header->id);
     store_be16(0, &ipv4_header->frag_off);
     store_be16(0, &ipv4_header->crc);
@@ -314,16 +238,13 @@ static void ip_send(struct netbuf* buf) {
 // Sends a UDP packet to the TFTP server identified by the global configuration
 static void udp_send(struct netbuf* buf, u32 source_port, u32 dest_port) {
     // Append the UDP header
-    buf->ptr -= sizeof(struct udp_header);
-    buf->len += sizeof(struct udp_header);
-
-    // Get a pointer to the start of the header
-    struct udp_header* udp_header = (struct udp_header *)buf->ptr;
+    struct udp_header* udp_header = (struct udp_header *)netbuf_push(buf,
+        sizeof(struct udp_header));
 
     // Fill in the fields
     store_be16(source_port, &udp_header->source_port);
     store_be16(dest_port, &udp_header->dest_port);
-    store_be16(buf->len, &udp_header->len);
+    store_be16(netbuf_chain_len(buf), &udp_header->len);
     store_be16(0, &udp_header->crc);
 
     ip_send(buf);
@@ -335,8 +256,13 @@ static const u8 arp_fragment[8] = { 0x00, 0x01, 0x08, 0x00, 0x06, 0x04, 0x00, 0x
 // This will do a blocking ARP request. This returns 0 if success and -ERR_NET if the host
 // does not respond to the ARP. 
 i32 arp_get_mac_addr(u32 ip_addr, u8* mac_addr) {
-    struct netbuf* buf = alloc_netbuf();
-    struct arp_header* arp = (struct arp_header *)buf->ptr;
+    struct netbuf* buf = alloc_netbuf_len(sizeof(struct arp_header));
+    if (buf == NULL) {
+        proto_stats.tx_no_buffer++;
+        return -ERR_NET;
+    }
+    struct arp_header* arp = (struct arp_header *)netbuf_put(buf,
+        sizeof(struct arp_header));
 
     // Fill in the ARP stuff
     arp->mac_len = 6;
@@ -350,8 +276,6 @@ i32 arp_get_mac_addr(u32 ip_addr, u8* mac_addr) {
     store_be32(0, &arp->source_ip);
     store_be32(ip_addr, &arp->dest_ip);
 
-    buf->len = sizeof(struct arp_header);
-
     // Send the ARP packet
     u8 broad_mac[6] = { [0 ... 5] = 0xFF };
     mac_send(buf, broad_mac, MAC_TYPE_ARP);
@@ -365,12 +289,15 @@ i32 arp_get_mac_addr(u32 ip_addr, u8* mac_addr) {
         u32 valid = 1;
         
         // Check the ether type field
-        if (read_be16(buf->ptr + 12) != ETHER_TYPE_ARP) {
-            valid = 0;
+        if (buf->len < sizeof(struct mac_header) + sizeof(struct arp_header) ||
+            read_be16(buf->ptr + 12) != ETHER_TYPE_ARP) {
+            proto_stats.arp_dropped++;
+            free_netbuf(buf);
+            continue;
         }
 
         // Skip the MAC header
-        arp = (struct arp_header *)(buf->ptr + 14);
+        arp = (struct arp_header *)netbuf_pull(buf, sizeof(struct mac_header));
 
         // Compare the first framgent
         u8* arp_start = (u8 *)arp;
@@ -399,6 +326,7 @@ i32 arp_get_mac_addr(u32 ip_addr, u8* mac_addr) {
             free_netbuf(buf);
             return 0;
         }
+        proto_stats.arp_dropped++;
         free_netbuf(buf);
     }
     
@@ -409,8 +337,13 @@ i32 arp_get_mac_addr(u32 ip_addr, u8* mac_addr) {
 // This may prevent the server from sending us ARP requests
 void send_gratuitous_arp(u32 ip_addr) {
     // Send an ARP request
-    struct netbuf* buf = alloc_netbuf();
-    struct arp_header* arp = (struct arp_header *)buf->ptr;
+    struct netbuf* buf = alloc_netbuf_len(sizeof(struct arp_header));
+    if (buf == NULL) {
+        proto_stats.tx_no_buffer++;
+        return;
+    }
+    struct arp_header* arp = (struct arp_header *)netbuf_put(buf,
+        sizeof(struct arp_header));
 
     // Fill in the ARP stuff
     arp->mac_len = 6;
@@ -429,9 +362,6 @@ void send_gratuitous_arp(u32 ip_addr) {
     const u8 broad_mac[6] = { [0 ... 5] = 0xFF };
     copy_mac_addr(broad_mac, arp->dest_mac);
 
-    // Update the length of the ARP payload
-    buf->len = sizeof(struct arp_header);
-
     // Broadcast the ARP packet
     mac_send(buf, broad_mac, MAC_TYPE_ARP);
 }
@@ -439,12 +369,23 @@ void send_gratuitous_arp(u32 ip_addr) {
 // Handles and incoming ARP packet. If this is a request we send an ARP response
 void handle_arp(struct netbuf* buf) {
     struct arp_header* arp_header = (struct arp_header *)buf->ptr;
+    proto_stats.rx_arp++;
+
+    if (buf->len < sizeof(struct arp_header)) {
+        proto_stats.arp_dropped++;
+        return;
+    }
 
     if (read_be16(&arp_header->operation) == ARP_REQUEST && 
         read_be32(&arp_header->dest_ip) == tftp_client_ip) {
-        // Send an ARP response
-        struct netbuf* resp = alloc_netbuf();
-        struct arp_header* arp_header_resp = (struct arp_header *)resp->ptr;
+        // Send an ARP response. The server asks again if there is no buffer for it
+        struct netbuf* resp = alloc_netbuf_len(sizeof(struct arp_header));
+        if (resp == NULL) {
+            proto_stats.tx_no_buffer++;
+            return;
+        }
+        struct arp_header* arp_header_resp = (struct arp_header *)netbuf_put(resp,
+            sizeof(struct arp_header));
 
         // Fill in the ARP stuff
         arp_header_resp->mac_len = 6;
@@ -459,22 +400,26 @@ void handle_arp(struct netbuf* buf) {
         store_be32(tftp_client_ip, &arp_header_resp->source_ip);
         store_be32(read_be32(&arp_header->source_ip), &arp_header_resp->dest_ip);
 
-        resp->len = sizeof(struct arp_header);    
         mac_send(resp, arp_header->source_mac, MAC_TYPE_ARP);
+        proto_stats.tx_arp_replies++;
     }
 }
 
 // Sends a TFTP ACK to the server
 void tftp_ack(u32 block_num) {
-    struct netbuf* buf = alloc_netbuf();
-    buf->len = sizeof(struct tftp_ack);
+    // A lost ACK makes the server send the block again
+    struct netbuf* buf = alloc_netbuf_len(sizeof(struct tftp_ack));
+    if (buf == NULL) {
+        proto_stats.tx_no_buffer++;
+        return;
+    }
+    struct tftp_ack* ack = (struct tftp_ack *)netbuf_put(buf, sizeof(struct tftp_ack));
 
-    struct tftp_ack* ack = (struct tftp_ack *)buf->ptr;
-    
     store_be16(TFTP_OPCODE_ACK, &ack->opcode);
     store_be16(block_num, &ack->block_num);
 
     udp_send(buf, tftp_client_port, tftp_server_port);
+    proto_stats.tftp_tx_acks++;
 }
 
 // Current sequence number
@@ -486,18 +431,32 @@ static u32 curr_sequence_num = 0;
 void handle_udp(struct netbuf* buf) {
     struct udp_header* header = (struct udp_header *)buf->ptr;
 
+    // Drop the packet if the UDP length does not fit in the received data
+    u32 udp_len = read_be16(&header->len);
+    if (buf->len < sizeof(struct udp_header) || udp_len < sizeof(struct udp_header) ||
+        udp_len > buf->len) {
+        proto_stats.rx_ip_dropped++;
+        return;
+    }
+    netbuf_trim(buf, udp_len);
+    netbuf_pull(buf, sizeof(struct udp_header));
+
     if (read_be16(&header->dest_port) == tftp_client_port) {
-        // Update the TFTP server port
+        // The first reply gives the port of the server for this transfer. As RFC 1350
+        // asks, packets from any other port are not part of the transfer
+        u32 source_port = read_be16(&header->source_port);
         if (tftp_server_port == 0) {
-            tftp_server_port = read_be16(&header->source_port);
+            tftp_server_port = source_port;
+        } else if (source_port != tftp_server_port) {
+            proto_stats.rx_udp_bad_port++;
+            return;
         }
 
-        // Get the lenght
-        u16 len = read_be16(&header->len) - sizeof(struct udp_header) - 
-            sizeof(struct tftp_data_header);
-
-        // Advance the pointer
-        buf->ptr += sizeof(struct udp_header);
+        if (buf->len < sizeof(struct tftp_data_header)) {
+            proto_stats.tftp_bad_opcode++;
+            return;
+        }
+        u16 len = buf->len - sizeof(struct tftp_data_header);
         struct tftp_data_header* tftp_header = (struct tftp_data_header *)buf->ptr;
 
         // Check if the TFTP is a data packet
@@ -509,42 +468,52 @@ void handle_udp(struct netbuf* buf) {
                 // Get the data pointer
                 u8* src = buf->ptr + sizeof(struct tftp_data_header);
 
-                // Copy the file fragment to memory
-                for (u32 i = 0; i < len; i++) {
-                    *tftp_tmp_dest++ = *src++;
-                }
+                // Place the file fragment in memory. An error is reported at the end
+                tftp_write(src, len);
 
                 tftp_ack(sequence_num);
                 curr_sequence_num++;
+                proto_stats.tftp_rx_blocks++;
+                proto_stats.tftp_rx_bytes += len;
 
                 // ZLP or short packes is interpreted as the EOF marker
                 if (len != packet_size) {
-                    tftp_done = 1;
+                    tftp_done = TFTP_DONE;
                 }
+            } else if (sequence_num == (u16)curr_sequence_num) {
+                // The server did not get our last ACK and is retransmitting
+                proto_stats.tftp_duplicates++;
+            } else {
+                proto_stats.tftp_out_of_order++;
             }
         } else if (read_be16(&tftp_header->opcode) == TFTP_OPCODE_OACK) {
 
-            // Check if the OACK contains "blksize" with the wrong size
-            buf->ptr += 2;
+            // Check if the OACK contains "blksize" with the wrong size. The option is
+            // never longer than the netbuf tailroom, so a short packet only fails the
+            // compare
+            u8* ptr = netbuf_pull(buf, 2);
             u32 success = 1;
             const char* block_size_str = "blksize";
             while (*block_size_str) {
-                if (*buf->ptr++ != *block_size_str++) {
+                if (*ptr++ != *block_size_str++) {
                     success = 0;
                 }
             }
             // Check the terminating zero
-            if (*buf->ptr++) {
+            if (*ptr++) {
                 success = 0;
             }
             const char* size_str = TFTP_DATA_SIZE;
             while (*size_str) {
-                if (*buf->ptr++ != *size_str++) {
+                if (*ptr++ != *size_str++) {
                     success = 0;
                 }
             }
             // Check the terminating zero
-            if (*buf->ptr++) {
+            if (*ptr++) {
+                success = 0;
+            }
+            if (ptr > buf->ptr + buf->len) {
                 success = 0;
             }
 
@@ -554,7 +523,21 @@ void handle_udp(struct netbuf* buf) {
 
             // Send the ACK
             tftp_ack(0);
+        } else if (read_be16(&tftp_header->opcode) == TFTP_OPCODE_ERROR) {
+            // The server does not have the file
+            tftp_done = TFTP_FAILED;
+        } else {
+            proto_stats.tftp_bad_opcode++;
+        }
+    } else if (read_be16(&header->dest_port) == TFTP_CONTROL_PORT) {
+        u32 len = buf->len;
+        const char* command = TFTP_SWITCH_COMMAND;
+
+        if (len == sizeof(TFTP_SWITCH_COMMAND) - 1 && mem_cmp(buf->ptr, command, len)) {
+            switch_requested = 1;
         }
+    } else {
+        proto_stats.rx_udp_bad_port++;
     }
 }
 
@@ -562,18 +545,47 @@ void handle_udp(struct netbuf* buf) {
 void handle_tftp(struct netbuf* buf) {
     struct ip_header* header = (struct ip_header *)buf->ptr;
 
+    if (buf->len < sizeof(struct ip_header)) {
+        proto_stats.rx_ip_dropped++;
+        return;
+    }
+
     // Check the IP, len and protocol
-    if (header->protocol == 0x11 && read_be32(&header->dest_ip) == tftp_client_ip) {
-        // Skip the IP header
-        buf->ptr += sizeof(struct ip_header);
+    u32 ip_len = read_be16(&header->len);
+    if (header->protocol == 0x11 && read_be32(&header->dest_ip) == tftp_client_ip &&
+        ip_len >= sizeof(struct ip_header) && ip_len <= buf->len) {
+        // Drop the ethernet padding and skip the IP header
+        netbuf_trim(buf, ip_len);
+        netbuf_pull(buf, sizeof(struct ip_header));
         handle_udp(buf);
+    } else {
+        proto_stats.rx_ip_dropped++;
     }
 }
 
-// Performs a TFTP read request
-void tftp_request(const char* file_name, const char* block_size) {
-    struct netbuf* buf = alloc_netbuf();
-    
+// Returns the size of a string including the terminating zero
+static u32 tftp_string_size(const char* str) {
+    u32 size = 1;
+    while (*str++) {
+        size++;
+    }
+    return size;
+}
+
+// Performs a TFTP read request to the server port `port`
+void tftp_request(const char* file_name, const char* block_size, u32 port) {
+    // The request is usually short enough for a small netbuf
+    u32 len = 2 + tftp_string_size(file_name) + sizeof("octet");
+    if (block_size) {
+        len += sizeof("blksize") + tftp_string_size(block_size);
+    }
+
+    struct netbuf* buf = alloc_netbuf_len(len);
+    if (buf == NULL) {
+        proto_stats.tx_no_buffer++;
+        return;
+    }
+
     u8* ptr = buf->ptr;
 
     store_be16(TFTP_OPCODE_READ, ptr);
@@ -604,96 +616,504 @@ void tftp_request(const char* file_name, const char* block_size) {
     }
 
     // Update the length
-    buf->len = ptr - buf->ptr;
+    netbuf_put(buf, ptr - buf->ptr);
 
     // Send the new packet
-    udp_send(buf, tftp_client_port, 69);
+    udp_send(buf, tftp_client_port, port);
 }
 
-// Tries to read the given file from TFTP server. This will write the file to `dest`
-i32 tftp_read_file(void* dest) {
+// Returns the time in ms, or 0 if the board has no timer
+static u32 tftp_time() {
+    const struct timer_iface* timer = get_timer();
+    if (timer && timer->get_time) {
+        return timer->get_time();
+    }
+    return 0;
+}
 
-    // Clear the server TFTP port
+// Handles one received packet and frees it
+static void tftp_handle(struct netbuf* buf) {
+    struct mac_header* mac_header = (struct mac_header *)buf->ptr;
+    proto_stats.rx_packets++;
+
+    // Skip MAC header
+    if (netbuf_pull(buf, sizeof(struct mac_header)) == NULL) {
+        proto_stats.rx_runts++;
+    } else if (read_be16(&mac_header->type) == MAC_TYPE_ARP) {
+        handle_arp(buf);
+    } else if (read_be16(&mac_header->type) == MAC_TYPE_IPv4) {
+        handle_tftp(buf);
+    } else {
+        proto_stats.rx_unknown_ethertype++;
+    }
+
+    // Free the netbuffer after use
+    free_netbuf(buf);
+}
+
+// Handles the packets waiting in the NIC, up to the poll budget. This returns 0 if there
+// was no packet
+static u32 tftp_receive() {
+    return nic_poll(NIC_POLL_BUDGET, tftp_handle);
+}
+
+// Moves to a new client port for the next transfer. Anything sent on behalf of the
+// transfer, like the delta hashes, must come after this
+static void tftp_next_port() {
+    tftp_client_port++;
+    if (tftp_client_port >= TFTP_CLIENT_PORT_FIRST + TFTP_CLIENT_PORT_COUNT) {
+        tftp_client_port = TFTP_CLIENT_PORT_FIRST;
+    }
+}
+
+// Requests `file_name` from the TFTP server at `port`. The data is passed to tftp_write as
+// the packets are received. The caller picks the client port with tftp_next_port first
+static void tftp_get_start(const char* file_name, u32 port) {
     tftp_server_port = 0;
     curr_sequence_num = 0;
+    tftp_done = TFTP_RUNNING;
+    tftp_request(file_name, TFTP_DATA_SIZE, port);
+}
 
-    // Get the TFTP size
-    packet_size = 0;
-    const char* size_ptr = TFTP_DATA_SIZE;
-    const char* tmp = size_ptr;
-    while (*tmp) {
-        packet_size = packet_size * 10 + (*tmp++ - '0');
+static void tftp_write_boot_image(const u8* data, u32 size) {
+    boot_image_write(&tftp_image, data, size);
+}
+
+#ifdef DELTA_REBOOT
+
+// Start and end of the read-only part of the running image. Everything after it is
+// changed at runtime and always sent in full
+extern u8 _kernel_s[];
+extern u8 _rodata_e[];
+
+static struct delta tftp_delta;
+
+static void tftp_write_delta(const u8* data, u32 size) {
+    delta_write(&tftp_delta, data, size);
+}
+
+// Sends the block hashes of the read-only part of the running image to the delta server
+static u32 delta_send_hashes() {
+    u32 blocks = (_rodata_e - _kernel_s) / DELTA_BLOCK_SIZE;
+    u32 base_size = blocks * DELTA_BLOCK_SIZE;
+
+    for (u32 first = 0; first < blocks; first += DELTA_HASHES_PER_PACKET) {
+        u32 count = blocks - first;
+        if (count > DELTA_HASHES_PER_PACKET) {
+            count = DELTA_HASHES_PER_PACKET;
+        }
+
+        // Missing hashes make the server refuse the delta, and the full image is used
+        struct netbuf* buf = alloc_netbuf();
+        if (buf == NULL) {
+            proto_stats.tx_no_buffer++;
+            break;
+        }
+        struct delta_hashes* packet = (struct delta_hashes *)netbuf_put(buf,
+            sizeof(struct delta_hashes) + count * 4);
+        packet->magic = DELTA_MAGIC;
+        packet->version = DELTA_VERSION;
+        packet->block_size = DELTA_BLOCK_SIZE;
+        packet->base_size = base_size;
+        packet->first_block = first;
+        packet->count = count;
+
+        for (u32 i = 0; i < count; i++) {
+            const u8* block = _kernel_s + (first + i) * DELTA_BLOCK_SIZE;
+            packet->hashes[i] = crc32(block, DELTA_BLOCK_SIZE);
+        }
+
+        udp_send(buf, tftp_client_port, DELTA_PORT);
+    }
+    return base_size;
+}
+
+// Asks the delta server for the changed blocks. The new image is built at `dest` from the
+// running image and the blocks
+static void delta_start(void* dest, u32 stage_size) {
+    // The delta server matches the hashes to the request by the client port
+    tftp_next_port();
+    u32 base_size = delta_send_hashes();
+    delta_init(&tftp_delta, dest, stage_size, _kernel_s, base_size);
+
+    tftp_write = tftp_write_delta;
+    tftp_get_start(TFTP_FILE_NAME, DELTA_PORT);
+}
+
+// Returns 0 if the delta transfer gave a complete and correct image
+static i32 delta_check() {
+    if (tftp_done != TFTP_DONE) {
+        return -ERR_NET;
     }
-    curr_sequence_num = 0;
 
+    i32 size = delta_finish(&tftp_delta);
+    if (size < 0) {
+        return size;
+    }
+    kprint("Delta reboot received {u} bytes for a {u} byte image\n",
+        (u32)proto_stats.tftp_rx_bytes, size);
+    return 0;
+}
+
+#endif
+
+// Resolves the MAC address of the server and announces our own
+static void tftp_connect() {
     // Get the network IP address
     string_to_ip(TFTP_SERVER_IP, &tftp_server_ip);
     string_to_ip(TFTP_CLIENT_IP, &tftp_client_ip);
 
-    boot_start_timer();
+    // The previous kernel already resolved the server and announced us. This is only
+    // trusted if all the addresses are the same
+    if (handoff && (handoff->flags & HANDOFF_SERVER) && handoff->server_ip == tftp_server_ip &&
+        handoff->client_ip == tftp_client_ip && mem_cmp(handoff->client_mac, mac_addr, 6)) {
+        copy_mac_addr(handoff->server_mac, tftp_server_mac);
+        return;
+    }
 
     // Get the MAC address of the host computer
-    while (arp_get_mac_addr(tftp_server_ip, tftp_server_mac) != 0);
+    while (arp_get_mac_addr(tftp_server_ip, tftp_server_mac) != 0) {
+        proto_stats.arp_retransmits++;
+    }
 
     // Send a gratuitous ARP advertising our MAC address
     send_gratuitous_arp(tftp_client_ip);
+}
 
-    // This is where we copy the file
-    tftp_tmp_dest = dest;
-    tftp_request(TFTP_FILE_NAME, TFTP_DATA_SIZE);
+// Returns the physical address of the handoff block at the end of the DDR
+static u32 handoff_phys() {
+    return (u32)ddr_start + (u32)ddr_size - HANDOFF_SIZE;
+}
 
-    // This loop will read the file
-    tftp_done = 0;
-    while (tftp_done == 0) {
-        // Try to receive a raw packet
-        struct netbuf* buf = nic_receive();
-        if (buf == NULL) {
-            continue;
-        }
+// Returns the number of bytes a file staged at `dest` may use. This is the rest of the DDR
+// below the handoff block
+static u32 tftp_stage_size(void* dest) {
+    return handoff_phys() - virt_to_phys(dest);
+}
 
-        // We have a new packet
-        struct mac_header* mac_header = (struct mac_header *)buf->ptr;
+// Returns the handoff block if this kernel was started by a soft reboot. The block lies
+// outside any staging area, so it stays intact while this kernel runs
+static const struct handoff* handoff_receive() {
+    if (boot_args[BOOT_ARG_HANDOFF] != handoff_phys()) {
+        return NULL;
+    }
 
-        // Skip MAC header
-        buf->ptr += sizeof(struct mac_header);
+    const struct handoff* block = phys_to_virt(handoff_phys());
+    if (handoff_check(block) || block->ddr_start != (u32)ddr_start ||
+        block->ddr_size != (u32)ddr_size || block->sram_start != (u32)sram_start) {
+        return NULL;
+    }
+    return block;
+}
+
+// Starts the new kernel at the physical address `entry`. The state of the network stack
+// is handed over, so the new kernel does not have to find it again
+static void tftp_jump(u32 entry) {
+    struct handoff* block = phys_to_virt(handoff_phys());
+    mem_set(block, 0, sizeof(struct handoff));
+
+    nic_save_link(block);
+    copy_mac_addr(mac_addr, block->client_mac);
+    copy_mac_addr(tftp_server_mac, block->server_mac);
+    block->client_ip = tftp_client_ip;
+    block->server_ip = tftp_server_ip;
+    block->flags |= HANDOFF_SERVER;
+
+    if (get_timer()) {
+        block->time = boot_get_time();
+        block->flags |= HANDOFF_TIME;
+    }
+
+    block->ddr_start = (u32)ddr_start;
+    block->ddr_size = (u32)ddr_size;
+    block->sram_start = (u32)sram_start;
+    handoff_seal(block);
+
+    // No frame may be written into this kernel while the new one is copied over it
+    nic_stop();
+
+#ifdef SMP
+    // The secondary cores run from this kernel, which the new one overwrites
+    smp_stop();
+#endif
+
+    kernel_jump(entry, handoff_phys());
+}
+
+// Returns the TFTP data size from the config
+static u32 tftp_packet_size() {
+    u32 size = 0;
+    const char* tmp = TFTP_DATA_SIZE;
+    while (*tmp) {
+        size = size * 10 + (*tmp++ - '0');
+    }
+    return size;
+}
+
+// Starts reading the full boot image to the staging area
+static void stage_full_start() {
+    boot_image_init(&tftp_image, stage_dest, tftp_stage_size(stage_dest));
+    tftp_write = tftp_write_boot_image;
+    stage_file = STAGE_FULL;
+    tftp_next_port();
+    tftp_get_start(TFTP_FILE_NAME, 69);
+}
 
-        if (read_be16(&mac_header->type) == MAC_TYPE_ARP) {
-            handle_arp(buf);
-        } else if (read_be16(&mac_header->type) == MAC_TYPE_IPv4) {
-            handle_tftp(buf);
+// Starts staging the next kernel at `dest`. With delta reboot only the changed blocks
+// are asked for first, and the full image is read if the delta server fails
+static void tftp_stage_start(void* dest) {
+    packet_size = tftp_packet_size();
+
+    // The device tree might lie in the staging area
+    boot_fdt_drop();
+    tftp_connect();
+
+    stage_dest = dest;
+    stage_entry = 0;
+    stage_state = STAGE_RUNNING;
+
+#ifdef DELTA_REBOOT
+    stage_file = STAGE_DELTA;
+    stage_last_packet = tftp_time();
+    stage_idle_polls = 0;
+    delta_start(dest, tftp_stage_size(dest));
+#else
+    stage_full_start();
+#endif
+}
+
+#ifdef DELTA_REBOOT
+// Returns 1 if the delta server has been quiet for too long. `received` is the number of
+// packets handled by the last poll
+static u32 stage_timed_out(u32 received) {
+    if (received) {
+        stage_last_packet = tftp_time();
+        stage_idle_polls = 0;
+        return 0;
+    }
+
+    stage_idle_polls++;
+    u32 idle = get_timer() ? tftp_time() - stage_last_packet :
+        stage_idle_polls / TFTP_POLLS_PER_MS;
+    return idle > DELTA_TIMEOUT_MS;
+}
+#endif
+
+// Handles the packets received since the last call, up to the poll budget, and moves the
+// staging on. A segmented boot image is checked as soon as it is complete. Returns the
+// staging state
+static u32 tftp_stage_poll() {
+#ifdef DELTA_REBOOT
+    u32 received = tftp_receive();
+#else
+    tftp_receive();
+#endif
+    if (stage_state != STAGE_RUNNING) {
+        return stage_state;
+    }
+
+#ifdef DELTA_REBOOT
+    if (stage_file == STAGE_DELTA) {
+        if (tftp_done == TFTP_RUNNING && stage_timed_out(received)) {
+            tftp_done = TFTP_FAILED;
+        }
+        if (tftp_done == TFTP_RUNNING) {
+            return STAGE_RUNNING;
         }
 
-        // Free the netbuffer after use
-        free_netbuf(buf);
+        // The delta image starts at the beginning of the staging area
+        if (delta_check() == 0) {
+            stage_state = STAGE_READY;
+            return stage_state;
+        }
+
+        kprint("Delta reboot failed. Reading the full image\n");
+        stage_full_start();
+        return STAGE_RUNNING;
     }
+#endif
 
-    boot_message("Starting new kernel at {p}\n", dest);
+    if (tftp_done == TFTP_RUNNING) {
+        return STAGE_RUNNING;
+    }
 
-    // We have a new image in memory - execute it
-    void (*new_kernel)() = (void *)((u32)dest);
-    new_kernel();
+    // Never jump into an image that did not arrive intact
+    if (tftp_done == TFTP_DONE && boot_image_finish(&tftp_image, &stage_entry) == 0) {
+        stage_state = STAGE_READY;
+    } else {
+        stage_state = STAGE_FAILED;
+    }
+    return stage_state;
+}
+
+// Sleeps until the NIC has work. While the delta server is asked, the wait could hide its
+// timeout, so this returns at once
+void tftp_wait() {
+#ifdef DELTA_REBOOT
+    if (stage_state == STAGE_RUNNING && stage_file == STAGE_DELTA) {
+        return;
+    }
+#endif
+    nic_wait();
+}
+
+// Starts the staged kernel
+static void stage_jump() {
+    boot_message("Starting new kernel at {p}\n", stage_dest + stage_entry);
+
+    // The new kernel expects to be started with the MMU and the caches off
+    tftp_jump(virt_to_phys(stage_dest) + stage_entry);
+}
+
+// Tries to read the given file from TFTP server. This will write the file to `dest` and
+// start it. A segmented boot image is checked first, and -ERR_CORRUPT is returned if it
+// is damaged. With delta reboot only the changed blocks are read if the delta server
+// answers, and the full file otherwise
+i32 tftp_read_file(void* dest) {
+    boot_start_timer();
+    tftp_stage_start(dest);
+
+    while (tftp_stage_poll() == STAGE_RUNNING) {
+        tftp_wait();
+    }
 
+    if (stage_state != STAGE_READY) {
+        kprint("Boot image is corrupt\n");
+        return -ERR_CORRUPT;
+    }
+
+    stage_jump();
     return 0;
 }
 
-// Start the networking
-void tftp_init() {
-    kprint("Starting TFTP/IP soft reboot stack\n");
-    netbuf_init();
+// Starts reading the next kernel to `dest` in the background. The transfer advances each
+// time tftp_prefetch_poll is called, so the running kernel keeps working meanwhile. This
+// takes the same delta and full image steps as tftp_read_file
+void tftp_prefetch_start(void* dest) {
+    switch_requested = 0;
+    tftp_stage_start(dest);
+    kprint("Prefetching the next kernel to {p}\n", dest);
+}
+
+// Handles the packets received since the last call, up to the poll budget. If a switch
+// has been requested, the new kernel is started once it is ready
+void tftp_prefetch_poll() {
+    u32 running = (stage_state == STAGE_RUNNING);
+    u32 state = tftp_stage_poll();
+
+    if (running && state == STAGE_READY) {
+        kprint("Next kernel is ready\n");
+    } else if (running && state == STAGE_FAILED) {
+        kprint("Prefetch failed\n");
+    }
+
+    if (switch_requested && state == STAGE_READY) {
+        tftp_switch();
+    }
+}
 
-    // Call the device specific NIC initialization routine
-    nic_init();
+// Starts the prefetched kernel. The image is already in memory and checked, so this only
+// costs the relocation done by the new kernel. This returns -ERR_NET if no kernel is ready
+i32 tftp_switch() {
+    if (stage_state != STAGE_READY) {
+        return -ERR_NET;
+    }
+
+    stage_jump();
+    return 0;
+}
 
-    // Update our MAC address
+// Call the device specific NIC initialization routine. After a soft reboot the link set
+// up by the previous kernel is used. Otherwise the auto-negotiation is left running, and
+// completed by tftp_nic_poll
+static i32 tftp_nic_start() {
+    handoff = handoff_receive();
+    if (handoff) {
+        if (handoff->flags & HANDOFF_TIME) {
+            boot_resume_timer(handoff->time);
+        }
+        nic_resume(handoff);
+    } else {
+        nic_init_start();
+    }
+    return 0;
+}
+
+static i32 tftp_nic_poll() {
+    if (handoff == NULL && nic_init_poll()) {
+        return INITCALL_PENDING;
+    }
+    return 0;
+}
+
+static u32 mac_is_zero(const u8* mac) {
+    return (mac[0] | mac[1] | mac[2] | mac[3] | mac[4] | mac[5]) == 0;
+}
+
+// Reads the MAC address of the first ethernet controller from the device tree
+static void tftp_fdt_mac(u8* mac) {
+    struct fdt* fdt = boot_fdt();
+    if (fdt == NULL) {
+        return;
+    }
+
+    i32 node = fdt_path(fdt, "ethernet0");
+    u32 len = 0;
+    const u8* prop = fdt_prop(fdt, node, "local-mac-address", &len);
+    if (prop == NULL) {
+        prop = fdt_prop(fdt, node, "mac-address", &len);
+    }
+    if (prop && len == 6) {
+        copy_mac_addr(prop, mac);
+    }
+}
+
+static i32 tftp_stack_start() {
+    kprint("Starting TFTP/IP soft reboot stack\n");
+    net_stats_reset();
+
+    // Update our MAC address. A MAC address in the config is used first, then the one
+    // in the device tree, and then the one used by the previous kernel
     u8 mac[6];
-    if (string_to_mac(TFTP_CLIENT_MAC, mac) == 0) {
-        update_mac_addr(mac);
+    if (string_to_mac(TFTP_CLIENT_MAC, mac)) {
+        mem_set(mac, 0, 6);
     }
+    if (mac_is_zero(mac)) {
+        tftp_fdt_mac(mac);
+    }
+    if (mac_is_zero(mac) && handoff) {
+        copy_mac_addr(handoff->client_mac, mac);
+    }
+    update_mac_addr(mac);
 
     kprint("TFTP stack ready\n");
 
-    // TODO: Some packets are droppen unless this delay is present 
-    for (u32 i = 0; i < 500000; i++) {
-        asm ("nop");
-    }    
+    // TODO: Some packets are droppen unless this delay is present. The link is already
+    // settled after a soft reboot
+    if (handoff == NULL) {
+        for (u32 i = 0; i < 500000; i++) {
+            asm ("nop");
+        }
+    }
+    return 0;
+}
+
+DECLARE_INITCALL(netbuf);
+DECLARE_INITCALL(fdt);
+
+// The NIC registers its interrupt when it starts
+#ifdef NIC_IRQ
+DECLARE_INITCALL(irq);
+INITCALL(nic, tftp_nic_start, tftp_nic_poll, &initcall_netbuf, &initcall_irq);
+#else
+INITCALL(nic, tftp_nic_start, tftp_nic_poll, &initcall_netbuf);
+#endif
+INITCALL(tftp, tftp_stack_start, NULL, &initcall_nic, &initcall_fdt);
+
+// Starts the networking without the initcalls. This waits for the link to come up
+void tftp_init() {
+    netbuf_init();
+    tftp_nic_start();
+    while (tftp_nic_poll() == INITCALL_PENDING);
+    tftp_stack_start();
 }
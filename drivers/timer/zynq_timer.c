@@ -0,0 +1,55 @@
+// Timer driver for Xilinx Zynq-7000 chips (kernel driver)
+
+#include <chaos/timer.h>
+#include <zynq/regmap.h>
+
+// The global timer runs from the peripheral clock. QEMU models it at 100 MHz. This can be
+// overridden from the config file for real hardware
+#ifndef ZYNQ_TIMER_CLK
+#define ZYNQ_TIMER_CLK 100000000
+#endif
+
+// We prescale the global timer down to 1 MHz
+#define TIMER_PRESCALER ((ZYNQ_TIMER_CLK / 1000000) - 1)
+
+void zynq_init() {
+    struct global_timer_reg* const hw = GLOBAL_TIMER_REG;
+    hw->control = 0;
+    hw->control = (TIMER_PRESCALER << 8);
+}
+
+// Restarts the timer from zero
+void zynq_restart() {
+    struct global_timer_reg* const hw = GLOBAL_TIMER_REG;
+
+    // The counter can only be written while the timer is disabled
+    hw->control &= ~1;
+    hw->counter_low = 0;
+    hw->counter_high = 0;
+    hw->control |= 1;
+}
+
+// Returns the time in milliseconds
+u32 zynq_get_time() {
+    struct global_timer_reg* const hw = GLOBAL_TIMER_REG;
+    u32 high;
+    u32 low;
+
+    // Read the high word twice to catch a carry from the low word
+    do {
+        high = hw->counter_high;
+        low = hw->counter_low;
+    } while (high != hw->counter_high);
+
+    return (u32)((((u64)high << 32) | low) / 1000);
+}
+
+const struct timer_iface zynq_timer_iface = {
+    .init = zynq_init,
+    .restart = zynq_restart,
+    .get_time = zynq_get_time
+};
+
+const struct timer_iface* get_timer() {
+    return &zynq_timer_iface;
+}
@@ -7,19 +7,55 @@
 #include <chaos/cache.h>
 #include <chaos/timer.h>
 #include <chaos/boot_message.h>
+#include <chaos/initcall.h>
 #include <chaos/tftp.h>
 
+#ifdef NIC_BENCH
+#include <chaos/netbuf.h>
+#include <chaos/nic_bench.h>
+#endif
+
 // This is the memory padding between successive kernels
 #define KERNEL_PADDING 1000
 extern u32 linker_kernel_end;
 
+#ifdef NIC_BENCH
+static i32 nic_bench_initcall() {
+    nic_bench(NIC_BENCH_FRAMES, NIC_BENCH_SIZE);
+    return 0;
+}
+
+DECLARE_INITCALL(nic);
+INITCALL(nic_bench, nic_bench_initcall, NULL, &initcall_nic);
+#endif
+
+#ifdef SOFT_REBOOT_PREFETCH
+static i32 prefetch_initcall() {
+    tftp_prefetch_start(&linker_kernel_end + KERNEL_PADDING);
+    return 0;
+}
+
+DECLARE_INITCALL(tftp);
+INITCALL(prefetch, prefetch_initcall, NULL, &initcall_tftp);
+#endif
+
 void main() {
 
     kprint("\n\nStarting chaos kernel v2.0\n");
-    //boot_start_timer();
+
+    // Brings up everything registered with INITCALL. Slow hardware is finished in the
+    // background while the rest runs
+    initcall_run_all();
+    initcall_report();
 
     //tftp_init();
     //tftp_read_file(&linker_kernel_end + KERNEL_PADDING);
 
-    while (1);
+    while (1) {
+#ifdef SOFT_REBOOT_PREFETCH
+        // Sleep until the NIC interrupt fires. Under load the NIC is polled instead
+        tftp_wait();
+        tftp_prefetch_poll();
+#endif
+    }
 }
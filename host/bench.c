@@ -0,0 +1,238 @@
+// Microbenchmarks for the portable kernel code
+
+#include "harness.h"
+#include <chaos/mem.h>
+#include <chaos/list.h>
+#include <chaos/net_addr.h>
+#include <chaos/lz4.h>
+#include <chaos/crc32.h>
+#include <chaos/print_format.h>
+#include <chaos/fdt.h>
+#include <chaos/pool.h>
+#include "fdt_build.h"
+#include <stdio.h>
+
+// Sizes matching a full ethernet frame and a large image copy
+#define FRAME_SIZE 1514
+#define BLOCK_SIZE 65536
+
+static u8 src[BLOCK_SIZE + 4];
+static u8 dest[BLOCK_SIZE + 4];
+
+static void bench_mem_copy_frame(void) {
+    mem_copy(src, dest, FRAME_SIZE);
+    harness_sink += dest[0];
+}
+
+static void bench_mem_copy_frame_unaligned(void) {
+    mem_copy(src + 2, dest + 2, FRAME_SIZE);
+    harness_sink += dest[2];
+}
+
+static void bench_mem_copy_block(void) {
+    mem_copy(src, dest, BLOCK_SIZE);
+    harness_sink += dest[0];
+}
+
+static void bench_mem_set_block(void) {
+    mem_set(dest, harness_sink & 0xFF, BLOCK_SIZE);
+    harness_sink += dest[0];
+}
+
+static void bench_mem_cmp_frame(void) {
+    harness_sink += mem_cmp(src, src, FRAME_SIZE);
+}
+
+static void bench_read_be32(void) {
+    u32 sum = 0;
+    for (u32 i = 0; i < 256; i += 4) {
+        sum += read_be32(src + i);
+    }
+    harness_sink += sum;
+}
+
+static void bench_print_format(void) {
+    char buf[64];
+    harness_sink += print_format_to_buf(buf, sizeof(buf), "[{3:u}.{0:3:u}] {s} {p}\n",
+        harness_sink, 123, "message", 0x20000000);
+}
+
+static void bench_string_to_ip(void) {
+    u32 ip;
+    string_to_ip("192.168.10.200", &ip);
+    harness_sink += ip;
+}
+
+static void bench_ip_to_string(void) {
+    char str[16];
+    ip_to_string(str, 0xC0A80AC8 + harness_sink);
+    harness_sink += str[0];
+}
+
+static void bench_string_to_mac(void) {
+    u8 mac[6];
+    string_to_mac("ca:ca:ca:ca:ca:dd", mac);
+    harness_sink += mac[5];
+}
+
+static struct list_node list;
+static struct list_node nodes[64];
+
+static void bench_list_push_pop(void) {
+    for (u32 i = 0; i < 64; i++) {
+        list_push_back(&nodes[i], &list);
+    }
+    while (list_pop_front(&list));
+}
+
+// Netbuf sized pool. A burst of 64 is more than the two magazines of a core hold, so the
+// depot is used on both the alloc and the free side, as it is with a full RX ring
+#define POOL_OBJS 256
+
+static struct pool pool;
+static struct pool_cpu pool_cpu;
+static struct pool_magazine pool_mags[POOL_MAGAZINES(POOL_OBJS)];
+static u32 pool_objs[POOL_OBJS];
+static void* pool_burst[64];
+
+static void pool_setup(void) {
+    pool_init(&pool, &pool_cpu, pool_mags, POOL_MAGAZINES(POOL_OBJS));
+    for (u32 i = 0; i < POOL_OBJS; i++) {
+        pool_add(&pool, &pool_objs[i]);
+    }
+}
+
+static void bench_pool_alloc_free(void) {
+    void* obj = pool_alloc(&pool);
+    pool_free(&pool, obj);
+    harness_sink += (u32)(uintptr_t)obj;
+}
+
+static void bench_pool_burst(void) {
+    for (u32 i = 0; i < 64; i++) {
+        pool_burst[i] = pool_alloc(&pool);
+    }
+    for (u32 i = 0; i < 64; i++) {
+        pool_free(&pool, pool_burst[i]);
+    }
+}
+
+// LZ4 block of short literal runs and longer matches, similar to the mix in a compressed
+// kernel image. The block decompresses to BLOCK_SIZE bytes
+static u8 lz4_block[BLOCK_SIZE];
+static u32 lz4_block_size;
+
+static void lz4_build_block(void) {
+    u8* ptr = lz4_block;
+    u32 written = 0;
+
+    while (written + 36 + 15 <= BLOCK_SIZE) {
+        // 8 literals and a match of 28 bytes
+        *ptr++ = 0x8F;
+        for (u32 i = 0; i < 8; i++) {
+            *ptr++ = src[(written + i) & 0xFFF];
+        }
+        written += 8;
+
+        u32 offset = written < 1000 ? written : 1000;
+        *ptr++ = offset & 0xFF;
+        *ptr++ = offset >> 8;
+        *ptr++ = 28 - 4 - 15;
+        written += 28;
+    }
+
+    // The block ends with less than 255 literals
+    u32 last = BLOCK_SIZE - written;
+    *ptr++ = 0xF0;
+    *ptr++ = last - 15;
+    for (u32 i = 0; i < last; i++) {
+        *ptr++ = src[i];
+    }
+    lz4_block_size = ptr - lz4_block;
+}
+
+static void bench_lz4_decompress(void) {
+    harness_sink += lz4_decompress(lz4_block, lz4_block_size, dest, BLOCK_SIZE);
+}
+
+static void bench_crc32_frame(void) {
+    harness_sink += crc32(src, FRAME_SIZE);
+}
+
+// Tree shaped like a board device tree, with 16 buses of 12 devices each. The lookups go
+// to the last device, which is the worst case for a walk
+static u8 fdt_blob[32768];
+static struct fdt fdt_walk;
+static struct fdt fdt_indexed;
+static struct fdt_index fdt_index;
+
+static void fdt_build_board(void) {
+    char name[32];
+
+    fdt_build_start();
+    fdt_build_begin("");
+    for (u32 bus = 0; bus < 16; bus++) {
+        sprintf(name, "bus@%x", bus << 24);
+        fdt_build_begin(name);
+        for (u32 dev = 0; dev < 12; dev++) {
+            sprintf(name, "device@%x", (bus << 24) | (dev << 12));
+            fdt_build_begin(name);
+            fdt_build_prop_string("compatible", "vendor,device");
+            fdt_build_prop_string("status", "okay");
+            fdt_build_prop_u32("phandle", bus * 12 + dev + 1);
+            fdt_build_end();
+        }
+        fdt_build_end();
+    }
+    fdt_build_end();
+
+    u32 size = fdt_build_finish(fdt_blob);
+    fdt_init(&fdt_walk, fdt_blob, size, NULL);
+    fdt_init(&fdt_indexed, fdt_blob, size, &fdt_index);
+}
+
+static void bench_fdt_path_walk(void) {
+    harness_sink += fdt_path(&fdt_walk, "/bus@f000000/device@f00b000");
+}
+
+static void bench_fdt_path_indexed(void) {
+    harness_sink += fdt_path(&fdt_indexed, "/bus@f000000/device@f00b000");
+}
+
+static void bench_fdt_phandle_walk(void) {
+    harness_sink += fdt_phandle(&fdt_walk, 192);
+}
+
+static void bench_fdt_phandle_indexed(void) {
+    harness_sink += fdt_phandle(&fdt_indexed, 192);
+}
+
+void run_benchmarks(void) {
+    for (u32 i = 0; i < sizeof(src); i++) {
+        src[i] = i * 7;
+    }
+    list_init(&list);
+    lz4_build_block();
+    fdt_build_board();
+    pool_setup();
+
+    harness_bench("mem_copy_frame", bench_mem_copy_frame, FRAME_SIZE);
+    harness_bench("mem_copy_frame_unaligned", bench_mem_copy_frame_unaligned, FRAME_SIZE);
+    harness_bench("mem_copy_64k", bench_mem_copy_block, BLOCK_SIZE);
+    harness_bench("mem_set_64k", bench_mem_set_block, BLOCK_SIZE);
+    harness_bench("mem_cmp_frame", bench_mem_cmp_frame, FRAME_SIZE);
+    harness_bench("read_be32_x64", bench_read_be32, 256);
+    harness_bench("print_format", bench_print_format, 0);
+    harness_bench("string_to_ip", bench_string_to_ip, 0);
+    harness_bench("ip_to_string", bench_ip_to_string, 0);
+    harness_bench("string_to_mac", bench_string_to_mac, 0);
+    harness_bench("list_push_pop_x64", bench_list_push_pop, 0);
+    harness_bench("pool_alloc_free", bench_pool_alloc_free, 0);
+    harness_bench("pool_burst_x64", bench_pool_burst, 0);
+    harness_bench("lz4_decompress_64k", bench_lz4_decompress, BLOCK_SIZE);
+    harness_bench("crc32_frame", bench_crc32_frame, FRAME_SIZE);
+    harness_bench("fdt_path_walk", bench_fdt_path_walk, 0);
+    harness_bench("fdt_path_indexed", bench_fdt_path_indexed, 0);
+    harness_bench("fdt_phandle_walk", bench_fdt_phandle_walk, 0);
+    harness_bench("fdt_phandle_indexed", bench_fdt_phandle_indexed, 0);
+}
@@ -0,0 +1,94 @@
+// Builds flattened device trees for the FDT tests and benchmarks
+
+#include "fdt_build.h"
+#include <chaos/fdt.h>
+#include <chaos/mem.h>
+#include <string.h>
+
+#define HEADER_SIZE 40
+#define RSVMAP_SIZE 16
+
+static u8 structs[65536];
+static char strings[4096];
+static u32 struct_size;
+static u32 strings_size;
+
+static void put_u32(u32 val) {
+    store_be32(val, structs + struct_size);
+    struct_size += 4;
+}
+
+// Returns the offset of `name` in the strings block. Names are shared like dtc does
+static u32 string_offset(const char* name) {
+    for (u32 offset = 0; offset < strings_size; offset += strlen(strings + offset) + 1) {
+        if (strcmp(strings + offset, name) == 0) {
+            return offset;
+        }
+    }
+    u32 offset = strings_size;
+    strcpy(strings + offset, name);
+    strings_size += strlen(name) + 1;
+    return offset;
+}
+
+void fdt_build_start(void) {
+    struct_size = 0;
+    strings_size = 0;
+}
+
+void fdt_build_begin(const char* name) {
+    put_u32(1);
+    u32 len = strlen(name) + 1;
+    memset(structs + struct_size, 0, (len + 3) & ~3);
+    memcpy(structs + struct_size, name, len);
+    struct_size += (len + 3) & ~3;
+}
+
+void fdt_build_end(void) {
+    put_u32(2);
+}
+
+void fdt_build_nop(void) {
+    put_u32(4);
+}
+
+void fdt_build_prop(const char* name, const void* data, u32 len) {
+    put_u32(3);
+    put_u32(len);
+    put_u32(string_offset(name));
+    memset(structs + struct_size, 0, (len + 3) & ~3);
+    memcpy(structs + struct_size, data, len);
+    struct_size += (len + 3) & ~3;
+}
+
+void fdt_build_prop_u32(const char* name, u32 val) {
+    u8 cell[4] = { 0 };
+    store_be32(val, cell);
+    fdt_build_prop(name, cell, 4);
+}
+
+void fdt_build_prop_string(const char* name, const char* str) {
+    fdt_build_prop(name, str, strlen(str) + 1);
+}
+
+u32 fdt_build_finish(u8* blob) {
+    put_u32(9);
+
+    u32 off_struct = HEADER_SIZE + RSVMAP_SIZE;
+    u32 off_strings = off_struct + struct_size;
+    u32 total = off_strings + strings_size;
+
+    memset(blob, 0, off_struct);
+    store_be32(FDT_MAGIC, blob);
+    store_be32(total, blob + 4);
+    store_be32(off_struct, blob + 8);
+    store_be32(off_strings, blob + 12);
+    store_be32(HEADER_SIZE, blob + 16);
+    store_be32(17, blob + 20);
+    store_be32(16, blob + 24);
+    store_be32(strings_size, blob + 32);
+    store_be32(struct_size, blob + 36);
+    memcpy(blob + off_struct, structs, struct_size);
+    memcpy(blob + off_strings, strings, strings_size);
+    return total;
+}
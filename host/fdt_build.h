@@ -0,0 +1,19 @@
+// Builds flattened device trees for the FDT tests and benchmarks
+
+#ifndef FDT_BUILD_H
+#define FDT_BUILD_H
+
+#include <chaos/types.h>
+
+void fdt_build_start(void);
+void fdt_build_begin(const char* name);
+void fdt_build_end(void);
+void fdt_build_nop(void);
+void fdt_build_prop(const char* name, const void* data, u32 len);
+void fdt_build_prop_u32(const char* name, u32 val);
+void fdt_build_prop_string(const char* name, const char* str);
+
+// Writes the blob to `blob` and returns its size
+u32 fdt_build_finish(u8* blob);
+
+#endif
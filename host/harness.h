@@ -0,0 +1,26 @@
+// Minimal test and benchmark harness for the host build of the portable kernel code
+
+#ifndef HARNESS_H
+#define HARNESS_H
+
+#include <chaos/types.h>
+
+// Checks a condition and records a failure without stopping the test run
+#define check(condition)                                  \
+    do {                                                  \
+        harness_check((condition), #condition, __FILE__, __LINE__); \
+    } while (0)
+
+void harness_check(int ok, const char* expr, const char* file, int line);
+
+// Runs `fn` until at least the minimum run time has passed and reports the time per
+// operation. `bytes` is the number of bytes processed by one call, or zero
+void harness_bench(const char* name, void (*fn)(void), u32 bytes);
+
+// Keeps the compiler from removing benchmark work
+extern volatile u32 harness_sink;
+
+void run_tests(void);
+void run_benchmarks(void);
+
+#endif
@@ -0,0 +1,105 @@
+// Host build of the portable kernel code. Runs the unit tests and the benchmarks and
+// writes one JSON object per result to the results file
+
+#include "harness.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifndef HOST_COMMIT
+#define HOST_COMMIT "unknown"
+#endif
+
+// Each benchmark runs for at least this long
+#define MIN_RUN_NS 100000000ULL
+
+volatile u32 harness_sink;
+
+static u32 checks;
+static u32 failures;
+static FILE* results;
+
+static u64 now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// The inline kernel helpers panic on bugs in the caller. No test takes those paths
+void panic(const char* message) {
+    printf("PANIC %s\n", message);
+    exit(1);
+}
+
+void harness_check(int ok, const char* expr, const char* file, int line) {
+    checks++;
+    if (!ok) {
+        failures++;
+        printf("FAIL %s:%d: %s\n", file, line, expr);
+    }
+}
+
+void harness_bench(const char* name, void (*fn)(void), u32 bytes) {
+    // Warm up the caches and find an iteration count that runs long enough
+    u64 iterations = 1;
+    u64 elapsed;
+    while (1) {
+        u64 start = now_ns();
+        for (u64 i = 0; i < iterations; i++) {
+            fn();
+        }
+        elapsed = now_ns() - start;
+
+        if (elapsed >= MIN_RUN_NS) {
+            break;
+        }
+        iterations *= 2;
+    }
+
+    double ns_per_op = (double)elapsed / iterations;
+    double bytes_per_s = bytes ? bytes * 1e9 / ns_per_op : 0;
+
+    printf("  %-28s %10.1f ns/op", name, ns_per_op);
+    if (bytes) {
+        printf(" %10.1f MB/s", bytes_per_s / 1e6);
+    }
+    printf("\n");
+
+    if (results) {
+        fprintf(results, "{\"commit\": \"%s\", \"name\": \"%s\", \"ns_per_op\": %.2f, "
+            "\"bytes_per_s\": %.0f, \"iterations\": %llu}\n", HOST_COMMIT, name,
+            ns_per_op, bytes_per_s, (unsigned long long)iterations);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        results = fopen(argv[1], "w");
+        if (results == NULL) {
+            perror(argv[1]);
+            return 1;
+        }
+    }
+
+    printf("Running unit tests\n");
+    run_tests();
+    printf("  %u checks, %u failures\n", checks, failures);
+
+    if (results) {
+        fprintf(results, "{\"commit\": \"%s\", \"name\": \"unit_tests\", \"checks\": %u, "
+            "\"failures\": %u}\n", HOST_COMMIT, checks, failures);
+    }
+
+    // Benchmarks of broken code are meaningless
+    if (failures) {
+        return 1;
+    }
+
+    printf("Running benchmarks\n");
+    run_benchmarks();
+
+    if (results) {
+        fclose(results);
+    }
+    return 0;
+}
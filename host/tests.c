@@ -0,0 +1,689 @@
+// Unit tests for the portable kernel code
+
+#include "harness.h"
+#include <chaos/mem.h>
+#include <chaos/list.h>
+#include <chaos/net_addr.h>
+#include <chaos/lz4.h>
+#include <chaos/crc32.h>
+#include <chaos/boot_image.h>
+#include <chaos/delta.h>
+#include <chaos/handoff.h>
+#include <chaos/fdt.h>
+#include <chaos/pool.h>
+#include <chaos/netbuf.h>
+#include "fdt_build.h"
+#include <chaos/status.h>
+#include <chaos/print_format.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdio.h>
+
+static void test_mem(void) {
+    u8 a[64];
+    u8 b[64];
+
+    // Every size and misalignment must give the same result as a byte loop
+    for (u32 offset = 0; offset < 4; offset++) {
+        for (u32 size = 0; size < 40; size++) {
+            memset(a, 0xAA, sizeof(a));
+            mem_set(a + offset, 0x5C, size);
+
+            u32 ok = 1;
+            for (u32 i = 0; i < sizeof(a); i++) {
+                u8 expected = (i >= offset && i < offset + size) ? 0x5C : 0xAA;
+                ok &= (a[i] == expected);
+            }
+            check(ok);
+
+            for (u32 i = 0; i < sizeof(a); i++) {
+                a[i] = i;
+            }
+            memset(b, 0, sizeof(b));
+            mem_copy(a + offset, b + offset, size);
+            check(memcmp(a + offset, b + offset, size) == 0);
+            check(b[offset + size] == 0);
+        }
+    }
+
+    check(mem_cmp("abcd", "abcd", 4) == 1);
+    check(mem_cmp("abcd", "abce", 4) == 0);
+    check(mem_cmp("abcd", "xbcd", 0) == 1);
+}
+
+static void test_endian(void) {
+    const u8 data[8] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08 };
+
+    check(read_le16(data) == 0x0201);
+    check(read_le32(data) == 0x04030201);
+    check(read_le64(data) == 0x0807060504030201ULL);
+    check(read_be16(data) == 0x0102);
+    check(read_be32(data) == 0x01020304);
+    check(read_be64(data) == 0x0102030405060708ULL);
+
+    u8 out[4];
+    store_be32(0xCAFEBABE, out);
+    check(out[0] == 0xCA && out[1] == 0xFE && out[2] == 0xBA && out[3] == 0xBE);
+    store_be16(0x1234, out);
+    check(out[0] == 0x12 && out[1] == 0x34);
+}
+
+// Formats into a buffer and compares with the expected string
+static int format_is(const char* expected, const char* format, ...) {
+    char buf[64];
+    va_list arg;
+    va_start(arg, format);
+    u32 len = print_format_to_buf_arg(buf, sizeof(buf), format, arg);
+    va_end(arg);
+
+    return len == strlen(expected) && memcmp(buf, expected, len) == 0;
+}
+
+static void test_print_format(void) {
+    check(format_is("plain", "plain"));
+    check(format_is("42", "{u}", 42));
+    check(format_is("-42", "{i}", -42));
+    check(format_is("+7", "{+:i}", 7));
+    check(format_is("ff", "{h}", 255));
+    check(format_is("0xFF", "{!:H}", 255));
+    check(format_is("0x2000BEEF", "{p}", 0x2000BEEF));
+    check(format_is("101", "{b}", 5));
+    check(format_is("  7", "{3:u}", 7));
+    check(format_is("007", "{0:3:u}", 7));
+    check(format_is("7  ", "{<:3:u}", 7));
+    check(format_is("x", "{c}", 'x'));
+    check(format_is("str", "{s}", "str"));
+    check(format_is("  ab", "{4:s}", "ab"));
+    check(format_is("ab  ", "{<:4:s}", "ab"));
+    check(format_is("{", "{{"));
+    check(format_is("[  1.002] ", "[{3:u}.{0:3:u}] ", 1, 2));
+
+    // The output is truncated to the buffer size
+    char buf[4];
+    check(print_format_to_buf(buf, sizeof(buf), "{u}", 123456) == 4);
+    check(memcmp(buf, "1234", 4) == 0);
+}
+
+struct item {
+    u32 value;
+    struct list_node node;
+};
+
+static void test_list(void) {
+    struct list_node list;
+    struct item items[4];
+    list_init(&list);
+    check(list_is_empty(&list));
+
+    for (u32 i = 0; i < 4; i++) {
+        items[i].value = i;
+        list_push_back(&items[i].node, &list);
+    }
+    check(list_get_size(&list) == 4);
+
+    u32 expected = 0;
+    u32 ok = 1;
+    struct list_node* node;
+    list_iterate(node, &list) {
+        ok &= (list_get_struct(node, struct item, node)->value == expected++);
+    }
+    check(ok);
+
+    node = list_pop_front(&list);
+    check(list_get_struct(node, struct item, node)->value == 0);
+    node = list_pop_back(&list);
+    check(list_get_struct(node, struct item, node)->value == 3);
+    check(list_get_size(&list) == 2);
+
+    list_push_front(&items[0].node, &list);
+    check(list_get_struct(list_get_first(&list), struct item, node)->value == 0);
+
+    // Merge a second list into the first
+    struct list_node other;
+    list_init(&other);
+    list_push_back(&items[3].node, &other);
+    list_merge(&other, &list);
+    check(list_get_size(&list) == 4);
+    check(list_get_struct(list_get_first(&list), struct item, node)->value == 3);
+
+    while (list_pop_front(&list));
+    check(list_is_empty(&list));
+}
+
+static void test_net_addr(void) {
+    u32 ip;
+    check(string_to_ip("192.168.10.200", &ip) == 0 && ip == 0xC0A80AC8);
+    check(string_to_ip("10.0.2.15", &ip) == 0 && ip == 0x0A00020F);
+    check(string_to_ip("0.0.0.0", &ip) == 0 && ip == 0);
+    check(string_to_ip("255.255.255.255", &ip) == 0 && ip == 0xFFFFFFFF);
+    check(string_to_ip("256.1.1.1", &ip) != 0);
+    check(string_to_ip("01.1.1.1", &ip) != 0);
+    check(string_to_ip("1..1.1", &ip) != 0);
+    check(string_to_ip("1.1.1", &ip) != 0);
+    check(string_to_ip("1.1.1.1.", &ip) != 0);
+
+    char str[18];
+    ip_to_string(str, 0xC0A80AC8);
+    check(strcmp(str, "192.168.10.200") == 0);
+    ip_to_string(str, 0x0A00020F);
+    check(strcmp(str, "10.0.2.15") == 0);
+
+    u8 mac[6];
+    check(string_to_mac("ca:ca:ca:ca:ca:dd", mac) == 0);
+    check(mac[0] == 0xCA && mac[5] == 0xDD);
+    check(string_to_mac("CA:CA:CA:CA:CA:DD", mac) == 0 && mac[5] == 0xDD);
+    check(string_to_mac("ca:ca:ca:ca:ca", mac) != 0);
+    check(string_to_mac("cac:ca:ca:ca:ca:dd", mac) != 0);
+
+    mac_to_string(str, mac, 1);
+    check(strcmp(str, "ca:ca:ca:ca:ca:dd") == 0);
+    mac_to_string(str, mac, 0);
+    check(strcmp(str, "CA:CA:CA:CA:CA:DD") == 0);
+}
+
+// Decompresses a block and compares with the expected output
+static int lz4_is(const char* expected, const u8* block, u32 size) {
+    u8 out[64];
+    i32 len = lz4_decompress(block, size, out, sizeof(out));
+    return len == (i32)strlen(expected) && memcmp(out, expected, len) == 0;
+}
+
+static void test_lz4(void) {
+    // Literals only
+    const u8 literals[] = { 0x50, 'h', 'e', 'l', 'l', 'o' };
+    check(lz4_is("hello", literals, sizeof(literals)));
+
+    // A run is a match overlapping its own output
+    const u8 run[] = { 0x14, 'a', 0x01, 0x00, 0x10, 'b' };
+    check(lz4_is("aaaaaaaaab", run, sizeof(run)));
+
+    // Match of an earlier string followed by the last literals
+    const u8 repeat[] = { 0x40, 'a', 'b', 'c', 'd', 0x04, 0x00, 0x20, 'x', 'y' };
+    check(lz4_is("abcdabcdxy", repeat, sizeof(repeat)));
+
+    // Extended literal and match lengths
+    u8 block[300];
+    u8 out[600];
+    block[0] = 0xFF;
+    block[1] = 255;
+    block[2] = 5;
+    for (u32 i = 0; i < 275; i++) {
+        block[3 + i] = i;
+    }
+    block[278] = 0x01;
+    block[279] = 0x00;
+    block[280] = 255;
+    block[281] = 0;
+    check(lz4_decompress(block, 282, out, sizeof(out)) == 275 + 15 + 255 + 4);
+    u32 ok = 1;
+    for (u32 i = 0; i < 275; i++) {
+        ok &= (out[i] == (u8)i);
+    }
+    for (u32 i = 275; i < 275 + 274; i++) {
+        ok &= (out[i] == (u8)274);
+    }
+    check(ok);
+
+    // Corrupt blocks never read or write out of bounds
+    const u8 zero_offset[] = { 0x14, 'a', 0x00, 0x00 };
+    check(lz4_decompress(zero_offset, sizeof(zero_offset), out, 64) == -ERR_CORRUPT);
+    const u8 far_offset[] = { 0x14, 'a', 0x02, 0x00 };
+    check(lz4_decompress(far_offset, sizeof(far_offset), out, 64) == -ERR_CORRUPT);
+    const u8 short_literals[] = { 0x50, 'h', 'e' };
+    check(lz4_decompress(short_literals, sizeof(short_literals), out, 64) == -ERR_CORRUPT);
+    const u8 short_offset[] = { 0x14, 'a', 0x01 };
+    check(lz4_decompress(short_offset, sizeof(short_offset), out, 64) == -ERR_CORRUPT);
+    const u8 short_length[] = { 0xF0, 255 };
+    check(lz4_decompress(short_length, sizeof(short_length), out, 64) == -ERR_CORRUPT);
+    check(lz4_decompress(run, sizeof(run), out, 9) == -ERR_CORRUPT);
+    check(lz4_decompress(literals, sizeof(literals), out, 4) == -ERR_CORRUPT);
+    check(lz4_decompress(literals, 0, out, 64) == 0);
+}
+
+static void test_crc32(void) {
+    check(crc32("123456789", 9) == 0xCBF43926);
+    check(crc32("", 0) == 0);
+
+    // Updating in pieces gives the same result
+    u32 crc = crc32_update(CRC32_INIT, "1234", 4);
+    crc = crc32_update(crc, "56789", 5);
+    check(~crc == 0xCBF43926);
+}
+
+// Builds a boot image with a data segment, a zero fill tail and a pure zero fill segment
+static u32 build_boot_image(u8* file) {
+    struct boot_image_header header = {
+        .magic = BOOT_IMAGE_MAGIC,
+        .version = BOOT_IMAGE_VERSION,
+        .segment_count = 3,
+        .load_addr = 0x20000000,
+        .entry = 0x20000004,
+        .crc = 0
+    };
+    struct boot_segment segments[3] = {
+        { 0x20000000, 10, 16, BOOT_SEGMENT_EXEC | BOOT_SEGMENT_READ },
+        { 0x20000020, 0, 8, BOOT_SEGMENT_WRITE | BOOT_SEGMENT_READ },
+        { 0x20000010, 6, 6, BOOT_SEGMENT_READ },
+    };
+
+    u32 size = 0;
+    memcpy(file, &header, sizeof(header));
+    size += sizeof(header);
+    memcpy(file + size, segments, sizeof(segments));
+    size += sizeof(segments);
+    memcpy(file + size, "0123456789abcdef", 16);
+    size += 16;
+
+    u32 crc = crc32(file, size);
+    memcpy(file + offsetof(struct boot_image_header, crc), &crc, 4);
+    return size;
+}
+
+// Feeds the file to the receiver in pieces of `step` bytes
+static i32 receive_boot_image(u8* stage, const u8* file, u32 size, u32 step, u32* entry) {
+    struct boot_image image;
+    memset(stage, 0xAA, 64);
+    boot_image_init(&image, stage, 48);
+
+    for (u32 i = 0; i < size; i += step) {
+        boot_image_write(&image, file + i, (size - i < step) ? size - i : step);
+    }
+    return boot_image_finish(&image, entry);
+}
+
+static void test_boot_image(void) {
+    u8 file[128];
+    u8 stage[64];
+    u32 entry;
+    u32 size = build_boot_image(file);
+
+    for (u32 step = 1; step < size; step += 7) {
+        check(receive_boot_image(stage, file, size, step, &entry) == 0);
+        check(entry == 4);
+        check(memcmp(stage, "0123456789\0\0\0\0\0\0abcdef", 22) == 0);
+        check(memcmp(stage + 32, "\0\0\0\0\0\0\0\0", 8) == 0);
+        check(stage[40] == 0xAA);
+    }
+
+    // Any damaged byte is caught by the CRC or the header checks
+    for (u32 i = 0; i < size; i++) {
+        file[i] ^= 0x10;
+        check(receive_boot_image(stage, file, size, 13, &entry) == -ERR_CORRUPT);
+        file[i] ^= 0x10;
+    }
+
+    // Missing and extra data
+    check(receive_boot_image(stage, file, size - 1, 5, &entry) == -ERR_CORRUPT);
+    file[size] = 0;
+    check(receive_boot_image(stage, file, size + 1, 5, &entry) == -ERR_CORRUPT);
+
+    // A segment outside the staging area
+    struct boot_segment* segment = (struct boot_segment *)(file + sizeof(struct boot_image_header));
+    segment->mem_size = 64;
+    check(receive_boot_image(stage, file, size, 5, &entry) == -ERR_CORRUPT);
+    segment->mem_size = 16;
+
+    // A file without the header is copied as it is
+    check(receive_boot_image(stage, (const u8 *)"raw kernel", 10, 3, &entry) == 0);
+    check(entry == 0 && memcmp(stage, "raw kernel", 10) == 0);
+    check(receive_boot_image(stage, file + 4, 47, 7, &entry) == 0);
+    check(memcmp(stage, file + 4, 47) == 0);
+}
+
+static u8 delta_base[2 * DELTA_BLOCK_SIZE];
+static u8 delta_image[2 * DELTA_BLOCK_SIZE + 100];
+static u8 delta_file[sizeof(struct delta_header) + 2 * (4 + DELTA_BLOCK_SIZE)];
+static u8 delta_stage[3 * DELTA_BLOCK_SIZE];
+
+// Builds a delta from the base to a new image where the second block and the tail differ
+static u32 build_delta(void) {
+    for (u32 i = 0; i < sizeof(delta_base); i++) {
+        delta_base[i] = i * 13;
+    }
+    memcpy(delta_image, delta_base, sizeof(delta_base));
+    delta_image[DELTA_BLOCK_SIZE + 5] ^= 0xFF;
+    memset(delta_image + sizeof(delta_base), 0x77, 100);
+
+    struct delta_header header = {
+        .magic = DELTA_MAGIC,
+        .version = DELTA_VERSION,
+        .block_size = DELTA_BLOCK_SIZE,
+        .base_size = sizeof(delta_base),
+        .image_size = sizeof(delta_image),
+        .block_count = 2,
+        .crc = crc32(delta_image, sizeof(delta_image))
+    };
+
+    u8* ptr = delta_file;
+    memcpy(ptr, &header, sizeof(header));
+    ptr += sizeof(header);
+
+    u32 offset = DELTA_BLOCK_SIZE;
+    memcpy(ptr, &offset, 4);
+    memcpy(ptr + 4, delta_image + offset, DELTA_BLOCK_SIZE);
+    ptr += 4 + DELTA_BLOCK_SIZE;
+
+    offset = 2 * DELTA_BLOCK_SIZE;
+    memcpy(ptr, &offset, 4);
+    memcpy(ptr + 4, delta_image + offset, 100);
+    ptr += 4 + 100;
+
+    return ptr - delta_file;
+}
+
+static i32 receive_delta(u32 size, u32 step, u32 base_size) {
+    struct delta delta;
+    memset(delta_stage, 0, sizeof(delta_stage));
+    delta_init(&delta, delta_stage, sizeof(delta_stage), delta_base, base_size);
+
+    for (u32 i = 0; i < size; i += step) {
+        delta_write(&delta, delta_file + i, (size - i < step) ? size - i : step);
+    }
+    return delta_finish(&delta);
+}
+
+static void test_delta(void) {
+    u32 size = build_delta();
+
+    for (u32 step = 1; step < 300; step += 37) {
+        check(receive_delta(size, step, sizeof(delta_base)) == sizeof(delta_image));
+        check(memcmp(delta_stage, delta_image, sizeof(delta_image)) == 0);
+    }
+
+    // The advertised base must match, and the result must match the CRC
+    check(receive_delta(size, 64, DELTA_BLOCK_SIZE) == -ERR_CORRUPT);
+    delta_file[sizeof(struct delta_header) + 10] ^= 1;
+    check(receive_delta(size, 64, sizeof(delta_base)) == -ERR_CORRUPT);
+    delta_file[sizeof(struct delta_header) + 10] ^= 1;
+
+    // A block offset that is not block aligned
+    delta_file[sizeof(struct delta_header)] = 1;
+    check(receive_delta(size, 64, sizeof(delta_base)) == -ERR_CORRUPT);
+    delta_file[sizeof(struct delta_header)] = 0;
+
+    // Missing data
+    check(receive_delta(size - 1, 64, sizeof(delta_base)) == -ERR_CORRUPT);
+}
+
+static void test_handoff(void) {
+    struct handoff handoff;
+    memset(&handoff, 0, sizeof(handoff));
+    handoff.flags = HANDOFF_LINK | HANDOFF_SERVER;
+    handoff.phy_addr = 1;
+    handoff.server_ip = 0xC0A80A01;
+
+    // Anything in r0 from a bootloader must be rejected
+    check(handoff_check(&handoff) == -ERR_CORRUPT);
+
+    handoff_seal(&handoff);
+    check(handoff.magic == HANDOFF_MAGIC);
+    check(handoff.size == sizeof(struct handoff));
+    check(handoff_check(&handoff) == 0);
+
+    // The CRC is the same as for the block with a zero CRC field
+    u32 crc = handoff.crc;
+    handoff.crc = 0;
+    check(crc32(&handoff, sizeof(handoff)) == crc);
+    handoff.crc = crc;
+
+    // Any changed bit is rejected
+    for (u32 i = 0; i < sizeof(handoff) * 8; i += 7) {
+        ((u8 *)&handoff)[i / 8] ^= 1 << (i % 8);
+        check(handoff_check(&handoff) == -ERR_CORRUPT);
+        ((u8 *)&handoff)[i / 8] ^= 1 << (i % 8);
+    }
+    check(handoff_check(&handoff) == 0);
+}
+
+static u8 fdt_blob[32768];
+static struct fdt_index fdt_index;
+
+// A small board tree with aliases, phandles, unit addresses and NOPs
+static u32 build_board_fdt(void) {
+    u8 mac[6] = { 0xCA, 0xCA, 0xCA, 0xCA, 0xCA, 0xDD };
+    u8 reg[8] = { 0x20, 0, 0, 0, 0x10, 0, 0, 0 };
+
+    fdt_build_start();
+    fdt_build_begin("");
+    fdt_build_prop_string("model", "test board");
+    fdt_build_begin("aliases");
+    fdt_build_prop_string("ethernet0", "/soc/ethernet@f8008000");
+    fdt_build_prop_string("serial0", "/soc/serial@f8020000");
+    fdt_build_end();
+    fdt_build_begin("memory@20000000");
+    fdt_build_prop("reg", reg, sizeof(reg));
+    fdt_build_end();
+    fdt_build_nop();
+    fdt_build_begin("soc");
+    fdt_build_begin("ethernet@f8008000");
+    fdt_build_prop("local-mac-address", mac, sizeof(mac));
+    fdt_build_nop();
+    fdt_build_prop_u32("phandle", 5);
+    fdt_build_end();
+    fdt_build_begin("serial@f8020000");
+    fdt_build_prop_string("status", "okay");
+    fdt_build_prop_u32("phandle", 7);
+    fdt_build_begin("child");
+    fdt_build_end();
+    fdt_build_end();
+    fdt_build_begin("intc");
+    fdt_build_prop_u32("linux,phandle", 9);
+    fdt_build_end();
+    fdt_build_end();
+    fdt_build_end();
+    return fdt_build_finish(fdt_blob);
+}
+
+static void check_board_fdt(struct fdt* fdt) {
+    i32 root = fdt_path(fdt, "/");
+    check(root >= 0);
+
+    u32 len;
+    const char* model = fdt_prop(fdt, root, "model", &len);
+    check(model && len == 11 && strcmp(model, "test board") == 0);
+    check(fdt_prop(fdt, root, "mode", &len) == NULL);
+
+    i32 eth = fdt_path(fdt, "/soc/ethernet@f8008000");
+    check(eth >= 0 && strcmp(fdt_name(fdt, eth), "ethernet@f8008000") == 0);
+    const u8* mac = fdt_prop(fdt, eth, "local-mac-address", &len);
+    check(mac && len == 6 && mac[5] == 0xDD);
+    check(fdt_path(fdt, "ethernet0") == eth);
+    check(fdt_path(fdt, "/soc/ethernet") == eth);
+    check(fdt_phandle(fdt, 5) == eth);
+
+    i32 serial = fdt_path(fdt, "serial0");
+    check(serial >= 0 && fdt_phandle(fdt, 7) == serial);
+    check(fdt_path(fdt, "serial0/child") == fdt_path(fdt, "/soc/serial@f8020000/child"));
+    check(fdt_path(fdt, "/soc/serial@f8020000/child") >= 0);
+    check(fdt_phandle(fdt, 9) == fdt_path(fdt, "/soc/intc"));
+
+    u32 val;
+    i32 memory = fdt_path(fdt, "/memory");
+    check(memory >= 0 && memory == fdt_path(fdt, "/memory@20000000"));
+    check(fdt_prop_u32(fdt, memory, "reg", &val) == -ERR_NOT_FOUND);
+    check(fdt_prop_u32(fdt, eth, "phandle", &val) == 0 && val == 5);
+
+    check(fdt_path(fdt, "/soc/ethernet@f8008001") == -ERR_NOT_FOUND);
+    check(fdt_path(fdt, "/socket") == -ERR_NOT_FOUND);
+    check(fdt_path(fdt, "/soc/intc/none") == -ERR_NOT_FOUND);
+    check(fdt_path(fdt, "ethernet1") == -ERR_NOT_FOUND);
+    check(fdt_phandle(fdt, 6) == -ERR_NOT_FOUND);
+    check(fdt_phandle(fdt, 0) == -ERR_NOT_FOUND);
+
+    // The children of /soc in order
+    u32 count = 0;
+    for (i32 node = fdt_first_child(fdt, fdt_path(fdt, "/soc")); node >= 0;
+        node = fdt_next_sibling(fdt, node)) {
+        count++;
+    }
+    check(count == 3);
+    check(fdt_first_child(fdt, fdt_path(fdt, "/soc/intc")) == -ERR_NOT_FOUND);
+}
+
+static void test_fdt(void) {
+    struct fdt fdt;
+    u32 size = build_board_fdt();
+
+    // The same answers with and without the index
+    check(fdt_init(&fdt, fdt_blob, size, NULL) == 0);
+    check_board_fdt(&fdt);
+    check(fdt_init(&fdt, fdt_blob, size, &fdt_index) == 0);
+    check_board_fdt(&fdt);
+    check(fdt_index.count == 8);
+
+    // Header checks
+    check(fdt_init(&fdt, fdt_blob, size - 1, NULL) == -ERR_CORRUPT);
+    fdt_blob[0] ^= 1;
+    check(fdt_init(&fdt, fdt_blob, size, NULL) == -ERR_NOT_FOUND);
+    fdt_blob[0] ^= 1;
+    fdt_blob[27] = 18;
+    check(fdt_init(&fdt, fdt_blob, size, NULL) == -ERR_CORRUPT);
+    fdt_blob[27] = 16;
+
+    // A property length running past the structure block
+    check(fdt_init(&fdt, fdt_blob, size, NULL) == 0);
+    i32 memory = fdt_path(&fdt, "/memory");
+    store_be32(0x10000, (u8 *)fdt.structs + memory + 24);
+    check(fdt_prop(&fdt, memory, "reg", NULL) == NULL);
+    check(fdt_path(&fdt, "/soc") < 0);
+
+    // A tree larger than the index is searched without it
+    fdt_build_start();
+    fdt_build_begin("");
+    for (u32 i = 0; i < FDT_INDEX_NODES + 44; i++) {
+        char name[16];
+        sprintf(name, "node@%x", i);
+        fdt_build_begin(name);
+        fdt_build_prop_u32("phandle", i + 1);
+        fdt_build_end();
+    }
+    fdt_build_end();
+    size = fdt_build_finish(fdt_blob);
+    check(fdt_init(&fdt, fdt_blob, size, &fdt_index) == 0);
+    i32 node = fdt_path(&fdt, "/node@12b");
+    check(node >= 0 && strcmp(fdt_name(&fdt, node), "node@12b") == 0);
+    check(fdt_phandle(&fdt, 0x12c) == node);
+}
+
+// More objects than fit in the magazines of one core, so the depot is used both ways
+#define TEST_POOL_OBJS 100
+
+static void test_pool(void) {
+    static struct pool pool;
+    static struct pool_cpu cpu;
+    static struct pool_magazine mags[POOL_MAGAZINES(TEST_POOL_OBJS)];
+    static u32 objs[TEST_POOL_OBJS];
+    static u8 taken[TEST_POOL_OBJS];
+    void* got[TEST_POOL_OBJS];
+
+    pool_init(&pool, &cpu, mags, POOL_MAGAZINES(TEST_POOL_OBJS));
+    for (u32 i = 0; i < TEST_POOL_OBJS; i++) {
+        pool_add(&pool, &objs[i]);
+    }
+
+    // Every object comes out exactly once, then the pool is empty
+    u32 ok = 1;
+    for (u32 i = 0; i < TEST_POOL_OBJS; i++) {
+        got[i] = pool_alloc(&pool);
+        u32 index = (u32 *)got[i] - objs;
+        ok &= got[i] != NULL && index < TEST_POOL_OBJS && !taken[index];
+        if (ok) {
+            taken[index] = 1;
+        }
+    }
+    check(ok);
+    check(pool_alloc(&pool) == NULL);
+    check(pool_alloc(&pool) == NULL);
+
+    struct pool_stats stats;
+    pool_get_stats(&pool, &stats);
+    check(stats.total == TEST_POOL_OBJS);
+    check(stats.in_use == TEST_POOL_OBJS);
+    check(stats.high_watermark == TEST_POOL_OBJS);
+    check(stats.fails == 2);
+
+    for (u32 i = 0; i < TEST_POOL_OBJS; i++) {
+        pool_free(&pool, got[i]);
+    }
+    pool_get_stats(&pool, &stats);
+    check(stats.in_use == 0);
+    check(stats.high_watermark == TEST_POOL_OBJS);
+    check(stats.allocs == TEST_POOL_OBJS && stats.frees == TEST_POOL_OBJS);
+
+    // Cycling through the depot many times must neither lose nor duplicate an object
+    for (u32 round = 0; round < 20; round++) {
+        u32 count = 0;
+        while (count < TEST_POOL_OBJS && (got[count] = pool_alloc(&pool))) {
+            count++;
+        }
+        ok &= count == TEST_POOL_OBJS && pool_alloc(&pool) == NULL;
+        for (u32 i = 0; i < count; i++) {
+            pool_free(&pool, got[count - 1 - i]);
+        }
+    }
+    check(ok);
+    pool_get_stats(&pool, &stats);
+    check(stats.in_use == 0 && stats.fails == 22);
+}
+
+static void test_netbuf(void) {
+    static struct netbuf bufs[2];
+    static u8 storage[2][NETBUF_SIZE];
+    struct netbuf* buf = &bufs[0];
+    buf->buf = storage[0];
+    buf->size = NETBUF_SIZE;
+    buf->ptr = buf->buf + NETBUF_HEADROOM;
+    buf->len = 0;
+    buf->next = NULL;
+    buf->refs = 1;
+    check(netbuf_headroom(buf) == NETBUF_HEADROOM);
+    check(netbuf_tailroom(buf) == NETBUF_SIZE - NETBUF_HEADROOM);
+
+    // Payload first, then the headers in front of it
+    u8* data = netbuf_put(buf, 100);
+    check(data == buf->buf + NETBUF_HEADROOM && buf->len == 100);
+    u8* header = netbuf_push(buf, 8);
+    check(header == data - 8 && buf->ptr == header && buf->len == 108);
+    check(netbuf_tailroom(buf) == NETBUF_SIZE - NETBUF_HEADROOM - 100);
+
+    // The receive side takes the headers off again. A pull past the end fails
+    check(netbuf_pull(buf, 8) == data && buf->len == 100);
+    check(netbuf_pull(buf, 101) == NULL && buf->ptr == data && buf->len == 100);
+    netbuf_trim(buf, 60);
+    check(buf->len == 60);
+    netbuf_trim(buf, 80);
+    check(buf->len == 60);
+
+    struct netbuf* tail = &bufs[1];
+    tail->buf = storage[1];
+    tail->size = NETBUF_SIZE;
+    tail->ptr = tail->buf;
+    tail->len = 1000;
+    tail->next = NULL;
+    tail->refs = 1;
+    netbuf_chain(buf, tail);
+    check(buf->next == tail);
+    check(netbuf_chain_len(buf) == 1060);
+
+    // An extra reference covers the whole chain and makes the data read-only
+    check(!netbuf_shared(buf));
+    netbuf_get(buf);
+    check(buf->refs == 2 && tail->refs == 2);
+    check(netbuf_shared(buf) && netbuf_shared(tail));
+}
+
+void run_tests(void) {
+    test_mem();
+    test_endian();
+    test_print_format();
+    test_list();
+    test_net_addr();
+    test_lz4();
+    test_crc32();
+    test_boot_image();
+    test_delta();
+    test_handoff();
+    test_fdt();
+    test_pool();
+    test_netbuf();
+}
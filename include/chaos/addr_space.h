@@ -0,0 +1,34 @@
+// Server address spaces
+
+#ifndef ADDR_SPACE_H
+#define ADDR_SPACE_H
+
+#include <chaos/types.h>
+
+// Each server has its own first-level table for the lower 2 GiB, which is installed in
+// TTBR0. The mappings are non-global and tagged with an ASID, so a switch between servers
+// does not flush the TLB. The kernel mapping in TTBR1 is global and shared by all
+#define ADDR_SPACE_ENTRIES 2048
+#define ADDR_SPACE_ALIGN   8192
+
+struct addr_space {
+    // First-level table with ADDR_SPACE_ENTRIES entries aligned to ADDR_SPACE_ALIGN
+    u32* table;
+
+    // The ASID generation in the upper bits and the hardware ASID in the lower 8 bits.
+    // Zero means no ASID has been assigned yet
+    u32 asid;
+};
+
+void addr_space_init(struct addr_space* space, u32* table);
+void addr_space_release(struct addr_space* space);
+
+// Maps `size` bytes from `virt` to `phys` with 1 MiB sections. All must be aligned to
+// 1 MiB and the virtual range must be in the lower 2 GiB
+void addr_space_map(struct addr_space* space, u32 virt, u32 phys, u32 size, u32 attr);
+void addr_space_unmap(struct addr_space* space, u32 virt, u32 size);
+
+// Switches to the address space. Passing NULL goes back to the boot identity mapping
+void addr_space_switch(struct addr_space* space);
+
+#endif
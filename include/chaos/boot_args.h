@@ -0,0 +1,16 @@
+// Registers given to the kernel entry
+
+#ifndef BOOT_ARGS_H
+#define BOOT_ARGS_H
+
+#include <chaos/types.h>
+
+// A bootloader passes 0, the machine type and the physical address of the device tree in
+// r0-r2. A kernel started by a soft reboot gets the handoff block in r0 instead
+#define BOOT_ARG_HANDOFF 0
+#define BOOT_ARG_DTB     2
+
+// Written by the entry code before the relocation
+extern u32 boot_args[3];
+
+#endif
@@ -0,0 +1,53 @@
+// Segmented boot image received by the soft reboot. See doc/boot-image.md
+
+#ifndef BOOT_IMAGE_H
+#define BOOT_IMAGE_H
+
+#include <chaos/types.h>
+
+#define BOOT_IMAGE_MAGIC        0x4D494243    // "CBIM"
+#define BOOT_IMAGE_VERSION      1
+#define BOOT_IMAGE_MAX_SEGMENTS 32
+
+// Segment flags. These are the flags of the ELF program header
+#define BOOT_SEGMENT_EXEC  (1 << 0)
+#define BOOT_SEGMENT_WRITE (1 << 1)
+#define BOOT_SEGMENT_READ  (1 << 2)
+
+// The header is followed by the segment table and the data of each segment in table
+// order. All fields are little endian
+struct boot_image_header {
+    u32 magic;
+    u32 version;
+    u32 segment_count;
+    u32 load_addr;       // Lowest physical address of any segment
+    u32 entry;           // Physical entry point
+    u32 crc;             // CRC-32 of the whole file with this field set to zero
+};
+
+struct boot_segment {
+    u32 addr;            // Physical load address
+    u32 file_size;       // Bytes in the file
+    u32 mem_size;        // Bytes in memory. The bytes after file_size are zero filled
+    u32 flags;
+};
+
+// Receiver state. The image is placed in a staging area with the same layout it will
+// have at load_addr. A file without the boot image header is copied to the staging
+// area as it is
+struct boot_image {
+    u8* stage;
+    u32 stage_size;
+    u32 state;
+    u32 offset;          // Bytes done of the header, the table, the segment or raw file
+    u32 segment;
+    u32 crc;
+    struct boot_image_header header;
+    struct boot_segment segments[BOOT_IMAGE_MAX_SEGMENTS];
+};
+
+void boot_image_init(struct boot_image* image, void* stage, u32 stage_size);
+i32 boot_image_write(struct boot_image* image, const u8* data, u32 size);
+i32 boot_image_finish(struct boot_image* image, u32* entry_offset);
+
+#endif
@@ -7,6 +7,8 @@
 #include <stdarg.h>
 
 void boot_start_timer();
+void boot_resume_timer(u32 time);
+u32 boot_get_time();
 
 void boot_message(const char* message, ...);
 
@@ -5,6 +5,9 @@
 
 #include <chaos/types.h>
 
+// Reads the cache geometry. Called once at boot with the MMU on
+extern void cache_init();
+
 extern void icache_enable();
 extern void icache_disable();
 extern void icache_invalidate();
@@ -14,8 +17,20 @@ extern void dcache_disable();
 extern void dcache_clean();
 extern void dcache_clean_virt_range(u32 start, u32 end);
 extern void dcache_invalidate();
+extern void dcache_invalidate_local();
 extern void dcache_invalidate_virt_range(u32 start, u32 end);
 extern void dcache_clean_invalidate();
 extern void dcache_clean_invalidate_virt_range(u32 start, u32 end);
 
+// Outer cache hooks. These are no-ops unless the board has an outer cache driver, and
+// are called by the data cache routines above. The ranges are virtual addresses in the
+// DDR window
+void outer_cache_init();
+void outer_clean_range(u32 start, u32 end);
+void outer_invalidate_range(u32 start, u32 end);
+void outer_clean_invalidate_range(u32 start, u32 end);
+void outer_clean_all();
+void outer_flush_all();
+void outer_disable();
+
 #endif
\ No newline at end of file
@@ -0,0 +1,13 @@
+// CRC-32 as used by ethernet and zlib
+
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <chaos/types.h>
+
+#define CRC32_INIT 0xFFFFFFFF
+
+u32 crc32_update(u32 crc, const void* data, u32 size);
+u32 crc32(const void* data, u32 size);
+
+#endif
@@ -0,0 +1,61 @@
+// Delta soft reboot. The running kernel advertises block hashes of its own image and
+// receives only the blocks that changed in the new one
+
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <chaos/types.h>
+
+#define DELTA_MAGIC      0x544C4443    // "CDLT"
+#define DELTA_VERSION    1
+#define DELTA_BLOCK_SIZE 1024
+
+// Hashes per advertisement packet
+#define DELTA_HASHES_PER_PACKET 256
+
+// Advertisement sent over UDP to the delta server. This covers `count` blocks starting
+// at `first_block`. The hash of a block is its CRC-32. All fields are little endian
+struct delta_hashes {
+    u32 magic;
+    u32 version;
+    u32 block_size;
+    u32 base_size;       // Bytes of the running image covered by all the packets
+    u32 first_block;
+    u32 count;
+    u32 hashes[];
+};
+
+// The delta file starts with this header. It is followed by `block_count` blocks, each
+// being its byte offset in the new image and then the data. The block is a full block
+// or the rest of the image. All fields are little endian
+struct delta_header {
+    u32 magic;
+    u32 version;
+    u32 block_size;
+    u32 base_size;       // Must match the advertised size
+    u32 image_size;
+    u32 block_count;
+    u32 crc;             // CRC-32 of the new image
+};
+
+// Receiver state. The new image is built in the staging area from the running image
+// and the changed blocks
+struct delta {
+    u8* stage;
+    u32 stage_size;
+    const u8* base;
+    u32 base_size;
+    u32 state;
+    u32 offset;          // Bytes done of the header, the block offset or the block
+    u32 block;
+    u32 block_offset;
+    u32 block_size;
+    struct delta_header header;
+};
+
+void delta_init(struct delta* delta, void* stage, u32 stage_size, const void* base,
+    u32 base_size);
+i32 delta_write(struct delta* delta, const u8* data, u32 size);
+i32 delta_finish(struct delta* delta);
+
+#endif
@@ -0,0 +1,56 @@
+// Flattened device tree parser. The tree is read in place and nothing is copied
+
+#ifndef FDT_H
+#define FDT_H
+
+#include <chaos/types.h>
+
+#define FDT_MAGIC 0xD00DFEED
+
+// Size of the optional node index. A tree with more nodes is searched without the index
+#define FDT_INDEX_NODES 256
+#define FDT_INDEX_SLOTS 512
+
+// One node in the index. The offset is into the structure block
+struct fdt_index_node {
+    u32 offset;
+    u32 parent;
+    u32 hash;        // Hash of the full path
+    u32 phandle;
+};
+
+// Hash tables from path and phandle to the index node. A slot holds the node number plus
+// one, or zero when empty
+struct fdt_index {
+    struct fdt_index_node nodes[FDT_INDEX_NODES];
+    u16 by_path[FDT_INDEX_SLOTS];
+    u16 by_phandle[FDT_INDEX_SLOTS];
+    u32 count;
+    u32 state;
+};
+
+struct fdt {
+    const u8* structs;
+    const char* strings;
+    u32 struct_size;
+    u32 strings_size;
+    struct fdt_index* index;
+};
+
+// Nodes are given as offsets into the structure block. A negative node is an error code
+i32 fdt_init(struct fdt* fdt, const void* blob, u32 blob_size, struct fdt_index* index);
+i32 fdt_path(struct fdt* fdt, const char* path);
+i32 fdt_phandle(struct fdt* fdt, u32 phandle);
+i32 fdt_first_child(const struct fdt* fdt, i32 node);
+i32 fdt_next_sibling(const struct fdt* fdt, i32 node);
+const char* fdt_name(const struct fdt* fdt, i32 node);
+
+const void* fdt_prop(const struct fdt* fdt, i32 node, const char* name, u32* len);
+i32 fdt_prop_u32(const struct fdt* fdt, i32 node, const char* name, u32* val);
+
+// The tree from the bootloader. This is NULL if there is none, or if it has been dropped
+// because a soft reboot might overwrite it
+struct fdt* boot_fdt();
+void boot_fdt_drop();
+
+#endif
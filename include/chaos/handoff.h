@@ -0,0 +1,52 @@
+// State handed from a running kernel to the kernel it starts with a soft reboot
+
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <chaos/types.h>
+
+#define HANDOFF_MAGIC   0x46444843    // "CHDF"
+#define HANDOFF_VERSION 1
+
+// The block is placed this far below the end of DDR, and its physical address is passed
+// to the new kernel in r0. The staging area for the new kernel stops below it
+#define HANDOFF_SIZE 0x1000
+
+// Flags telling which fields are valid
+#define HANDOFF_LINK   (1 << 0)    // PHY address and link setting
+#define HANDOFF_SERVER (1 << 1)    // Server MAC address
+#define HANDOFF_TIME   (1 << 2)    // Boot timer
+
+// The block is written by the old kernel right before the jump. The new kernel only uses
+// it if the magic, version, size and CRC match, and the memory map is the same as its own
+struct handoff {
+    u32 magic;
+    u32 version;
+    u32 size;
+    u32 crc;               // CRC-32 of the block with this field as zero
+    u32 flags;
+
+    // Link set up by the PHY autonegotiation
+    u32 phy_addr;
+    u32 link_speed;        // 10 or 100 Mbps
+    u32 link_full_duplex;
+
+    // Network configuration. The MAC addresses are padded to whole words
+    u8  client_mac[8];
+    u8  server_mac[8];
+    u32 client_ip;
+    u32 server_ip;
+
+    // Boot timer in ms at the jump. The new kernel continues counting from here
+    u32 time;
+
+    // Memory map of the old kernel
+    u32 ddr_start;
+    u32 ddr_size;
+    u32 sram_start;
+};
+
+void handoff_seal(struct handoff* handoff);
+i32 handoff_check(const struct handoff* handoff);
+
+#endif
@@ -0,0 +1,41 @@
+// Initcalls collected by the linker and run in dependency order at boot
+
+#ifndef INITCALL_H
+#define INITCALL_H
+
+#include <chaos/types.h>
+
+// Returned by a poll function while the initialization is still running
+#define INITCALL_PENDING 1
+
+// The start function begins the initialization and returns 0 or an error code. Slow
+// hardware can return early and be finished by the poll function, which returns
+// INITCALL_PENDING until it is done. Other initcalls run in the meantime. An initcall is
+// started once all of its dependencies are done, and skipped if any of them failed
+struct initcall {
+    const char* name;
+    i32 (*start)();
+    i32 (*poll)();
+    const struct initcall* const* deps;
+    u32 dep_count;
+};
+
+// Gives access to an initcall defined in another file, so it can be used as a dependency
+#define DECLARE_INITCALL(id) extern const struct initcall initcall_##id
+
+// Registers an initcall. The dependencies are given as &initcall_<id>
+#define INITCALL(id, start_fn, poll_fn, ...)                                           \
+    static const struct initcall* const initcall_deps_##id[] = { __VA_ARGS__ };        \
+    __attribute__((section(".initcall"), used, aligned(4)))                            \
+    const struct initcall initcall_##id = {                                            \
+        .name = #id,                                                                   \
+        .start = start_fn,                                                             \
+        .poll = poll_fn,                                                               \
+        .deps = initcall_deps_##id,                                                    \
+        .dep_count = sizeof(initcall_deps_##id) / sizeof(initcall_deps_##id[0]),       \
+    }
+
+void initcall_run_all();
+void initcall_report();
+
+#endif
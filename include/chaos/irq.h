@@ -0,0 +1,71 @@
+// Interrupt controller interface and IRQ dispatch (kernel driver)
+
+#ifndef IRQ_H
+#define IRQ_H
+
+#include <chaos/types.h>
+
+// Highest interrupt number supported by any of the controllers, plus one
+#define IRQ_COUNT 128
+
+// Returned by ack when no interrupt is pending
+#define IRQ_SPURIOUS 0xFFFFFFFF
+
+struct irq_iface {
+    void (*init)();
+    void (*enable)(u32 irq);
+    u32  (*ack)();
+    void (*eoi)(u32 irq);
+};
+
+// This should return NULL, or the interrupt controller of the board. The functions not
+// implemented should be set to NULL
+const struct irq_iface* get_irq();
+
+// Sets up the interrupt controller and the exception vectors, and unmasks IRQs on this
+// core. Returns -ERR_NOT_FOUND if the board has no interrupt controller
+i32 irq_init();
+
+// Calls `handler` in IRQ mode each time interrupt `irq` fires. The handler runs on the
+// small IRQ stack with IRQs masked, so it should only quiet the device and leave the
+// work to thread context. Returns -ERR_NOT_FOUND if the interrupt cannot be used
+i32 irq_register(u32 irq, void (*handler)());
+
+// Sets up the vector table. Implemented in arch/vectors.s
+void vectors_init();
+
+static inline void irq_local_disable() {
+    asm volatile ("cpsid i" : : : "memory");
+}
+
+static inline void irq_local_enable() {
+    asm volatile ("cpsie i" : : : "memory");
+}
+
+// Masks IRQs on this core and returns the previous state for irq_local_restore. This can
+// be nested, and is safe in IRQ mode. The host build has no interrupts, so there this
+// does nothing
+static inline u32 irq_local_save() {
+#ifdef __arm__
+    u32 cpsr;
+    asm volatile ("mrs %0, cpsr\n\tcpsid i" : "=r" (cpsr) : : "memory");
+    return cpsr;
+#else
+    return 0;
+#endif
+}
+
+static inline void irq_local_restore(u32 flags) {
+#ifdef __arm__
+    asm volatile ("msr cpsr_c, %0" : : "r" (flags) : "memory");
+#endif
+}
+
+// Sleeps until an interrupt is pending. This must be called with IRQs masked, after the
+// wake condition has been checked. A pending IRQ wakes the core even while masked, so an
+// interrupt that comes after the check is never missed
+static inline void irq_wait() {
+    asm volatile ("dsb\n\twfi" : : : "memory");
+}
+
+#endif
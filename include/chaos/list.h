@@ -15,7 +15,7 @@ struct list_node {
 
 // Returns a pointer to the struct entry in which the list is embedded
 #define list_get_struct(node, type, member) \
-    (type *)((u8 *)node - offsetof(type, member))
+    ((type *)((u8 *)(node) - offsetof(type, member)))
 
 // Initializes a list
 static inline void list_init(struct list_node* list) {
@@ -0,0 +1,23 @@
+// LZ4 block decompression
+
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <chaos/types.h>
+
+// Header placed between the decompressor stub and the LZ4 payload of a compressed kernel
+// image. All fields are little endian. This must match arch/lz4_stub.s and
+// scripts/lz4_pack.py
+#define LZ4_IMAGE_MAGIC 0x345A4C43    // "CLZ4"
+
+struct lz4_image_header {
+    u32 magic;
+    u32 dest;            // Physical address the kernel is decompressed to
+    u32 image_size;      // Size of the decompressed kernel
+    u32 payload_size;    // Size of the LZ4 block following this header
+    u32 ddr_size;        // Size of the DDR starting at `dest`
+};
+
+i32 lz4_decompress(const u8* src, u32 src_size, u8* dest, u32 dest_size);
+
+#endif
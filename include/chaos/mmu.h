@@ -0,0 +1,101 @@
+// Early MMU setup and the kernel virtual memory layout
+
+#ifndef MMU_H
+#define MMU_H
+
+#include <chaos/types.h>
+
+// The kernel is linked at 0x80000000 and DDR is mapped linearly from there. The lower
+// 2 GiB are translated by TTBR0, which holds the identity mapping of DDR used during boot
+// and when jumping to a new kernel
+#define KERNEL_VIRT_BASE 0x80000000
+
+// Peripherals placed low in the physical address space are mapped above the DDR window.
+// Peripherals at or above 0xC0000000 physical are identity mapped
+#define IO_LOW_BASE 0xC0000000
+#define IO_LOW(addr) (IO_LOW_BASE + (addr))
+
+#define MMU_SECTION_SIZE 0x100000
+
+// The 1 MiB section holding the on-chip SRAM is mapped twice. Code and data use the
+// cached window and DMA descriptors use the non-cacheable window. The two windows never
+// share any bytes. These must match the linker script
+#define SRAM_VIRT          0xD0000000
+#define SRAM_UNCACHED_VIRT 0xD0100000
+
+// Places a function or data in the cached SRAM window. The contents are copied in at boot.
+// The SRAM is far from the kernel, so this relies on the kernel being built with long calls
+#define __sram_func __attribute__((section(".ramfunc"), noinline))
+#define __sram_data __attribute__((section(".sram_data")))
+
+// Places DMA descriptors in the non-cacheable SRAM window. This memory is not zeroed
+#define __sram_dma __attribute__((section(".sram_dma")))
+
+// Short-descriptor section attributes. All are privileged access only in domain 0
+#ifdef SMP
+#define MMU_NORMAL   0x1140E   // Normal memory, write-back write-allocate and shareable
+#else
+#define MMU_NORMAL   0x140E    // Normal memory, inner and outer write-back write-allocate
+#endif
+#define MMU_UNCACHED 0x1402    // Normal memory, non-cacheable
+#define MMU_DEVICE   0x0416    // Shareable device memory, execute never
+
+// Attributes for server mappings in the lower 2 GiB. These are accessible from user mode
+#define MMU_USER_NORMAL 0x1C0E
+#define MMU_USER_DEVICE 0x0C16
+#define MMU_XN          (1 << 4)
+#define MMU_NG          (1 << 17)
+
+// Places a variable in the non-cacheable DMA region. Use this for DMA descriptors
+#define __dma_coherent __attribute__((section(".dma_coherent")))
+
+// One entry in the board specific table of peripheral windows. All fields must be
+// aligned to 1 MiB
+struct mmu_region {
+    u32 virt;
+    u32 phys;
+    u32 size;
+    u32 attr;
+};
+
+// Each board provides these. The table is read by the early MMU setup before the MMU is
+// enabled, so it must only contain plain numbers
+extern const struct mmu_region mmu_io_regions[];
+extern const u32 mmu_io_region_count;
+
+extern u32 kernel_page_table[4096];
+extern u32 boot_page_table[2048];
+
+// Symbols from the linker script giving the link address, physical load address, DDR
+// size and the SRAM location
+extern u8 link_location[];
+extern u8 ddr_start[];
+extern u8 ddr_size[];
+extern u8 sram_start[];
+
+// Converts a kernel virtual address in the DDR window or in one of the SRAM windows to a
+// physical address
+static inline u32 virt_to_phys(const void* virt) {
+    u32 addr = (u32)virt;
+    if (addr - SRAM_VIRT < 2 * MMU_SECTION_SIZE) {
+        return ((u32)sram_start & ~(MMU_SECTION_SIZE - 1)) + (addr & (MMU_SECTION_SIZE - 1));
+    }
+    return addr - (u32)link_location + (u32)ddr_start;
+}
+
+static inline void* phys_to_virt(u32 phys) {
+    return (void *)(phys - (u32)ddr_start + (u32)link_location);
+}
+
+// Installs a translation table for the lower 2 GiB and its ASID
+void mmu_switch_ttbr0(u32 table_phys, u32 asid);
+
+void tlb_invalidate_all();
+void tlb_invalidate_asid(u32 asid);
+void tlb_invalidate_page(u32 virt, u32 asid);
+
+// Cleans the data cache, turns off the MMU and the caches, and jumps to the physical
+// address `phys` with `arg` in r0
+void kernel_jump(u32 phys, u32 arg) __attribute__((noreturn));
+
+#endif
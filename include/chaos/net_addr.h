@@ -0,0 +1,14 @@
+// Conversion between network addresses and strings
+
+#ifndef NET_ADDR_H
+#define NET_ADDR_H
+
+#include <chaos/types.h>
+
+i32 string_to_ip(const char* str, u32* ip_addr);
+void ip_to_string(char* str, u32 addr);
+
+void mac_to_string(char* str, u8* mac, u8 lowercase);
+i32 string_to_mac(const char* str, u8* mac);
+
+#endif
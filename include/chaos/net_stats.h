@@ -0,0 +1,75 @@
+// Statistics counters for the NIC drivers and the kernel network stack
+
+#ifndef NET_STATS_H
+#define NET_STATS_H
+
+#include <chaos/types.h>
+
+// Counters from the NIC. Most NICs implement 32-bit clear-on-read counters, so the driver
+// folds them into these 64-bit totals each time the stats are read. The poll counters are
+// kept by the driver
+struct nic_stats {
+    u64 rx_frames;
+    u64 tx_frames;
+    u64 rx_octets;
+    u64 tx_octets;
+    u64 rx_fcs_errors;
+    u64 rx_length_errors;
+    u64 rx_alignment_errors;
+    u64 rx_symbol_errors;
+    u64 rx_overruns;
+    u64 rx_resource_errors;
+    u64 rx_undersize;
+    u64 rx_oversize;
+    u64 rx_checksum_errors;
+    u64 tx_underruns;
+    u64 tx_collisions;
+    u64 tx_late_collisions;
+    u64 poll_interrupts;    // Interrupts that scheduled nic_poll
+    u64 poll_budget_full;   // Polls that used the whole budget and kept the NIC polled
+};
+
+// Software counters from the protocol layers. Every packet the stack drops should be
+// counted here
+struct proto_stats {
+    u64 rx_packets;
+    u64 rx_runts;           // Frames too short to hold a MAC header
+    u64 rx_unknown_ethertype;
+    u64 rx_arp;
+    u64 tx_arp_replies;
+    u64 arp_retransmits;
+    u64 arp_dropped;
+    u64 rx_ip_dropped;
+    u64 rx_udp_bad_port;
+    u64 tftp_rx_blocks;
+    u64 tftp_rx_bytes;
+    u64 tftp_duplicates;
+    u64 tftp_out_of_order;
+    u64 tftp_bad_opcode;
+    u64 tftp_tx_acks;
+    u64 rx_no_buffer;       // Frames dropped because no netbuf could refill the RX ring
+    u64 tx_no_buffer;       // Packets not sent because no netbuf was free
+};
+
+#define NET_STATS_MAGIC   0x4154534E
+#define NET_STATS_VERSION 4
+
+// Binary snapshot of all the counters. The layout is versioned so that host tools can
+// parse a snapshot dumped from memory or sent over the network
+struct net_stats_snapshot {
+    u32 magic;
+    u32 version;
+    u32 size;
+    u32 reserved;
+    struct nic_stats nic;
+    struct proto_stats proto;
+};
+
+// Counters updated directly by the protocol layers
+extern struct proto_stats proto_stats;
+
+void net_stats_reset();
+void net_stats_snapshot(struct net_stats_snapshot* snapshot);
+void net_stats_print();
+
+#endif
@@ -4,24 +4,189 @@
 #define NETBUF_H
 
 #include <chaos/types.h>
-#include <chaos/list.h>
+#include <chaos/panic.h>
 
-#define NETBUF_SIZE 1600
+// Netbufs come in two sizes. Large ones hold a full ethernet frame, and small ones hold
+// ARP packets, TFTP ACKs and requests, and other short frames
+#define NETBUF_SIZE       1600
+#define NETBUF_SMALL_SIZE 256
 
-// Must be aligned with at least 64-bytes
+// Alignment of the packet data. This is the cache line of the Cortex-A7 and a multiple of
+// the GMAC DMA burst, and both sizes are a multiple of it
+#define NETBUF_ALIGN 64
+
+// Clones have no data of their own. They share the data of another netbuf
+enum netbuf_class {
+    NETBUF_SMALL,
+    NETBUF_LARGE,
+    NETBUF_CLONE,
+    NETBUF_CLASSES
+};
+
+// Room reserved in front of the data of a new netbuf, so that the protocol layers can
+// push their headers without moving the payload
+#define NETBUF_HEADROOM 134
+
+// Metadata of a netbuf. The packet data is stored apart from it
 struct netbuf {
-    u8 buf[NETBUF_SIZE];
+    // Start and size of the data buffer
+    u8* buf;
+    u16 size;
+    u16 class;
 
-    // Allow to link netbuf's together. This also open for IP fragmenting
-    struct list_node node;
+    // Next buffer of a packet that spans several netbufs. Only the first buffer carries
+    // the headers, and the packet length is the sum of `len` over the chain
+    struct netbuf* next;
 
     // Allways pointing to the current protocol header start
     u8* ptr;
     u32 len;
+
+    // Number of references. The netbuf goes back to its pool when the last one is freed
+    u32 refs;
+
+    // The netbuf owning the data of a clone. A clone holds a reference to it, so the data
+    // stays until the last clone is freed
+    struct netbuf* origin;
+
+#ifdef NETBUF_DEBUG
+    // Owner tag written on allocation. The owner is the return address of the caller of
+    // alloc_netbuf and the timestamp is in milliseconds
+    u32 owner;
+    u32 timestamp;
+    u32 allocated;
+#endif
+};
+
+// Netbuf pool statistics of one class. The counters and the watermarks are reset by
+// netbuf_init
+struct netbuf_stats {
+    u32 total;
+    u32 in_use;
+    u32 high_watermark;    // Highest number of netbufs in use at the same time
+    u32 low_watermark;     // Lowest number of free netbufs seen
+    u32 alloc_count;
+    u32 free_count;
+    u32 alloc_failed;      // Allocations that found the pool empty
 };
 
+// Small frames up to this length are copied out of the RX ring into a small netbuf, and
+// the large buffer goes straight back to the DMA
+#define NETBUF_COPYBREAK (NETBUF_SMALL_SIZE - NETBUF_HEADROOM)
+
 void netbuf_init();
+
+// Returns an empty large netbuf with NETBUF_HEADROOM bytes in front of the data, or NULL
+// if the pool is empty. The caller must handle this, usually by dropping the packet and
+// counting it. A netbuf can be freed on any core
 struct netbuf* alloc_netbuf();
+
+// Returns the smallest netbuf with room for `len` bytes after the headroom. If there is
+// no free netbuf of that size a larger one is used. Returns NULL if none is free
+struct netbuf* alloc_netbuf_len(u32 len);
+
+// Drops a reference to a netbuf and to every buffer chained to it. A buffer goes back to
+// its pool when its last reference is dropped
 void free_netbuf(struct netbuf* buf);
 
+// Drops one reference to a single netbuf and leaves the buffers chained to it alone. This
+// is for a holder that took over the references of a chain one buffer at a time
+void netbuf_put_ref(struct netbuf* buf);
+
+// Takes an extra reference to a netbuf and every buffer chained to it. The holder must
+// not change the data or the chain while it is shared
+static inline struct netbuf* netbuf_get(struct netbuf* buf) {
+    for (struct netbuf* seg = buf; seg; seg = seg->next) {
+        __atomic_add_fetch(&seg->refs, 1, __ATOMIC_RELAXED);
+    }
+    return buf;
+}
+
+// Returns a copy of the metadata of a packet which shares the data. Each buffer of the
+// chain is cloned, and the clone has a data window and a chain of its own. Returns NULL
+// if there are not enough clones free. This lets a sender keep a packet for a
+// retransmission without copying the payload
+struct netbuf* netbuf_clone(struct netbuf* buf);
+
+// Returns 1 if the data of a netbuf might be seen by another holder
+static inline u32 netbuf_shared(const struct netbuf* buf) {
+    return buf->origin || __atomic_load_n(&buf->refs, __ATOMIC_RELAXED) > 1;
+}
+
+static inline u32 netbuf_headroom(const struct netbuf* buf) {
+    return buf->ptr - buf->buf;
+}
+
+static inline u32 netbuf_tailroom(const struct netbuf* buf) {
+    return buf->buf + buf->size - (buf->ptr + buf->len);
+}
+
+// Adds `len` bytes in front of the data and returns the new start. This is used to add a
+// protocol header. Running out of headroom or writing to shared data is a bug in the
+// caller. Headers for shared data go in a netbuf of their own in front of it
+static inline u8* netbuf_push(struct netbuf* buf, u32 len) {
+    if (len > netbuf_headroom(buf) || netbuf_shared(buf)) {
+        panic("Netbuf push beyond the headroom or to shared data");
+    }
+    buf->ptr -= len;
+    buf->len += len;
+    return buf->ptr;
+}
+
+// Removes `len` bytes from the start of the data and returns the new start. This is used
+// to skip a received header. Returns NULL, leaving the netbuf as it is, if the data is
+// shorter than `len`, so a short packet can be dropped
+static inline u8* netbuf_pull(struct netbuf* buf, u32 len) {
+    if (len > buf->len) {
+        return NULL;
+    }
+    buf->ptr += len;
+    buf->len -= len;
+    return buf->ptr;
+}
+
+// Adds `len` bytes at the end of the data and returns a pointer to them. Running out of
+// tailroom or writing to shared data is a bug in the caller
+static inline u8* netbuf_put(struct netbuf* buf, u32 len) {
+    if (len > netbuf_tailroom(buf) || netbuf_shared(buf)) {
+        panic("Netbuf put beyond the tailroom or to shared data");
+    }
+    u8* tail = buf->ptr + buf->len;
+    buf->len += len;
+    return tail;
+}
+
+// Cuts the data down to `len` bytes. This is used to drop padding and trailers. Nothing
+// happens if the data is already shorter
+static inline void netbuf_trim(struct netbuf* buf, u32 len) {
+    if (len < buf->len) {
+        buf->len = len;
+    }
+}
+
+// Appends `tail` and the buffers chained to it to the end of the chain at `buf`
+static inline void netbuf_chain(struct netbuf* buf, struct netbuf* tail) {
+    while (buf->next) {
+        buf = buf->next;
+    }
+    buf->next = tail;
+}
+
+// Returns the length of the packet starting at `buf`, over all chained buffers
+static inline u32 netbuf_chain_len(const struct netbuf* buf) {
+    u32 len = 0;
+    for (; buf; buf = buf->next) {
+        len += buf->len;
+    }
+    return len;
+}
+
+// Copies the statistics of the pool of one netbuf class
+void netbuf_get_stats(enum netbuf_class class, struct netbuf_stats* stats);
+void netbuf_print_stats();
+
+// Lists all netbufs held for longer than `threshold` milliseconds, followed by the number
+// of netbufs held by each owner. This requires NETBUF_DEBUG
+void netbuf_leak_report(u32 threshold);
+
 #endif
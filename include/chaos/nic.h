@@ -5,9 +5,46 @@
 
 #include <chaos/types.h>
 #include <chaos/netbuf.h>
+#include <chaos/net_stats.h>
+#include <chaos/handoff.h>
+
+// Frames handled by one call to nic_poll. Set from nic_poll_budget in the config
+#ifndef NIC_POLL_BUDGET
+#define NIC_POLL_BUDGET 8
+#endif
 
 void nic_init();
+
+// Splits nic_init so that other work can run during the PHY auto-negotiation. The poll
+// function returns 1 until the NIC is running
+void nic_init_start();
+u32 nic_init_poll();
+
+// Starts the NIC on the link set up by the previous kernel. This falls back to nic_init if
+// the handoff has no link or the link went down
+void nic_resume(const struct handoff* handoff);
+
+// Writes the link state to the handoff for the next kernel
+void nic_save_link(struct handoff* handoff);
+
+// Turns off the receiver, the transmitter and the interrupts before a soft reboot. The
+// netbufs of the running kernel are overwritten by the next one
+void nic_stop();
 struct netbuf* nic_receive();
 void nic_send(struct netbuf* buf);
 
+// Passes up to `budget` received frames to `handler`, which takes over each netbuf, and
+// releases the sent frames. Returns the number of frames taken from the RX ring
+u32 nic_poll(u32 budget, void (*handler)(struct netbuf* buf));
+
+// Sleeps until the NIC has work for nic_poll. Returns at once if the NIC is polled
+void nic_wait();
+
+// Folds the hardware counters into the driver totals and copies them to `stats`
+void nic_get_stats(struct nic_stats* stats);
+void nic_clear_stats();
+
+// Routes transmitted frames straight back to the receiver. Used for benchmarking
+void nic_set_loopback(u32 enable);
+
 #endif
@@ -0,0 +1,12 @@
+// NIC loopback benchmark
+
+#ifndef NIC_BENCH_H
+#define NIC_BENCH_H
+
+#include <chaos/types.h>
+
+// Sends `frames` frames of `size` bytes through the NIC in local loopback and prints the
+// packet rate through nic_send and nic_receive
+void nic_bench(u32 frames, u32 size);
+
+#endif
@@ -0,0 +1,71 @@
+// Object pool with per-core magazines. Each core keeps a few free objects in magazines of
+// its own and only goes to the shared depot for a whole magazine at a time
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <chaos/types.h>
+#include <chaos/smp.h>
+
+#define POOL_MAGAZINE_SIZE 16
+
+// Number of magazines needed for `objs` objects. Besides the full ones, each core holds
+// two magazines that may be partly filled, and the depot always needs an empty one
+#define POOL_MAGAZINES(objs) \
+    (((objs) + POOL_MAGAZINE_SIZE - 1) / POOL_MAGAZINE_SIZE + 2 * SMP_MAX_CPUS + 1)
+
+struct pool_magazine {
+    u32 count;
+    u32 next;        // Index plus one of the next magazine in the depot
+    void* objs[POOL_MAGAZINE_SIZE];
+};
+
+// State of one core. The user places this in the per-core data, so the cores never share
+// a cache line of it
+struct pool_cpu {
+    struct pool_magazine* loaded;
+    struct pool_magazine* prev;
+    u32 allocs;
+    u32 frees;
+    u32 fails;
+};
+
+// The depot keeps stacks of full and empty magazines. A stack head holds the index plus
+// one of the top magazine in the low word and a tag in the high word. The tag changes on
+// every update, so a magazine that is popped and pushed back between the read and the
+// compare-and-swap of another core is never mistaken for an unchanged head
+struct pool {
+    struct pool_cpu* cpu;
+    struct pool_magazine* mags;
+    u32 mag_count;
+    u32 total;
+    u32 high_watermark;
+    u64 full;
+    u64 empty;
+};
+
+struct pool_stats {
+    u32 total;
+    u32 in_use;
+    u32 high_watermark;    // Highest number of objects in use at the same time
+    u32 allocs;
+    u32 frees;
+    u32 fails;             // Allocations that found the pool empty
+};
+
+// The pool uses `mag_count` magazines at `mags`, which must be at least POOL_MAGAZINES of
+// the number of objects. `cpu` is the per-core state. This must be called before any
+// other core uses the pool
+void pool_init(struct pool* pool, struct pool_cpu* cpu, struct pool_magazine* mags,
+    u32 mag_count);
+void pool_add(struct pool* pool, void* obj);
+
+// Returns a free object, or NULL if the pool is empty. An object can be freed on any
+// core. Both mask IRQs while they change the magazines of the core, so they can also be
+// called from an interrupt handler
+void* pool_alloc(struct pool* pool);
+void pool_free(struct pool* pool, void* obj);
+
+void pool_get_stats(struct pool* pool, struct pool_stats* stats);
+
+#endif
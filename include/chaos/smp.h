@@ -0,0 +1,65 @@
+// Secondary cores, per-core data and calls across cores
+
+#ifndef SMP_H
+#define SMP_H
+
+#include <chaos/types.h>
+
+// Number of cores the kernel is built for. This must match the linker script
+#ifdef SMP
+#define SMP_MAX_CPUS SMP_CPUS
+#else
+#define SMP_MAX_CPUS 1
+#endif
+
+// Places a variable in the per-core data. Every core has its own copy, which is zeroed at
+// boot. The copy of a core is reached with per_cpu and the own copy with this_cpu
+#define __percpu __attribute__((section(".percpu")))
+
+#ifdef SMP
+// Symbols from the linker script. The copies of the other cores follow the one of core 0
+extern u8 _percpu_s[];
+extern u8 _percpu_e[];
+
+#define per_cpu(var, cpu) \
+    (*(__typeof__(&(var)))((u8 *)&(var) + (cpu) * (u32)(_percpu_e - _percpu_s)))
+#else
+#define per_cpu(var, cpu) (var)
+#endif
+
+#define this_cpu(var) per_cpu(var, smp_cpu_id())
+
+// Returns the number of the running core. The boot core is core 0. Code never moves
+// between cores, so the compiler is free to reuse the value
+static inline u32 smp_cpu_id() {
+#ifdef SMP
+    u32 mpidr;
+    asm ("mrc p15, 0, %0, c0, c0, 5" : "=r" (mpidr));
+    return mpidr & 0xFF;
+#else
+    return 0;
+#endif
+}
+
+u32 smp_cpu_online(u32 cpu);
+u32 smp_online_count();
+
+// Runs `fn` with `arg` on core `cpu`. With `wait` set this returns when the function is
+// done, otherwise as soon as the call is posted. Each core takes one call at a time, so a
+// new call to a busy core waits for the previous one. A core calling itself runs the
+// function directly. Returns -ERR_NOT_FOUND if the core is not online
+i32 smp_call_function(u32 cpu, void (*fn)(void*), void* arg, u32 wait);
+
+// Runs `fn` on every other online core. The cores run it in parallel
+void smp_call_function_others(void (*fn)(void*), void* arg, u32 wait);
+
+// Parks the secondary cores before the kernel is replaced, so a new kernel can start them
+// again
+void smp_stop();
+
+// Each SMP board provides these. The first releases core `cpu` from reset at the physical
+// address `entry`, and the second holds a parked core in reset
+i32 smp_boot_cpu(u32 cpu, u32 entry);
+void smp_stop_cpu(u32 cpu);
+
+#endif
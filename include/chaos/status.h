@@ -3,6 +3,8 @@
 #ifndef STATUS_H
 #define STATUS_H
 
-#define ERR_NET 1
+#define ERR_NET       1
+#define ERR_CORRUPT   2
+#define ERR_NOT_FOUND 3
 
 #endif
@@ -5,14 +5,16 @@
 
 #include <chaos/types.h>
 #include <chaos/netbuf.h>
+#include <chaos/net_addr.h>
 
 void tftp_init();
 i32 tftp_read_file(void* dest);
 
-i32 string_to_ip(const char* str, u32* ip_addr);
-void ip_to_string(char* str, u32 addr);
+void tftp_prefetch_start(void* dest);
+void tftp_prefetch_poll();
+i32 tftp_switch();
 
-void mac_to_string(char* str, u8* mac, u8 lowercase);
-i32 string_to_mac(const char* str, u8* mac);
+// Sleeps until the network has work. Returns at once while a transfer waits for a timeout
+void tftp_wait();
 
 #endif
@@ -1,9 +1,10 @@
-// Register map definitions for SAMA5D2 chips
+// Register map definitions for Allwinner H3 chips
 
 #ifndef H3_REGMAP_H
 #define H3_REGMAP_H
 
 #include <chaos/types.h>
+#include <chaos/mmu.h>
 
 struct uart_reg {
     union {
@@ -32,10 +33,45 @@ struct uart_reg {
     _rw u32 halt;
 };
 
-#define UART0_REG ((struct uart_reg *)0x01C28000)
-#define UART1_REG ((struct uart_reg *)0x01C28400)
-#define UART2_REG ((struct uart_reg *)0x01C28800)
-#define UART3_REG ((struct uart_reg *)0x01C28C00)
-#define UARTr_REG ((struct uart_reg *)0x01F02800)
+#define UART0_REG ((struct uart_reg *)IO_LOW(0x01C28000))
+#define UART1_REG ((struct uart_reg *)IO_LOW(0x01C28400))
+#define UART2_REG ((struct uart_reg *)IO_LOW(0x01C28800))
+#define UART3_REG ((struct uart_reg *)IO_LOW(0x01C28C00))
+#define UARTr_REG ((struct uart_reg *)IO_LOW(0x01F02800))
+
+// Reset and status registers of one core in the CPU configuration block
+struct cpucfg_cpu_reg {
+    _rw u32 rst_ctrl;
+    _rw u32 ctrl;
+    __r u32 status;
+    __r u32 reserved[13];
+};
+
+struct cpucfg_reg {
+    _rw u32 cpus_rst_ctrl;
+    __r u32 reserved0[15];
+    struct cpucfg_cpu_reg cpu[4];
+    _rw u32 cpu_sys_rst;
+    _rw u32 clk_gating;
+    __r u32 reserved1[15];
+    _rw u32 gen_ctrl;
+    __r u32 reserved2[6];
+    _rw u32 super_standby;
+    _rw u32 entry_addr;
+    __r u32 reserved3[14];
+    _rw u32 dbg_ctrl0;
+    _rw u32 dbg_ctrl1;
+};
+
+// Power control of the cores in the R_PRCM block
+struct prcm_reg {
+    __r u32 reserved0[64];
+    _rw u32 cpu_pwroff;
+    __r u32 reserved1[15];
+    _rw u32 cpu_pwr_clamp[4];
+};
+
+#define CPUCFG_REG ((struct cpucfg_reg *)IO_LOW(0x01F01C00))
+#define PRCM_REG   ((struct prcm_reg *)IO_LOW(0x01F01400))
 
 #endif
@@ -4,6 +4,7 @@
 #define SAMA5D2_REGMAP_H    
 
 #include <chaos/types.h>
+#include <chaos/mmu.h>
 
 struct wdt_reg {
     __w u32 cr;
@@ -340,7 +341,7 @@ struct l2cache_reg {
     __r u32 imr;
     __r u32 misr;
     __r u32 risr;
-    __r u32 icr;
+    __w u32 icr;
     __r u32 reserved3[323];
     _rw u32 csr;
     __r u32 reserved4[15];
@@ -368,7 +369,7 @@ struct l2cache_reg {
     _rw u32 powcr;
 };
 
-#define L2CAHCE_REG ((struct l2cache_reg *)0x00a00000)
+#define L2CAHCE_REG ((struct l2cache_reg *)IO_LOW(0x00a00000))
 
 struct trng_reg {
     __w u32 cr;
@@ -725,4 +726,7 @@ struct nic_reg {
 
 #define NIC_REG ((struct nic_reg *)0xf8008000)
 
+// The GMAC interrupt is the peripheral ID on the AIC
+#define NIC_IRQ_ID 5
+
 #endif
@@ -0,0 +1,93 @@
+// Register map definitions for Xilinx Zynq-7000 chips
+
+#ifndef ZYNQ_REGMAP_H
+#define ZYNQ_REGMAP_H
+
+#include <chaos/types.h>
+
+// The Zynq GEM is the same Cadence IP as the SAMA5D2 GMAC, and the L2 cache is the same
+// PL310 controller. We reuse the SAMA5D2 register layouts and only move the base
+// addresses. This lets the SAMA5D2 NIC driver run unchanged on the QEMU xilinx-zynq-a9
+// machine
+#include <sama5d2/regmap.h>
+
+#undef NIC_REG
+#define NIC_REG ((struct nic_reg *)0xe000b000)
+
+#undef L2CAHCE_REG
+#define L2CAHCE_REG ((struct l2cache_reg *)0xf8f02000)
+
+// GEM0 on the Cortex-A9 interrupt controller
+#undef NIC_IRQ_ID
+#define NIC_IRQ_ID 54
+
+// Cadence UART
+struct zynq_uart_reg {
+    _rw u32 cr;
+    _rw u32 mr;
+    __w u32 ier;
+    __w u32 idr;
+    __r u32 imr;
+    _rw u32 isr;
+    _rw u32 baudgen;
+    _rw u32 rxtout;
+    _rw u32 rxwm;
+    _rw u32 modemcr;
+    _rw u32 modemsr;
+    __r u32 sr;
+    _rw u32 fifo;
+    _rw u32 bauddiv;
+    _rw u32 flowdel;
+    __r u32 reserved0[2];
+    _rw u32 txwm;
+};
+
+#define ZYNQ_UART0_REG ((struct zynq_uart_reg *)0xe0000000)
+#define ZYNQ_UART1_REG ((struct zynq_uart_reg *)0xe0001000)
+
+// Cortex-A9 MPCore global timer
+struct global_timer_reg {
+    _rw u32 counter_low;
+    _rw u32 counter_high;
+    _rw u32 control;
+    _rw u32 isr;
+    _rw u32 compare_low;
+    _rw u32 compare_high;
+    _rw u32 auto_increment;
+};
+
+#define GLOBAL_TIMER_REG ((struct global_timer_reg *)0xf8f00200)
+
+// Cortex-A9 MPCore interrupt controller. The distributor routes the shared interrupts to
+// the cores, and each core acknowledges them through its CPU interface
+struct gic_dist_reg {
+    _rw u32 dcr;
+    __r u32 ictr;
+    __r u32 iidr;
+    __r u32 reserved0[29];
+    _rw u32 isr[32];
+    _rw u32 iser[32];
+    _rw u32 icer[32];
+    _rw u32 ispr[32];
+    _rw u32 icpr[32];
+    __r u32 abr[32];
+    __r u32 reserved1[32];
+    _rw u8  ipr[1024];
+    _rw u8  iptr[1024];
+    _rw u32 icfr[64];
+};
+
+struct gic_cpu_reg {
+    _rw u32 icr;
+    _rw u32 pmr;
+    _rw u32 bpr;
+    __r u32 iar;
+    __w u32 eoir;
+    __r u32 rpr;
+    __r u32 hpir;
+};
+
+#define GIC_DIST_REG ((struct gic_dist_reg *)0xf8f01000)
+#define GIC_CPU_REG ((struct gic_cpu_reg *)0xf8f00100)
+
+#endif
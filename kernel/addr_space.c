@@ -0,0 +1,113 @@
+// Server address spaces
+
+#include <chaos/addr_space.h>
+#include <chaos/assert.h>
+#include <chaos/cache.h>
+#include <chaos/mmu.h>
+#include <chaos/mem.h>
+
+// ASID 0 is used by the boot identity mapping, which leaves 255 ASIDs for the servers
+#define ASID_BITS 8
+#define ASID_MASK ((1 << ASID_BITS) - 1)
+#define ASID_FIRST_GENERATION (1 << ASID_BITS)
+
+// Each time all ASIDs have been handed out we start a new generation and flush the TLB.
+// An address space from an older generation gets a new ASID on its next switch
+static u32 asid_generation = ASID_FIRST_GENERATION;
+static u32 asid_next = 1;
+
+static struct addr_space* current_space;
+
+// Returns 1 if the address space holds an ASID from the current generation
+static inline u32 asid_is_current(const struct addr_space* space) {
+    return space->asid && (space->asid & ~ASID_MASK) == asid_generation;
+}
+
+// Gives the address space a new ASID. Returns 1 if this started a new generation, in
+// which case the TLB must be flushed before the new ASID is installed
+static u32 asid_new(struct addr_space* space) {
+    u32 rollover = 0;
+    if (asid_next > ASID_MASK) {
+        asid_generation += ASID_FIRST_GENERATION;
+        asid_next = 1;
+        rollover = 1;
+    }
+    space->asid = asid_generation | asid_next++;
+    return rollover;
+}
+
+void addr_space_init(struct addr_space* space, u32* table) {
+    assert(((u32)table & (ADDR_SPACE_ALIGN - 1)) == 0);
+
+    space->table = table;
+    space->asid = 0;
+
+    mem_set(table, 0, ADDR_SPACE_ENTRIES * sizeof(u32));
+    dcache_clean_virt_range((u32)table, (u32)(table + ADDR_SPACE_ENTRIES));
+}
+
+// Drops all TLB entries of the address space. The table memory can be reused afterwards
+void addr_space_release(struct addr_space* space) {
+    if (current_space == space) {
+        addr_space_switch(NULL);
+    }
+    if (asid_is_current(space)) {
+        tlb_invalidate_asid(space->asid);
+    }
+    space->asid = 0;
+}
+
+void addr_space_map(struct addr_space* space, u32 virt, u32 phys, u32 size, u32 attr) {
+    assert(((virt | phys | size) & (MMU_SECTION_SIZE - 1)) == 0);
+    assert(virt + size <= KERNEL_VIRT_BASE && virt + size >= virt);
+
+    u32* entry = &space->table[virt >> 20];
+    for (u32 i = 0; i < (size >> 20); i++) {
+        entry[i] = (phys + i * MMU_SECTION_SIZE) | attr | MMU_NG;
+    }
+
+    // Make the entries visible to the table walker. A new mapping can't be in the TLB
+    dcache_clean_virt_range((u32)entry, (u32)(entry + (size >> 20)));
+}
+
+void addr_space_unmap(struct addr_space* space, u32 virt, u32 size) {
+    assert(((virt | size) & (MMU_SECTION_SIZE - 1)) == 0);
+    assert(virt + size <= KERNEL_VIRT_BASE && virt + size >= virt);
+
+    u32* entry = &space->table[virt >> 20];
+    for (u32 i = 0; i < (size >> 20); i++) {
+        entry[i] = 0;
+    }
+    dcache_clean_virt_range((u32)entry, (u32)(entry + (size >> 20)));
+
+    // Entries tagged with an old generation ASID are already gone from the TLB
+    if (asid_is_current(space)) {
+        for (u32 i = 0; i < (size >> 20); i++) {
+            tlb_invalidate_page(virt + i * MMU_SECTION_SIZE, space->asid);
+        }
+    }
+}
+
+// A switch only writes TTBR0 and CONTEXTIDR. The TLB is flushed once every 255 new ASIDs
+void addr_space_switch(struct addr_space* space) {
+    if (space == current_space) {
+        return;
+    }
+
+    if (space == NULL) {
+        mmu_switch_ttbr0(virt_to_phys(boot_page_table), 0);
+        current_space = NULL;
+        return;
+    }
+
+    // A reused ASID might still tag TLB entries of the previous generation. The flush
+    // is done on the boot mapping, which has the reserved ASID 0, so no table walk can
+    // bring an old entry back before the reused ASID is installed
+    if (asid_is_current(space) == 0 && asid_new(space)) {
+        mmu_switch_ttbr0(virt_to_phys(boot_page_table), 0);
+        tlb_invalidate_all();
+    }
+
+    mmu_switch_ttbr0(virt_to_phys(space->table), space->asid);
+    current_space = space;
+}
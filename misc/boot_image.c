@@ -0,0 +1,187 @@
+// Streaming receiver for the segmented boot image. The file is parsed as it arrives, so
+// each segment is written straight to its place in the staging area
+
+#include <chaos/boot_image.h>
+#include <chaos/crc32.h>
+#include <chaos/status.h>
+#include <chaos/mem.h>
+
+// Receiver states
+#define BOOT_IMAGE_HEADER 0
+#define BOOT_IMAGE_TABLE  1
+#define BOOT_IMAGE_DATA   2
+#define BOOT_IMAGE_DONE   3
+#define BOOT_IMAGE_RAW    4
+#define BOOT_IMAGE_ERROR  5
+
+static inline u32 min(u32 a, u32 b) {
+    return (a < b) ? a : b;
+}
+
+// Prepares the receiver for a new file. The image can use `stage_size` bytes at `stage`
+void boot_image_init(struct boot_image* image, void* stage, u32 stage_size) {
+    image->stage = stage;
+    image->stage_size = stage_size;
+    image->state = BOOT_IMAGE_HEADER;
+    image->offset = 0;
+    image->segment = 0;
+    image->crc = CRC32_INIT;
+}
+
+// Appends raw file data to the staging area
+static i32 boot_image_write_raw(struct boot_image* image, const u8* data, u32 size) {
+    if (size > image->stage_size - image->offset) {
+        return -ERR_CORRUPT;
+    }
+    mem_copy(data, image->stage + image->offset, size);
+    image->offset += size;
+    return 0;
+}
+
+// The header is trusted only after the CRC check at the end. Until then it is checked
+// enough that the segment data can not be written outside the staging area
+static i32 boot_image_check_header(struct boot_image* image) {
+    struct boot_image_header* header = &image->header;
+
+    if (header->version != BOOT_IMAGE_VERSION || header->segment_count == 0 ||
+        header->segment_count > BOOT_IMAGE_MAX_SEGMENTS ||
+        header->entry - header->load_addr >= image->stage_size) {
+        return -ERR_CORRUPT;
+    }
+    return 0;
+}
+
+static i32 boot_image_check_segments(struct boot_image* image) {
+    for (u32 i = 0; i < image->header.segment_count; i++) {
+        struct boot_segment* segment = &image->segments[i];
+        u32 offset = segment->addr - image->header.load_addr;
+
+        if (segment->addr < image->header.load_addr ||
+            segment->file_size > segment->mem_size ||
+            segment->mem_size > image->stage_size ||
+            offset > image->stage_size - segment->mem_size) {
+            return -ERR_CORRUPT;
+        }
+    }
+    return 0;
+}
+
+// Moves to the next segment with data in the file
+static void boot_image_next_segment(struct boot_image* image) {
+    while (image->segment < image->header.segment_count &&
+        image->segments[image->segment].file_size == 0) {
+        image->segment++;
+    }
+    image->offset = 0;
+    image->state = (image->segment < image->header.segment_count) ?
+        BOOT_IMAGE_DATA : BOOT_IMAGE_DONE;
+}
+
+// Handles the next `size` bytes of the file. This can be called with any split of the
+// file. After an error the rest of the file is ignored and the error is returned again
+// by boot_image_finish
+i32 boot_image_write(struct boot_image* image, const u8* data, u32 size) {
+    while (size) {
+        u32 len = size;
+
+        if (image->state == BOOT_IMAGE_HEADER) {
+            u8* header = (u8 *)&image->header;
+            len = min(size, sizeof(struct boot_image_header) - image->offset);
+            mem_copy(data, header + image->offset, len);
+            image->offset += len;
+
+            if (image->offset == sizeof(struct boot_image_header)) {
+                image->offset = 0;
+                if (image->header.magic != BOOT_IMAGE_MAGIC) {
+                    // Not a boot image. The buffered bytes are the start of the file
+                    image->state = BOOT_IMAGE_RAW;
+                    if (boot_image_write_raw(image, header, sizeof(struct boot_image_header))) {
+                        image->state = BOOT_IMAGE_ERROR;
+                    }
+                } else if (boot_image_check_header(image)) {
+                    image->state = BOOT_IMAGE_ERROR;
+                } else {
+                    // The CRC covers the header with the CRC field as zero
+                    u32 crc = image->header.crc;
+                    image->header.crc = 0;
+                    image->crc = crc32_update(image->crc, header,
+                        sizeof(struct boot_image_header));
+                    image->header.crc = crc;
+                    image->state = BOOT_IMAGE_TABLE;
+                }
+            }
+        } else if (image->state == BOOT_IMAGE_TABLE) {
+            u32 table_size = image->header.segment_count * sizeof(struct boot_segment);
+            len = min(size, table_size - image->offset);
+            mem_copy(data, (u8 *)image->segments + image->offset, len);
+            image->crc = crc32_update(image->crc, data, len);
+            image->offset += len;
+
+            if (image->offset == table_size) {
+                if (boot_image_check_segments(image)) {
+                    image->state = BOOT_IMAGE_ERROR;
+                } else {
+                    image->segment = 0;
+                    boot_image_next_segment(image);
+                }
+            }
+        } else if (image->state == BOOT_IMAGE_DATA) {
+            struct boot_segment* segment = &image->segments[image->segment];
+            u8* dest = image->stage + segment->addr - image->header.load_addr;
+
+            len = min(size, segment->file_size - image->offset);
+            mem_copy(data, dest + image->offset, len);
+            image->crc = crc32_update(image->crc, data, len);
+            image->offset += len;
+
+            if (image->offset == segment->file_size) {
+                image->segment++;
+                boot_image_next_segment(image);
+            }
+        } else if (image->state == BOOT_IMAGE_RAW) {
+            if (boot_image_write_raw(image, data, size)) {
+                image->state = BOOT_IMAGE_ERROR;
+            }
+        } else {
+            // Data after the last segment is an error as well
+            image->state = BOOT_IMAGE_ERROR;
+            return -ERR_CORRUPT;
+        }
+
+        data += len;
+        size -= len;
+    }
+    return (image->state == BOOT_IMAGE_ERROR) ? -ERR_CORRUPT : 0;
+}
+
+// Completes the file. This checks the CRC and zero fills the segments. The offset of the
+// entry point into the staging area is written to `entry_offset`
+i32 boot_image_finish(struct boot_image* image, u32* entry_offset) {
+    // A raw file shorter than the header
+    if (image->state == BOOT_IMAGE_HEADER) {
+        u32 len = image->offset;
+        image->offset = 0;
+        image->state = BOOT_IMAGE_RAW;
+        if (boot_image_write_raw(image, (u8 *)&image->header, len)) {
+            return -ERR_CORRUPT;
+        }
+    }
+
+    if (image->state == BOOT_IMAGE_RAW) {
+        *entry_offset = 0;
+        return 0;
+    }
+
+    if (image->state != BOOT_IMAGE_DONE || ~image->crc != image->header.crc) {
+        return -ERR_CORRUPT;
+    }
+
+    for (u32 i = 0; i < image->header.segment_count; i++) {
+        struct boot_segment* segment = &image->segments[i];
+        u8* dest = image->stage + segment->addr - image->header.load_addr;
+        mem_set(dest + segment->file_size, 0, segment->mem_size - segment->file_size);
+    }
+
+    *entry_offset = image->header.entry - image->header.load_addr;
+    return 0;
+}
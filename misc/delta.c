@@ -0,0 +1,113 @@
+// Streaming receiver for the delta file of a delta soft reboot
+
+#include <chaos/delta.h>
+#include <chaos/crc32.h>
+#include <chaos/status.h>
+#include <chaos/mem.h>
+
+// Receiver states
+#define DELTA_HEADER       0
+#define DELTA_BLOCK_OFFSET 1
+#define DELTA_BLOCK_DATA   2
+#define DELTA_DONE         3
+#define DELTA_ERROR        4
+
+static inline u32 min(u32 a, u32 b) {
+    return (a < b) ? a : b;
+}
+
+// Prepares the receiver. The new image is built in `stage_size` bytes at `stage`. The
+// first `base_size` bytes of the running image at `base` are the ones advertised
+void delta_init(struct delta* delta, void* stage, u32 stage_size, const void* base,
+    u32 base_size) {
+    delta->stage = stage;
+    delta->stage_size = stage_size;
+    delta->base = base;
+    delta->base_size = base_size;
+    delta->state = DELTA_HEADER;
+    delta->offset = 0;
+    delta->block = 0;
+}
+
+// Checks the header and starts the new image as a copy of the running one
+static i32 delta_start(struct delta* delta) {
+    struct delta_header* header = &delta->header;
+
+    if (header->magic != DELTA_MAGIC || header->version != DELTA_VERSION ||
+        header->block_size != DELTA_BLOCK_SIZE || header->base_size != delta->base_size ||
+        header->image_size > delta->stage_size) {
+        return -ERR_CORRUPT;
+    }
+
+    mem_copy(delta->base, delta->stage, min(delta->base_size, header->image_size));
+    delta->state = header->block_count ? DELTA_BLOCK_OFFSET : DELTA_DONE;
+    return 0;
+}
+
+// Handles the next `size` bytes of the delta file. This can be called with any split of
+// the file. After an error the rest of the file is ignored
+i32 delta_write(struct delta* delta, const u8* data, u32 size) {
+    while (size) {
+        u32 len = size;
+
+        if (delta->state == DELTA_HEADER) {
+            len = min(size, sizeof(struct delta_header) - delta->offset);
+            mem_copy(data, (u8 *)&delta->header + delta->offset, len);
+            delta->offset += len;
+
+            if (delta->offset == sizeof(struct delta_header)) {
+                delta->offset = 0;
+                if (delta_start(delta)) {
+                    delta->state = DELTA_ERROR;
+                }
+            }
+        } else if (delta->state == DELTA_BLOCK_OFFSET) {
+            len = min(size, 4 - delta->offset);
+            mem_copy(data, (u8 *)&delta->block_offset + delta->offset, len);
+            delta->offset += len;
+
+            if (delta->offset == 4) {
+                u32 offset = delta->block_offset;
+                delta->offset = 0;
+                if (offset % DELTA_BLOCK_SIZE || offset >= delta->header.image_size) {
+                    delta->state = DELTA_ERROR;
+                } else {
+                    delta->block_size = min(DELTA_BLOCK_SIZE,
+                        delta->header.image_size - offset);
+                    delta->state = DELTA_BLOCK_DATA;
+                }
+            }
+        } else if (delta->state == DELTA_BLOCK_DATA) {
+            len = min(size, delta->block_size - delta->offset);
+            mem_copy(data, delta->stage + delta->block_offset + delta->offset, len);
+            delta->offset += len;
+
+            if (delta->offset == delta->block_size) {
+                delta->offset = 0;
+                delta->block++;
+                delta->state = (delta->block < delta->header.block_count) ?
+                    DELTA_BLOCK_OFFSET : DELTA_DONE;
+            }
+        } else {
+            // Data after the last block is an error as well
+            delta->state = DELTA_ERROR;
+            return -ERR_CORRUPT;
+        }
+
+        data += len;
+        size -= len;
+    }
+    return (delta->state == DELTA_ERROR) ? -ERR_CORRUPT : 0;
+}
+
+// Completes the delta file. The CRC of the patched image must match the new image, so a
+// stale block hash or a lost block is never started. This returns the image size
+i32 delta_finish(struct delta* delta) {
+    if (delta->state != DELTA_DONE) {
+        return -ERR_CORRUPT;
+    }
+    if (crc32(delta->stage, delta->header.image_size) != delta->header.crc) {
+        return -ERR_CORRUPT;
+    }
+    return delta->header.image_size;
+}
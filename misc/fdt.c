@@ -0,0 +1,473 @@
+// Flattened device tree parser. Everything is read straight from the blob given by the
+// bootloader. Lookups by path and phandle walk the tree, unless an index is given. The
+// index is built by the first lookup, so a kernel that never asks pays nothing
+
+#include <chaos/fdt.h>
+#include <chaos/status.h>
+#include <chaos/mem.h>
+
+// Structure block tokens
+#define FDT_BEGIN_NODE 1
+#define FDT_END_NODE   2
+#define FDT_PROP       3
+#define FDT_NOP        4
+#define FDT_END        9
+
+// Header fields
+#define FDT_TOTAL_SIZE     4
+#define FDT_OFF_STRUCT     8
+#define FDT_OFF_STRINGS    12
+#define FDT_VERSION        20
+#define FDT_LAST_COMP      24
+#define FDT_SIZE_STRINGS   32
+#define FDT_SIZE_STRUCT    36
+#define FDT_HEADER_SIZE    40
+
+// Index states
+#define FDT_INDEX_EMPTY 0
+#define FDT_INDEX_READY 1
+#define FDT_INDEX_FULL  2
+
+#define FDT_NO_PARENT 0xFFFFFFFF
+
+#define FNV_OFFSET 0x811C9DC5
+#define FNV_PRIME  0x01000193
+
+static u32 str_len(const char* str) {
+    u32 len = 0;
+    while (str[len]) {
+        len++;
+    }
+    return len;
+}
+
+static u32 fnv_update(u32 hash, const char* str, u32 len) {
+    for (u32 i = 0; i < len; i++) {
+        hash = (hash ^ (u8)str[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+static u32 phandle_slot(u32 phandle) {
+    return (phandle * 2654435761u) >> 23;
+}
+
+// Returns the token at `offset`. Anything outside the structure block reads as the end
+static u32 fdt_token(const struct fdt* fdt, u32 offset) {
+    if (offset > fdt->struct_size - 4 || fdt->struct_size < 4) {
+        return FDT_END;
+    }
+    return read_be32(fdt->structs + offset);
+}
+
+// Returns 1 if the name of the property at `offset` is the `len` characters at `name`. The
+// property value must be inside the structure block as well
+static u32 fdt_prop_is(const struct fdt* fdt, u32 offset, const char* name, u32 len) {
+    if (fdt->struct_size < 12 || offset > fdt->struct_size - 12 ||
+        read_be32(fdt->structs + offset + 4) > fdt->struct_size - offset - 12) {
+        return 0;
+    }
+    u32 name_offset = read_be32(fdt->structs + offset + 8);
+    return name_offset < fdt->strings_size && len < fdt->strings_size - name_offset &&
+        mem_cmp(fdt->strings + name_offset, name, len) &&
+        fdt->strings[name_offset + len] == 0;
+}
+
+// Returns the offset of the token following the one at `offset`, or -ERR_CORRUPT
+static i32 fdt_next_token(const struct fdt* fdt, u32 offset) {
+    u32 token = fdt_token(fdt, offset);
+    offset += 4;
+
+    if (token == FDT_BEGIN_NODE) {
+        // The name is zero terminated and padded to a word
+        while (offset < fdt->struct_size && fdt->structs[offset]) {
+            offset++;
+        }
+        if (offset >= fdt->struct_size) {
+            return -ERR_CORRUPT;
+        }
+        offset = (offset + 4) & ~3;
+    } else if (token == FDT_PROP) {
+        if (offset > fdt->struct_size - 8) {
+            return -ERR_CORRUPT;
+        }
+        u32 len = read_be32(fdt->structs + offset);
+        if (len > fdt->struct_size - offset - 8) {
+            return -ERR_CORRUPT;
+        }
+        offset = (offset + 8 + len + 3) & ~3;
+    } else if (token != FDT_END_NODE && token != FDT_NOP) {
+        return -ERR_CORRUPT;
+    }
+    return offset;
+}
+
+// Skips NOP tokens
+static i32 fdt_skip_nops(const struct fdt* fdt, i32 offset) {
+    while (offset >= 0 && fdt_token(fdt, offset) == FDT_NOP) {
+        offset = fdt_next_token(fdt, offset);
+    }
+    return offset;
+}
+
+// Returns the offset following the end of the node at `node`
+static i32 fdt_skip_node(const struct fdt* fdt, i32 node) {
+    u32 depth = 0;
+    i32 offset = node;
+
+    do {
+        u32 token = fdt_token(fdt, offset);
+        if (token == FDT_BEGIN_NODE) {
+            depth++;
+        } else if (token == FDT_END_NODE) {
+            depth--;
+        } else if (token == FDT_END) {
+            return -ERR_CORRUPT;
+        }
+        offset = fdt_next_token(fdt, offset);
+    } while (offset >= 0 && depth);
+
+    return offset;
+}
+
+// Checks the header of the blob at `blob`. The blob must be within `blob_size` bytes.
+// The index is optional
+i32 fdt_init(struct fdt* fdt, const void* blob, u32 blob_size, struct fdt_index* index) {
+    const u8* header = blob;
+
+    if (blob_size < FDT_HEADER_SIZE || read_be32(header) != FDT_MAGIC) {
+        return -ERR_NOT_FOUND;
+    }
+
+    u32 total_size = read_be32(header + FDT_TOTAL_SIZE);
+    u32 off_struct = read_be32(header + FDT_OFF_STRUCT);
+    u32 off_strings = read_be32(header + FDT_OFF_STRINGS);
+    u32 size_struct = read_be32(header + FDT_SIZE_STRUCT);
+    u32 size_strings = read_be32(header + FDT_SIZE_STRINGS);
+
+    // Version 17 is the first one with the structure block size
+    if (read_be32(header + FDT_VERSION) < 17 || read_be32(header + FDT_LAST_COMP) > 17 ||
+        total_size > blob_size || off_struct > total_size ||
+        size_struct > total_size - off_struct || off_strings > total_size ||
+        size_strings > total_size - off_strings || (off_struct & 3)) {
+        return -ERR_CORRUPT;
+    }
+
+    fdt->structs = header + off_struct;
+    fdt->strings = (const char *)header + off_strings;
+    fdt->struct_size = size_struct;
+    fdt->strings_size = size_strings;
+    fdt->index = index;
+    if (index) {
+        index->state = FDT_INDEX_EMPTY;
+    }
+
+    // The root node must come first
+    if (fdt_token(fdt, fdt_skip_nops(fdt, 0)) != FDT_BEGIN_NODE) {
+        return -ERR_CORRUPT;
+    }
+    return 0;
+}
+
+const char* fdt_name(const struct fdt* fdt, i32 node) {
+    return (const char *)fdt->structs + node + 4;
+}
+
+// Returns the first child of `node`, or -ERR_NOT_FOUND
+i32 fdt_first_child(const struct fdt* fdt, i32 node) {
+    i32 offset = fdt_next_token(fdt, node);
+
+    while (offset >= 0) {
+        u32 token = fdt_token(fdt, offset);
+        if (token == FDT_BEGIN_NODE) {
+            // Make sure the name is terminated
+            return (fdt_next_token(fdt, offset) < 0) ? -ERR_CORRUPT : offset;
+        }
+        if (token != FDT_PROP && token != FDT_NOP) {
+            return (token == FDT_END_NODE) ? -ERR_NOT_FOUND : -ERR_CORRUPT;
+        }
+        offset = fdt_next_token(fdt, offset);
+    }
+    return offset;
+}
+
+// Returns the next sibling of `node`, or -ERR_NOT_FOUND
+i32 fdt_next_sibling(const struct fdt* fdt, i32 node) {
+    i32 offset = fdt_skip_nops(fdt, fdt_skip_node(fdt, node));
+    if (offset < 0) {
+        return offset;
+    }
+    if (fdt_token(fdt, offset) != FDT_BEGIN_NODE) {
+        return -ERR_NOT_FOUND;
+    }
+    return (fdt_next_token(fdt, offset) < 0) ? -ERR_CORRUPT : offset;
+}
+
+// Returns the value of the property `name` in `node` and writes its length to `len`. This
+// returns NULL if the node does not have it
+const void* fdt_prop(const struct fdt* fdt, i32 node, const char* name, u32* len) {
+    u32 name_len = str_len(name);
+    i32 offset = fdt_next_token(fdt, node);
+
+    while (offset >= 0) {
+        u32 token = fdt_token(fdt, offset);
+        if (token == FDT_PROP) {
+            if (fdt_prop_is(fdt, offset, name, name_len)) {
+                if (len) {
+                    *len = read_be32(fdt->structs + offset + 4);
+                }
+                return fdt->structs + offset + 12;
+            }
+        } else if (token != FDT_NOP) {
+            return NULL;
+        }
+        offset = fdt_next_token(fdt, offset);
+    }
+    return NULL;
+}
+
+// Reads a single cell property
+i32 fdt_prop_u32(const struct fdt* fdt, i32 node, const char* name, u32* val) {
+    u32 len;
+    const u8* prop = fdt_prop(fdt, node, name, &len);
+    if (prop == NULL || len != 4) {
+        return -ERR_NOT_FOUND;
+    }
+    *val = read_be32(prop);
+    return 0;
+}
+
+static u32 fdt_node_phandle(const struct fdt* fdt, i32 node) {
+    u32 phandle = 0;
+    if (fdt_prop_u32(fdt, node, "phandle", &phandle)) {
+        fdt_prop_u32(fdt, node, "linux,phandle", &phandle);
+    }
+    return phandle;
+}
+
+// Finds the node at `path` below `node` by walking the tree
+static i32 fdt_walk_path(const struct fdt* fdt, i32 node, const char* path) {
+    while (*path) {
+        if (*path == '/') {
+            path++;
+            continue;
+        }
+
+        u32 len = 0;
+        while (path[len] && path[len] != '/') {
+            len++;
+        }
+
+        // The unit address may be left out if the path has none
+        u32 has_unit = 0;
+        for (u32 i = 0; i < len; i++) {
+            has_unit |= (path[i] == '@');
+        }
+
+        i32 child = fdt_first_child(fdt, node);
+        while (child >= 0) {
+            const char* name = fdt_name(fdt, child);
+            if (mem_cmp(name, path, len) &&
+                (name[len] == 0 || (name[len] == '@' && !has_unit))) {
+                break;
+            }
+            child = fdt_next_sibling(fdt, child);
+        }
+        if (child < 0) {
+            return child;
+        }
+
+        node = child;
+        path += len;
+    }
+    return node;
+}
+
+// Walks the whole tree once and fills in the index. A tree with too many nodes leaves
+// the index unused
+static void fdt_index_build(struct fdt* fdt) {
+    struct fdt_index* index = fdt->index;
+    u32 current = FDT_NO_PARENT;
+
+    index->count = 0;
+    index->state = FDT_INDEX_FULL;
+    mem_set(index->by_path, 0, sizeof(index->by_path));
+    mem_set(index->by_phandle, 0, sizeof(index->by_phandle));
+
+    i32 offset = fdt_skip_nops(fdt, 0);
+    while (offset >= 0) {
+        u32 token = fdt_token(fdt, offset);
+
+        if (token == FDT_BEGIN_NODE) {
+            if (index->count == FDT_INDEX_NODES) {
+                return;
+            }
+            struct fdt_index_node* node = &index->nodes[index->count];
+            node->offset = offset;
+            node->parent = current;
+            node->phandle = 0;
+            node->hash = FNV_OFFSET;
+            if (current != FDT_NO_PARENT) {
+                const char* name = fdt_name(fdt, offset);
+                node->hash = fnv_update(index->nodes[current].hash, "/", 1);
+                node->hash = fnv_update(node->hash, name, str_len(name));
+            }
+            current = index->count++;
+        } else if (token == FDT_PROP) {
+            if (current != FDT_NO_PARENT && read_be32(fdt->structs + offset + 4) == 4 &&
+                (fdt_prop_is(fdt, offset, "phandle", 7) ||
+                fdt_prop_is(fdt, offset, "linux,phandle", 13))) {
+                index->nodes[current].phandle = read_be32(fdt->structs + offset + 12);
+            }
+        } else if (token == FDT_END_NODE) {
+            if (current == FDT_NO_PARENT) {
+                return;
+            }
+            current = index->nodes[current].parent;
+        } else if (token == FDT_END) {
+            break;
+        }
+        offset = fdt_next_token(fdt, offset);
+    }
+    if (offset < 0 || current != FDT_NO_PARENT) {
+        return;
+    }
+
+    // Open addressing with linear probing. There are twice as many slots as nodes
+    for (u32 i = 0; i < index->count; i++) {
+        u32 slot = index->nodes[i].hash;
+        while (index->by_path[slot % FDT_INDEX_SLOTS]) {
+            slot++;
+        }
+        index->by_path[slot % FDT_INDEX_SLOTS] = i + 1;
+
+        if (index->nodes[i].phandle) {
+            slot = phandle_slot(index->nodes[i].phandle);
+            while (index->by_phandle[slot % FDT_INDEX_SLOTS]) {
+                slot++;
+            }
+            index->by_phandle[slot % FDT_INDEX_SLOTS] = i + 1;
+        }
+    }
+    index->state = FDT_INDEX_READY;
+}
+
+static u32 fdt_index_ready(struct fdt* fdt) {
+    if (fdt->index == NULL) {
+        return 0;
+    }
+    if (fdt->index->state == FDT_INDEX_EMPTY) {
+        fdt_index_build(fdt);
+    }
+    return fdt->index->state == FDT_INDEX_READY;
+}
+
+// Checks that index node `i` really is at `path`, by comparing the names of all its
+// parents from the end of the path
+static u32 fdt_index_match(const struct fdt* fdt, u32 i, const char* path, u32 len) {
+    const struct fdt_index* index = fdt->index;
+
+    while (index->nodes[i].parent != FDT_NO_PARENT) {
+        const char* name = fdt_name(fdt, index->nodes[i].offset);
+        u32 name_len = str_len(name);
+        if (len < name_len + 1 || path[len - name_len - 1] != '/' ||
+            !mem_cmp(path + len - name_len, name, name_len)) {
+            return 0;
+        }
+        len -= name_len + 1;
+        i = index->nodes[i].parent;
+    }
+    return len == 0;
+}
+
+// Looks up a full path in the index. This returns -ERR_NOT_FOUND if the path is not in it
+static i32 fdt_index_path(const struct fdt* fdt, const char* path) {
+    const struct fdt_index* index = fdt->index;
+    u32 len = str_len(path);
+
+    if (len == 1) {
+        return index->nodes[0].offset;
+    }
+
+    u32 slot = fnv_update(FNV_OFFSET, path, len);
+    while (index->by_path[slot % FDT_INDEX_SLOTS]) {
+        u32 i = index->by_path[slot % FDT_INDEX_SLOTS] - 1;
+        if (fdt_index_match(fdt, i, path, len)) {
+            return index->nodes[i].offset;
+        }
+        slot++;
+    }
+    return -ERR_NOT_FOUND;
+}
+
+// Returns the node at `path`. A path not starting with a slash starts with an alias. A
+// path component without a unit address matches a node with one
+i32 fdt_path(struct fdt* fdt, const char* path) {
+    i32 root = fdt_skip_nops(fdt, 0);
+
+    if (*path != '/') {
+        u32 len = 0;
+        while (path[len] && path[len] != '/') {
+            len++;
+        }
+
+        // Look the alias up in /aliases. The name is not zero terminated in the path
+        i32 aliases = fdt_path(fdt, "/aliases");
+        i32 offset = (aliases < 0) ? -ERR_NOT_FOUND : fdt_next_token(fdt, aliases);
+        const char* target = NULL;
+        while (offset >= 0 && fdt_token(fdt, offset) != FDT_BEGIN_NODE &&
+            fdt_token(fdt, offset) != FDT_END_NODE) {
+            if (fdt_token(fdt, offset) == FDT_PROP && fdt_prop_is(fdt, offset, path, len)) {
+                target = (const char *)fdt->structs + offset + 12;
+                break;
+            }
+            offset = fdt_next_token(fdt, offset);
+        }
+        if (target == NULL || *target != '/') {
+            return -ERR_NOT_FOUND;
+        }
+
+        i32 node = fdt_path(fdt, target);
+        return (node < 0) ? node : fdt_walk_path(fdt, node, path + len);
+    }
+
+    if (fdt_index_ready(fdt)) {
+        i32 node = fdt_index_path(fdt, path);
+        if (node >= 0) {
+            return node;
+        }
+    }
+
+    // Paths without unit addresses or with extra slashes are not in the index
+    return fdt_walk_path(fdt, root, path);
+}
+
+// Returns the node with the given phandle
+i32 fdt_phandle(struct fdt* fdt, u32 phandle) {
+    if (phandle == 0 || phandle == 0xFFFFFFFF) {
+        return -ERR_NOT_FOUND;
+    }
+
+    if (fdt_index_ready(fdt)) {
+        const struct fdt_index* index = fdt->index;
+        u32 slot = phandle_slot(phandle);
+        while (index->by_phandle[slot % FDT_INDEX_SLOTS]) {
+            u32 i = index->by_phandle[slot % FDT_INDEX_SLOTS] - 1;
+            if (index->nodes[i].phandle == phandle) {
+                return index->nodes[i].offset;
+            }
+            slot++;
+        }
+        return -ERR_NOT_FOUND;
+    }
+
+    // Every node in the tree is checked in order
+    i32 offset = fdt_skip_nops(fdt, 0);
+    while (offset >= 0 && fdt_token(fdt, offset) != FDT_END) {
+        if (fdt_token(fdt, offset) == FDT_BEGIN_NODE && fdt_node_phandle(fdt, offset) == phandle) {
+            return offset;
+        }
+        offset = fdt_next_token(fdt, offset);
+    }
+    return -ERR_NOT_FOUND;
+}
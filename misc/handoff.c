@@ -0,0 +1,31 @@
+// Sealing and checking of the soft reboot handoff block
+
+#include <chaos/handoff.h>
+#include <chaos/crc32.h>
+#include <chaos/status.h>
+
+static u32 handoff_crc(const struct handoff* handoff) {
+    u32 crc = crc32_update(CRC32_INIT, handoff, __builtin_offsetof(struct handoff, crc));
+    crc = crc32_update(crc, "\0\0\0\0", 4);
+    crc = crc32_update(crc, &handoff->flags,
+        sizeof(struct handoff) - __builtin_offsetof(struct handoff, flags));
+    return ~crc;
+}
+
+// Fills in the header fields and the CRC. This must be the last write to the block
+void handoff_seal(struct handoff* handoff) {
+    handoff->magic = HANDOFF_MAGIC;
+    handoff->version = HANDOFF_VERSION;
+    handoff->size = sizeof(struct handoff);
+    handoff->crc = handoff_crc(handoff);
+}
+
+// Returns 0 if the block is intact and of this version. Anything else in r0 at boot,
+// such as the arguments from a bootloader, gives -ERR_CORRUPT
+i32 handoff_check(const struct handoff* handoff) {
+    if (handoff->magic != HANDOFF_MAGIC || handoff->version != HANDOFF_VERSION ||
+        handoff->size != sizeof(struct handoff) || handoff->crc != handoff_crc(handoff)) {
+        return -ERR_CORRUPT;
+    }
+    return 0;
+}
@@ -0,0 +1,79 @@
+// LZ4 block decompression. This is used by the decompressor stub of a compressed kernel
+// image, which runs before the kernel is in place. It must therefore be position
+// independent and may not use any global data or call any other kernel code
+
+#include <chaos/lz4.h>
+#include <chaos/status.h>
+
+// Reads the extra length bytes following a length field of 15. Returns 0 if the input
+// ends before the length does
+static inline u32 lz4_read_length(const u8** in, const u8* in_end, u32* len) {
+    u32 byte;
+    do {
+        if (*in >= in_end) {
+            return 0;
+        }
+        byte = *(*in)++;
+        *len += byte;
+    } while (byte == 255);
+    return 1;
+}
+
+// Decompresses the LZ4 block `src` into `dest`. Every length and offset is checked, so a
+// corrupt block never reads or writes outside the two buffers. This returns the number
+// of bytes written or -ERR_CORRUPT if the block is malformed or does not fit in `dest`
+i32 lz4_decompress(const u8* src, u32 src_size, u8* dest, u32 dest_size) {
+    const u8* in = src;
+    const u8* in_end = src + src_size;
+    u8* out = dest;
+    u8* out_end = dest + dest_size;
+
+    while (in < in_end) {
+        // The token holds the literal length in the upper nibble and the match length
+        // minus four in the lower nibble. A nibble of 15 continues in the next bytes
+        u32 token = *in++;
+
+        u32 len = token >> 4;
+        if (len == 15 && lz4_read_length(&in, in_end, &len) == 0) {
+            return -ERR_CORRUPT;
+        }
+        if (len > (u32)(in_end - in) || len > (u32)(out_end - out)) {
+            return -ERR_CORRUPT;
+        }
+        for (u32 i = 0; i < len; i++) {
+            *out++ = *in++;
+        }
+
+        // The last sequence only has literals
+        if (in == in_end) {
+            break;
+        }
+
+        if (in_end - in < 2) {
+            return -ERR_CORRUPT;
+        }
+        u32 offset = in[0] | (in[1] << 8);
+        in += 2;
+        if (offset == 0 || offset > (u32)(out - dest)) {
+            return -ERR_CORRUPT;
+        }
+
+        len = token & 0xF;
+        if (len == 15 && lz4_read_length(&in, in_end, &len) == 0) {
+            return -ERR_CORRUPT;
+        }
+        len += 4;
+        if (len > (u32)(out_end - out)) {
+            return -ERR_CORRUPT;
+        }
+
+        // The match may overlap the output it is copied to. This is how runs are encoded,
+        // so the copy must go forward one byte at a time
+        const u8* match = out - offset;
+        for (u32 i = 0; i < len; i++) {
+            *out++ = *match++;
+        }
+    }
+
+    return out - dest;
+}
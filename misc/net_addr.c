@@ -0,0 +1,151 @@
+// Conversion between network addresses and strings
+
+#include <chaos/net_addr.h>
+#include <chaos/status.h>
+
+// Hex lookup table for use in MAC address conversion
+static const char hex_lookup[] = "0123456789ABCDEF";
+
+// Converts a string into network IP representation. This returns 0 if success and
+// -ERR_NET if failure
+i32 string_to_ip(const char* str, u32* ip_addr) {
+    u32 ip = 0;
+    for (u32 i = 0; i < 4; i++) {
+        // We track the number of digits to reject empty segments and leading zeros
+        u32 num = 0;
+        u32 digits = 0;
+
+        while (*str >= '0' && *str <= '9') {
+            if (digits && num == 0) {
+                return -ERR_NET;
+            }
+            num = num * 10 + (*str++ - '0');
+            digits++;
+
+            if (num > 0xFF) {
+                return -ERR_NET;
+            }
+        }
+        
+        // Check the formatting
+        if (digits == 0 || (i == 3 && *str != '\0') || (i != 3 && *str != '.')) {
+            return -ERR_NET;
+        }
+
+        // Skip the . charcater
+        str++;
+
+        // Update the network IP variable
+        ip = (ip << 8) | (num & 0xFF);
+    }
+
+    *ip_addr = ip;
+    return 0;
+}
+
+// Converts a network IP address into a string. The string must be at least 16 
+// characters
+void ip_to_string(char* str, u32 addr) {
+    for (u32 i = 4; i --> 0;) {
+        // Get a new byte-segment of the IP address
+        u8 segment = (addr >> (i * 8)) & 0xFF;
+        u8 base = 100;
+
+        // Prevent any starting zeros
+        while (base > segment) {
+            base /= 10;
+        }
+
+        // The current segment is zero
+        if (base == 0) {
+            *str++ = '0';
+        }
+
+        // Print the number to the buffer
+        while (base) {
+            *str++ = (segment / base) + '0';
+            segment = segment % base;
+            base = base / 10;
+        }
+
+        // Add the delimiter
+        if (i) {
+            *str++ = '.';
+        }
+    }
+    *str = 0;
+}
+
+// Check is a given character is a hexadecimal character
+static inline u8 is_hex(char c) {
+    if ((c >= '0' && c <= '9') || (c >= 'A' && c <= 'F') || (c >= 'a' && c <= 'f')) {
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+// Converts a hexadecimal character to a number in range 0..15
+static inline u8 hex_to_num(char hex) {
+    if ((hex >= '0' && hex <= '9')) {
+        return hex - '0';
+    }
+
+    // Try to clear bit 5 to convert to uppercase
+    hex &= ~(1 << 5);
+
+    if ((hex >= 'A' && hex <= 'F')) {
+        return hex - 'A' + 10;
+    }
+
+    return 0;
+}
+
+// Converts a string into a network MAC address. This returns 0 if success and -ERR_NET if
+// failure
+i32 string_to_mac(const char* str, u8* mac) {
+    for (u32 i = 0; i < 6; i++) {
+        // We use two variables for tracking if the segment has right format
+        u32 num = 0;
+        u32 index = 2;
+
+        while (is_hex(*str)) {
+            num = num * 16 + hex_to_num(*str++);
+
+            if (num > 0xFF || !index--) {
+                return -ERR_NET;
+            }
+        }
+        
+        // Check the formatting
+        if ((i == 5 && *str != '\0') || (i != 5 && *str != ':')) {
+            return -ERR_NET;
+        }
+
+        // Skip the . charcater
+        str++;
+
+        // Update the network IP variable
+        *mac++ = (u8)num;
+    }
+    return 0;
+}
+
+// Converts a network MAC address into a string. The string must be at least 18 
+// characters
+void mac_to_string(char* str, u8* mac, u8 lowercase) {
+    u8 lower = (lowercase) ? (1 << 5) : 0;
+    for (u32 i = 6; i --> 0;) {
+        // Get a new byte-segment of the IP address
+        u8 segment = *mac++;
+
+        *str++ = hex_lookup[(segment >> 4) & 0xF] | lower;        
+        *str++ = hex_lookup[(segment >> 0) & 0xF] | lower;        
+
+        // Add the delimiter
+        if (i) {
+            *str++ = ':';
+        }
+    }
+    *str = 0;
+}
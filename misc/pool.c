@@ -0,0 +1,178 @@
+// Object pool with per-core magazines and a lock-free depot
+
+#include <chaos/pool.h>
+#include <chaos/irq.h>
+
+// Pops a magazine from a depot stack. Returns NULL if the stack is empty
+static struct pool_magazine* pool_pop(struct pool* pool, u64* stack) {
+    u64 head = __atomic_load_n(stack, __ATOMIC_ACQUIRE);
+    while (1) {
+        u32 index = (u32)head;
+        if (index == 0) {
+            return NULL;
+        }
+
+        struct pool_magazine* mag = &pool->mags[index - 1];
+        u64 next = __atomic_load_n(&mag->next, __ATOMIC_RELAXED);
+        next |= ((head >> 32) + 1) << 32;
+        if (__atomic_compare_exchange_n(stack, &head, next, 1, __ATOMIC_ACQUIRE,
+            __ATOMIC_ACQUIRE)) {
+            return mag;
+        }
+    }
+}
+
+static void pool_push(struct pool* pool, u64* stack, struct pool_magazine* mag) {
+    u64 index = mag - pool->mags + 1;
+    u64 head = __atomic_load_n(stack, __ATOMIC_RELAXED);
+    u64 next;
+    do {
+        __atomic_store_n(&mag->next, (u32)head, __ATOMIC_RELAXED);
+        next = (((head >> 32) + 1) << 32) | index;
+    } while (!__atomic_compare_exchange_n(stack, &head, next, 1, __ATOMIC_RELEASE,
+        __ATOMIC_RELAXED));
+}
+
+// Returns the number of objects in use. The counters of the other cores are read while
+// they change, so this is exact on one core and close on several. A free counted before
+// the matching allocation could make the sum negative for a moment
+static u32 pool_in_use(struct pool* pool) {
+    i32 in_use = 0;
+    for (u32 i = 0; i < SMP_MAX_CPUS; i++) {
+        struct pool_cpu* cpu = &per_cpu(*pool->cpu, i);
+        in_use += (i32)(cpu->allocs - cpu->frees);
+    }
+    if (in_use < 0) {
+        return 0;
+    }
+    return ((u32)in_use > pool->total) ? pool->total : (u32)in_use;
+}
+
+static void pool_update_watermark(struct pool* pool) {
+    u32 in_use = pool_in_use(pool);
+    if (in_use > pool->high_watermark) {
+        pool->high_watermark = in_use;
+    }
+}
+
+void pool_init(struct pool* pool, struct pool_cpu* cpu, struct pool_magazine* mags,
+    u32 mag_count) {
+    pool->cpu = cpu;
+    pool->mags = mags;
+    pool->mag_count = mag_count;
+    pool->total = 0;
+    pool->high_watermark = 0;
+    pool->full = 0;
+    pool->empty = 0;
+
+    // Each core starts with two empty magazines. The rest go to the depot
+    u32 next = 0;
+    for (u32 i = 0; i < SMP_MAX_CPUS; i++) {
+        struct pool_cpu* state = &per_cpu(*cpu, i);
+        state->loaded = &mags[next++];
+        state->prev = &mags[next++];
+        state->loaded->count = 0;
+        state->prev->count = 0;
+        state->allocs = 0;
+        state->frees = 0;
+        state->fails = 0;
+    }
+    while (next < mag_count) {
+        mags[next].count = 0;
+        pool_push(pool, &pool->empty, &mags[next++]);
+    }
+}
+
+// Puts an object in a magazine of this core. When both are full, the previous one goes to
+// the depot. POOL_MAGAZINES leaves enough magazines for the depot to always have an empty
+// one
+static void pool_put(struct pool* pool, struct pool_cpu* cpu, void* obj) {
+    struct pool_magazine* mag = cpu->loaded;
+
+    if (mag->count == POOL_MAGAZINE_SIZE) {
+        if (cpu->prev->count < POOL_MAGAZINE_SIZE) {
+            cpu->loaded = cpu->prev;
+            cpu->prev = mag;
+        } else {
+            pool_push(pool, &pool->full, cpu->prev);
+            cpu->prev = mag;
+            cpu->loaded = pool_pop(pool, &pool->empty);
+        }
+        mag = cpu->loaded;
+    }
+    mag->objs[mag->count++] = obj;
+}
+
+// Adds an object to the pool. This is only used while the pool is set up
+void pool_add(struct pool* pool, void* obj) {
+    u32 flags = irq_local_save();
+    pool_put(pool, &this_cpu(*pool->cpu), obj);
+    pool->total++;
+    irq_local_restore(flags);
+}
+
+// The magazines of a core are only changed with IRQs masked, so an interrupt handler on
+// the same core never sees a magazine half way through an update
+void* pool_alloc(struct pool* pool) {
+    u32 flags = irq_local_save();
+    struct pool_cpu* cpu = &this_cpu(*pool->cpu);
+    struct pool_magazine* mag = cpu->loaded;
+
+    if (mag->count == 0) {
+        if (cpu->prev->count) {
+            cpu->loaded = cpu->prev;
+            cpu->prev = mag;
+        } else {
+            // Trade the empty previous magazine for a full one from the depot
+            struct pool_magazine* full = pool_pop(pool, &pool->full);
+            if (full == NULL) {
+                cpu->fails++;
+                irq_local_restore(flags);
+                return NULL;
+            }
+            pool_push(pool, &pool->empty, cpu->prev);
+            cpu->prev = mag;
+            cpu->loaded = full;
+            pool_update_watermark(pool);
+        }
+        mag = cpu->loaded;
+    }
+
+    cpu->allocs++;
+
+    // With one core the counters of this core are the totals, so the watermark is exact.
+    // Otherwise it is only updated when a core goes to the depot
+    if (SMP_MAX_CPUS == 1 && cpu->allocs - cpu->frees > pool->high_watermark) {
+        pool->high_watermark = cpu->allocs - cpu->frees;
+    }
+
+    void* obj = mag->objs[--mag->count];
+    irq_local_restore(flags);
+    return obj;
+}
+
+void pool_free(struct pool* pool, void* obj) {
+    u32 flags = irq_local_save();
+    struct pool_cpu* cpu = &this_cpu(*pool->cpu);
+    pool_put(pool, cpu, obj);
+    cpu->frees++;
+    irq_local_restore(flags);
+}
+
+void pool_get_stats(struct pool* pool, struct pool_stats* stats) {
+    pool_update_watermark(pool);
+
+    stats->total = pool->total;
+    stats->in_use = pool_in_use(pool);
+    stats->high_watermark = pool->high_watermark;
+    stats->allocs = 0;
+    stats->frees = 0;
+    stats->fails = 0;
+
+    for (u32 i = 0; i < SMP_MAX_CPUS; i++) {
+        struct pool_cpu* cpu = &per_cpu(*pool->cpu, i);
+        stats->allocs += cpu->allocs;
+        stats->frees += cpu->frees;
+        stats->fails += cpu->fails;
+    }
+}
@@ -0,0 +1,108 @@
+# Copyright (C) strawberryhacker
+
+import argparse
+import re
+import struct
+import sys
+import zlib
+
+# Builds a segmented boot image from the kernel ELF file. Only the bytes the kernel needs
+# are sent. Long runs of zeros are left out and zero filled by the receiver. The format
+# is described in doc/boot-image.md and must match include/chaos/boot_image.h
+
+BOOT_IMAGE_MAGIC   = 0x4D494243
+BOOT_IMAGE_VERSION = 1
+MAX_SEGMENTS       = 32
+
+PT_LOAD = 1
+
+HEADER_FORMAT  = "<6I"
+SEGMENT_FORMAT = "<4I"
+
+# A zero run shorter than this costs more in the segment table than it saves
+MIN_ZERO_RUN = 64
+
+# Returns the entry point and the loaded segments as (paddr, vaddr, data, flags). The
+# part of a segment beyond its file size is .bss, which the kernel zeroes itself
+def read_elf(path):
+    with open(path, "rb") as f:
+        elf = f.read()
+
+    if elf[:4] != b"\x7fELF" or elf[4] != 1 or elf[5] != 1:
+        print("{} is not a little endian ELF32 file".format(path))
+        sys.exit(1)
+
+    entry, phoff = struct.unpack_from("<II", elf, 0x18)
+    phentsize, phnum = struct.unpack_from("<HH", elf, 0x2A)
+
+    segments = []
+    for i in range(phnum):
+        p_type, offset, vaddr, paddr, filesz, memsz, flags, _ = struct.unpack_from(
+            "<8I", elf, phoff + i * phentsize)
+        if p_type == PT_LOAD and filesz:
+            segments.append((paddr, vaddr, elf[offset:offset + filesz], flags))
+
+    return entry, sorted(segments)
+
+# Splits the segments on the longest zero runs, given as (addr, data, mem_size, flags)
+def split_segments(segments):
+    runs = []
+    for index, (paddr, _, data, _) in enumerate(segments):
+        for match in re.finditer(b"\x00{%d,}" % MIN_ZERO_RUN, data):
+            runs.append((match.end() - match.start(), index, match.start(), match.end()))
+
+    runs.sort(reverse=True)
+    runs = runs[:MAX_SEGMENTS - len(segments)]
+
+    result = []
+    for index, (paddr, _, data, flags) in enumerate(segments):
+        cuts = sorted((start, end) for _, i, start, end in runs if i == index)
+        pos = 0
+        for start, end in cuts:
+            result.append((paddr + pos, data[pos:start], end - pos, flags))
+            pos = end
+        if pos < len(data):
+            result.append((paddr + pos, data[pos:], len(data) - pos, flags))
+    return result
+
+def main():
+    parser = argparse.ArgumentParser(description="Builds a segmented boot image")
+    parser.add_argument("elf", help="kernel ELF file")
+    parser.add_argument("output", help="boot image")
+    args = parser.parse_args()
+
+    entry, segments = read_elf(args.elf)
+    if not segments or len(segments) > MAX_SEGMENTS:
+        print("Unsupported number of segments")
+        sys.exit(1)
+
+    # The entry point is a virtual address. The receiver needs the physical one
+    entry_phys = None
+    for paddr, vaddr, data, _ in segments:
+        if vaddr <= entry < vaddr + len(data):
+            entry_phys = paddr + entry - vaddr
+    if entry_phys is None:
+        print("The entry point is not in any segment")
+        sys.exit(1)
+
+    segments = split_segments(segments)
+    load_addr = min(segment[0] for segment in segments)
+
+    table = b"".join(struct.pack(SEGMENT_FORMAT, addr, len(data), mem_size, flags)
+        for addr, data, mem_size, flags in segments)
+    payload = b"".join(segment[1] for segment in segments)
+
+    header = struct.pack(HEADER_FORMAT, BOOT_IMAGE_MAGIC, BOOT_IMAGE_VERSION,
+        len(segments), load_addr, entry_phys, 0)
+    crc = zlib.crc32(header + table + payload) & 0xFFFFFFFF
+    header = header[:-4] + struct.pack("<I", crc)
+
+    with open(args.output, "wb") as f:
+        f.write(header + table + payload)
+
+    span = max(addr + mem_size for addr, _, mem_size, _ in segments) - load_addr
+    size = len(header) + len(table) + len(payload)
+    print("Boot image has {} segments and sends {} of {} bytes".format(len(segments),
+        size, span))
+
+main()
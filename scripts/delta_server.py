@@ -0,0 +1,174 @@
+# Copyright (C) strawberryhacker
+
+import argparse
+import os
+import socket
+import struct
+import sys
+import zlib
+
+# Serves delta soft reboots. The running kernel sends the block hashes of its own image
+# and then reads the delta file over TFTP from this server. The delta file holds only the
+# blocks of the new image that differ. The formats must match include/chaos/delta.h
+
+DELTA_MAGIC      = 0x544C4443
+DELTA_VERSION    = 1
+DELTA_BLOCK_SIZE = 1024
+
+HASHES_FORMAT = "<6I"
+HEADER_FORMAT = "<7I"
+
+TFTP_READ  = 1
+TFTP_DATA  = 3
+TFTP_ACK   = 4
+TFTP_ERROR = 5
+TFTP_OACK  = 6
+
+PT_LOAD = 1
+
+# Returns the kernel image in the same layout as objcopy -O binary, which is what the
+# kernel relocates and what the running kernel hashes
+def load_image(path):
+    with open(path, "rb") as f:
+        elf = f.read()
+
+    phoff = struct.unpack_from("<I", elf, 0x1C)[0]
+    phentsize, phnum = struct.unpack_from("<HH", elf, 0x2A)
+
+    segments = []
+    for i in range(phnum):
+        p_type, offset, _, paddr, filesz, _, _, _ = struct.unpack_from("<8I", elf,
+            phoff + i * phentsize)
+        if p_type == PT_LOAD and filesz:
+            segments.append((paddr, elf[offset:offset + filesz]))
+
+    start = min(paddr for paddr, _ in segments)
+    end = max(paddr + len(data) for paddr, data in segments)
+    image = bytearray(end - start)
+    for paddr, data in segments:
+        image[paddr - start:paddr - start + len(data)] = data
+    return bytes(image)
+
+# Builds the delta file from the hashes of the running image
+def build_delta(image, base_size, hashes):
+    blocks = []
+    for offset in range(0, len(image), DELTA_BLOCK_SIZE):
+        data = image[offset:offset + DELTA_BLOCK_SIZE]
+        index = offset // DELTA_BLOCK_SIZE
+
+        # Only full blocks inside the hashed part of the running image can be reused
+        if offset + DELTA_BLOCK_SIZE <= base_size and len(data) == DELTA_BLOCK_SIZE and \
+            zlib.crc32(data) & 0xFFFFFFFF == hashes[index]:
+            continue
+        blocks.append(struct.pack("<I", offset) + data)
+
+    header = struct.pack(HEADER_FORMAT, DELTA_MAGIC, DELTA_VERSION, DELTA_BLOCK_SIZE,
+        base_size, len(image), len(blocks), zlib.crc32(image) & 0xFFFFFFFF)
+    return header + b"".join(blocks), len(blocks)
+
+def send_error(sock, addr, message):
+    sock.sendto(struct.pack("!HH", TFTP_ERROR, 1) + message.encode() + b"\0", addr)
+
+# Sends `data` to the client with plain lock step TFTP. Returns True on success
+def tftp_send(addr, data, options, timeout, retries):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(("", 0))
+    sock.settimeout(timeout)
+    block_size = int(options.get("blksize", 512))
+
+    # Sends a packet until the client ACKs `block`
+    def send(packet, block):
+        for _ in range(retries):
+            sock.sendto(packet, addr)
+            try:
+                while True:
+                    reply, source = sock.recvfrom(1500)
+                    if source != addr or len(reply) < 4:
+                        continue
+                    opcode, number = struct.unpack_from("!HH", reply)
+                    if opcode == TFTP_ACK and number == block:
+                        return True
+                    if opcode == TFTP_ERROR:
+                        return False
+            except socket.timeout:
+                pass
+        return False
+
+    try:
+        if "blksize" in options:
+            oack = struct.pack("!H", TFTP_OACK) + b"blksize\0" + \
+                str(block_size).encode() + b"\0"
+            if not send(oack, 0):
+                return False
+
+        # A file of whole blocks ends with an empty block
+        block = 1
+        for offset in range(0, len(data) + 1, block_size):
+            chunk = data[offset:offset + block_size]
+            packet = struct.pack("!HH", TFTP_DATA, block & 0xFFFF) + chunk
+            if not send(packet, block & 0xFFFF):
+                return False
+            block += 1
+        return True
+    finally:
+        sock.close()
+
+def parse_request(packet):
+    fields = packet[2:].split(b"\0")
+    options = {}
+    for i in range(2, len(fields) - 1, 2):
+        options[fields[i].decode().lower()] = fields[i + 1].decode()
+    return fields[0].decode(), options
+
+def main():
+    parser = argparse.ArgumentParser(description="Delta soft reboot server")
+    parser.add_argument("--elf", required=True, help="kernel ELF file to serve")
+    parser.add_argument("--port", type=int, default=6970)
+    parser.add_argument("--timeout", type=float, default=0.5, help="seconds per retry")
+    parser.add_argument("--retries", type=int, default=10)
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(("", args.port))
+    print("Serving delta reboots of {} on port {}".format(args.elf, args.port))
+
+    # Hashes of each client, given as (base_size, list of hashes)
+    clients = {}
+
+    while True:
+        packet, addr = sock.recvfrom(65536)
+
+        if len(packet) >= struct.calcsize(HASHES_FORMAT) and \
+            struct.unpack_from("<I", packet)[0] == DELTA_MAGIC:
+            _, version, block_size, base_size, first, count = struct.unpack_from(
+                HASHES_FORMAT, packet)
+            if version != DELTA_VERSION or block_size != DELTA_BLOCK_SIZE:
+                continue
+
+            blocks = base_size // DELTA_BLOCK_SIZE
+            if addr not in clients or clients[addr][0] != base_size:
+                clients[addr] = (base_size, [None] * blocks)
+            hashes = struct.unpack_from("<{}I".format(count), packet,
+                struct.calcsize(HASHES_FORMAT))
+            clients[addr][1][first:first + count] = hashes
+
+        elif len(packet) >= 4 and struct.unpack_from("!H", packet)[0] == TFTP_READ:
+            name, options = parse_request(packet)
+            client = clients.pop(addr, None)
+            if client is None or None in client[1]:
+                send_error(sock, addr, "missing block hashes")
+                print("Request from {} without all block hashes".format(addr[0]))
+                continue
+
+            # The image is read for each request so that a rebuild is picked up
+            image = load_image(args.elf)
+            delta, changed = build_delta(image, client[0], client[1])
+            total = (len(image) + DELTA_BLOCK_SIZE - 1) // DELTA_BLOCK_SIZE
+            print("Sending {} of {} blocks ({} bytes) to {}".format(changed, total,
+                len(delta), addr[0]))
+
+            if not tftp_send(addr, delta, options, args.timeout, args.retries):
+                print("Transfer to {} failed".format(addr[0]))
+
+main()
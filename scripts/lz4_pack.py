@@ -0,0 +1,144 @@
+# Copyright (C) strawberryhacker
+
+import argparse
+import struct
+import sys
+
+# Builds a compressed kernel image. The image is the decompressor stub, followed by the
+# image header and the kernel binary compressed as a single LZ4 block. The header must
+# match struct lz4_image_header in include/chaos/lz4.h
+
+LZ4_IMAGE_MAGIC = 0x345A4C43
+
+# Limits given by the LZ4 block format
+MIN_MATCH     = 4
+LAST_LITERALS = 5
+MF_LIMIT      = 12
+MAX_OFFSET    = 65535
+
+def write_length(out, length):
+    while length >= 255:
+        out.append(255)
+        length -= 255
+    out.append(length)
+
+def write_sequence(out, literals, offset, match_len):
+    lit_len = len(literals)
+    token = min(lit_len, 15) << 4
+    if offset:
+        token |= min(match_len - MIN_MATCH, 15)
+    out.append(token)
+    if lit_len >= 15:
+        write_length(out, lit_len - 15)
+    out += literals
+    if offset:
+        out += struct.pack("<H", offset)
+        if match_len - MIN_MATCH >= 15:
+            write_length(out, match_len - MIN_MATCH - 15)
+
+# Greedy compressor with a single entry hash table. This gets close to the reference
+# implementation at its fastest level, which is plenty for a kernel image
+def compress(data):
+    out = bytearray()
+    size = len(data)
+    table = {}
+    anchor = 0
+    pos = 0
+    match_end = size - LAST_LITERALS
+
+    while pos + MF_LIMIT <= size:
+        key = data[pos:pos + MIN_MATCH]
+        candidate = table.get(key)
+        table[key] = pos
+
+        if candidate is None or pos - candidate > MAX_OFFSET:
+            pos += 1
+            continue
+
+        # Extend the match forwards, but keep the last bytes as literals
+        length = MIN_MATCH
+        while pos + length < match_end and data[candidate + length] == data[pos + length]:
+            length += 1
+
+        # And backwards into the pending literals
+        while pos > anchor and candidate > 0 and data[candidate - 1] == data[pos - 1]:
+            pos -= 1
+            candidate -= 1
+            length += 1
+
+        write_sequence(out, data[anchor:pos], pos - candidate, length)
+        pos += length
+        anchor = pos
+
+    write_sequence(out, data[anchor:], 0, 0)
+    return bytes(out)
+
+# Reference decoder used to check the output before it is shipped
+def decompress(block):
+    out = bytearray()
+    pos = 0
+    while pos < len(block):
+        token = block[pos]
+        pos += 1
+        length = token >> 4
+        if length == 15:
+            while True:
+                byte = block[pos]
+                pos += 1
+                length += byte
+                if byte != 255:
+                    break
+        out += block[pos:pos + length]
+        pos += length
+        if pos == len(block):
+            break
+
+        offset = struct.unpack_from("<H", block, pos)[0]
+        pos += 2
+        length = token & 0xF
+        if length == 15:
+            while True:
+                byte = block[pos]
+                pos += 1
+                length += byte
+                if byte != 255:
+                    break
+        length += MIN_MATCH
+        for _ in range(length):
+            out.append(out[-offset])
+    return bytes(out)
+
+def main():
+    parser = argparse.ArgumentParser(description="Builds an LZ4 compressed kernel image")
+    parser.add_argument("stub", help="decompressor stub binary")
+    parser.add_argument("kernel", help="raw kernel binary")
+    parser.add_argument("output", help="compressed image")
+    parser.add_argument("--dest", required=True, help="physical address of the kernel")
+    parser.add_argument("--ddr-size", required=True, help="size of the DDR at dest")
+    args = parser.parse_args()
+
+    with open(args.stub, "rb") as f:
+        stub = f.read()
+    with open(args.kernel, "rb") as f:
+        kernel = f.read()
+
+    if len(stub) % 4:
+        print("The stub size must be a multiple of four")
+        sys.exit(1)
+
+    payload = compress(kernel)
+    if decompress(payload) != kernel:
+        print("LZ4 round trip failed")
+        sys.exit(1)
+
+    header = struct.pack("<5I", LZ4_IMAGE_MAGIC, int(args.dest, 0), len(kernel),
+        len(payload), int(args.ddr_size, 0))
+
+    with open(args.output, "wb") as f:
+        f.write(stub + header + payload)
+
+    image_size = len(stub) + len(header) + len(payload)
+    print("Compressed {} to {} bytes ({:.1f}%)".format(len(kernel), image_size,
+        100.0 * image_size / len(kernel)))
+
+main()
@@ -0,0 +1,68 @@
+# Copyright (C) strawberryhacker
+
+import argparse
+import json
+import re
+import subprocess
+import sys
+import time
+
+# Boots the kernel in QEMU xilinx-zynq-a9 and collects the result of the NIC loopback
+# benchmark from the serial log. The emulated GEM is driven by the SAMA5D2 NIC driver
+
+RESULT = re.compile(r"NIC benchmark: (\d+) ms, (\d+) packets/s, (\d+) kbit/s")
+COUNTS = re.compile(r"NIC benchmark: sent (\d+) received (\d+) lost (\d+) corrupt (\d+)")
+DONE   = re.compile(r"NIC benchmark done")
+
+def main():
+    parser = argparse.ArgumentParser(description="QEMU NIC loopback benchmark")
+    parser.add_argument("--elf", required=True, help="kernel ELF file")
+    parser.add_argument("--timeout", type=float, default=120.0, help="seconds")
+    parser.add_argument("--qemu", default="qemu-system-arm")
+    parser.add_argument("--output", help="JSON results file")
+    parser.add_argument("--echo", action="store_true", help="print the serial log")
+    args = parser.parse_args()
+
+    cmd = [args.qemu, "-M", "xilinx-zynq-a9", "-m", "512M", "-nographic",
+        "-monitor", "none", "-kernel", args.elf,
+        "-netdev", "user,id=net0", "-net", "nic,netdev=net0"]
+    proc = subprocess.Popen(cmd, stdin=subprocess.DEVNULL, stdout=subprocess.PIPE,
+        stderr=subprocess.STDOUT)
+
+    results = {}
+    deadline = time.monotonic() + args.timeout
+    for raw in iter(proc.stdout.readline, b""):
+        line = raw.decode(errors="replace").rstrip()
+        if args.echo:
+            print(line)
+
+        match = COUNTS.search(line)
+        if match:
+            results.update(zip(["sent", "received", "lost", "corrupt"],
+                map(int, match.groups())))
+        match = RESULT.search(line)
+        if match:
+            results.update(zip(["elapsed_ms", "packets_per_s", "kbit_per_s"],
+                map(int, match.groups())))
+        if DONE.search(line) or time.monotonic() > deadline:
+            break
+
+    proc.terminate()
+    try:
+        proc.wait(timeout=5)
+    except subprocess.TimeoutExpired:
+        proc.kill()
+
+    if "packets_per_s" not in results:
+        print("No benchmark result seen. Check the serial output with --echo")
+        sys.exit(1)
+
+    print("{} packets/s, {} kbit/s ({} of {} frames received)".format(
+        results["packets_per_s"], results["kbit_per_s"], results["received"],
+        results["sent"]))
+
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(results, f, indent=4)
+
+main()
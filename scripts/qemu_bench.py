@@ -0,0 +1,265 @@
+# Copyright (C) strawberryhacker
+
+import argparse
+import json
+import os
+import re
+import socket
+import subprocess
+import sys
+import threading
+import time
+
+# Boots the kernel in QEMU and measures the boot phases from the serial log. Each line
+# from the serial port is timestamped on arrival. A phase is the time between two
+# markers. In soft mode one QEMU session performs N soft reboots over the built-in TFTP
+# server. In cold mode QEMU is restarted for each boot
+#
+# Soft reboots need a working NIC, so soft mode only runs on xilinx-zynq-a9, where the
+# GEM is driven by the SAMA5D2 NIC driver. The H3 NIC driver of orangepi-pc is a stub.
+# The Zynq kernel prefetches the next kernel, and the benchmark sends the switch command
+# once it is ready. With --delta-port the delta server is started as well
+
+MACHINES = ["orangepi-pc", "xilinx-zynq-a9"]
+
+# Must match TFTP_SWITCH_COMMAND in drivers/tftp.c
+SWITCH_COMMAND = b"switch"
+
+# Markers printed by the kernel in boot order
+MARKERS = [
+    ("banner",      re.compile(r"Starting chaos kernel")),
+    ("net_start",   re.compile(r"Starting TFTP/IP soft reboot stack")),
+    ("net_ready",   re.compile(r"TFTP stack ready")),
+    ("image_ready", re.compile(r"Next kernel is ready")),
+    ("image_done",  re.compile(r"Starting new kernel at")),
+]
+
+# Printed once per staged image, telling whether the delta server was used
+DELTA_DONE   = re.compile(r"Delta reboot received (\d+) bytes for a (\d+) byte image")
+DELTA_FAILED = re.compile(r"Delta reboot failed")
+
+# Phases reported, given as (name, from marker, to marker)
+PHASES = [
+    ("early_init", "banner",     "net_start"),
+    ("nic_init",   "net_start",  "net_ready"),
+    ("transfer",   "net_ready",  "image_ready"),
+    ("handover",   "image_done", "banner"),
+]
+
+class serial_log:
+    def __init__(self, proc, echo):
+        self.lines = []
+        self.cond = threading.Condition()
+        self.echo = echo
+        self.proc = proc
+        self.thread = threading.Thread(target=self.reader, daemon=True)
+        self.thread.start()
+
+    def reader(self):
+        for raw in iter(self.proc.stdout.readline, b""):
+            stamp = time.monotonic()
+            line = raw.decode(errors="replace").rstrip()
+            if self.echo:
+                print(line)
+            with self.cond:
+                self.lines.append((stamp, line))
+                self.cond.notify_all()
+
+    # Waits for the next line matching `regex` after line index `start`
+    def wait_for(self, regex, start, timeout):
+        deadline = time.monotonic() + timeout
+        with self.cond:
+            while True:
+                for i in range(start, len(self.lines)):
+                    if regex.search(self.lines[i][1]):
+                        return i
+                remaining = deadline - time.monotonic()
+                if remaining <= 0:
+                    return None
+                self.cond.wait(remaining)
+
+def start_qemu(args):
+    netdev = "user,id=net0,tftp=" + args.tftp_dir
+    if args.machine == "orangepi-pc":
+        cmd = [args.qemu, "-M", "orangepi-pc", "-smp", str(args.smp)]
+    else:
+        # The switch command reaches the kernel through a forwarded host port
+        cmd = [args.qemu, "-M", "xilinx-zynq-a9", "-m", "512M"]
+        netdev += ",hostfwd=udp:127.0.0.1:{0}-:{0}".format(args.control_port)
+
+    cmd += ["-nographic", "-monitor", "none", "-kernel", args.elf,
+        "-netdev", netdev, "-net", "nic,netdev=net0"]
+    return subprocess.Popen(cmd, stdin=subprocess.DEVNULL, stdout=subprocess.PIPE,
+        stderr=subprocess.STDOUT)
+
+def start_delta_server(args):
+    script = os.path.join(os.path.dirname(os.path.abspath(__file__)), "delta_server.py")
+    cmd = [sys.executable, "-B", script, "--elf", args.elf, "--port",
+        str(args.delta_port)]
+    return subprocess.Popen(cmd, stdin=subprocess.DEVNULL, stdout=subprocess.DEVNULL,
+        stderr=subprocess.STDOUT)
+
+def send_switch(args):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.sendto(SWITCH_COMMAND, ("127.0.0.1", args.control_port))
+    sock.close()
+
+def stop_qemu(proc):
+    proc.terminate()
+    try:
+        proc.wait(timeout=5)
+    except subprocess.TimeoutExpired:
+        proc.kill()
+
+# Follows the markers in order and returns a list of boots. Each boot maps a marker name
+# to its timestamp. Missing markers end the run. `actions` maps a marker name to a
+# function called when the marker is seen
+def collect_boots(log, markers, boots_wanted, timeout, start_time, actions={}):
+    boots = []
+    index = 0
+    boot = { "qemu_start": start_time }
+
+    while len(boots) < boots_wanted:
+        for name, regex in markers:
+            found = log.wait_for(regex, index, timeout)
+            if found is None:
+                if len(boot) > 1:
+                    boots.append(boot)
+                return boots
+            boot[name] = log.lines[found][0]
+            index = found + 1
+            if name in actions:
+                actions[name]()
+
+        # The banner of the next kernel ends the handover phase of this one
+        boots.append(boot)
+        boot = {}
+
+    return boots
+
+def percentile(values, p):
+    values = sorted(values)
+    index = min(len(values) - 1, int(round(p / 100.0 * (len(values) - 1))))
+    return values[index]
+
+def main():
+    parser = argparse.ArgumentParser(description="QEMU boot benchmark")
+    parser.add_argument("--elf", required=True, help="kernel ELF file")
+    parser.add_argument("--tftp-dir", required=True, help="directory served by QEMU TFTP")
+    parser.add_argument("--runs", type=int, default=10, help="number of boots")
+    parser.add_argument("--mode", choices=["soft", "cold"], default="soft")
+    parser.add_argument("--machine", choices=MACHINES, default="xilinx-zynq-a9")
+    parser.add_argument("--control-port", type=int, default=6971,
+        help="UDP port of the switch command")
+    parser.add_argument("--delta-port", type=int,
+        help="start the delta server on this port")
+    parser.add_argument("--expect-delta", action="store_true",
+        help="fail unless every soft reboot used the delta server")
+    parser.add_argument("--timeout", type=float, default=20.0, help="seconds per marker")
+    parser.add_argument("--qemu", default="qemu-system-arm")
+    parser.add_argument("--smp", type=int, default=4, help="number of cores")
+    parser.add_argument("--output", help="JSON results file")
+    parser.add_argument("--echo", action="store_true", help="print the serial log")
+    args = parser.parse_args()
+
+    if args.mode == "soft" and args.machine == "orangepi-pc":
+        print("Soft reboots need a working NIC. The H3 NIC driver is a stub, so use "
+            "--machine xilinx-zynq-a9 or --mode cold")
+        sys.exit(1)
+
+    delta_server = None
+    if args.delta_port:
+        delta_server = start_delta_server(args)
+
+    boots = []
+    log = None
+    if args.mode == "soft":
+        proc = start_qemu(args)
+        log = serial_log(proc, args.echo)
+        boots = collect_boots(log, MARKERS, args.runs + 1, args.timeout,
+            time.monotonic(), { "image_ready": lambda: send_switch(args) })
+        stop_qemu(proc)
+    else:
+        for run in range(args.runs):
+            start = time.monotonic()
+            proc = start_qemu(args)
+            log = serial_log(proc, args.echo)
+            # Stop before the image download so that each run is a plain cold boot
+            boots += collect_boots(log, MARKERS[:3], 1, args.timeout, start)
+            stop_qemu(proc)
+
+    if delta_server:
+        stop_qemu(delta_server)
+
+    if not boots:
+        print("No kernel banner seen. Check the ELF and the serial output with --echo")
+        sys.exit(1)
+
+    # Cold boot is QEMU start to the first banner of each session
+    samples = { "cold_boot": [] }
+    for name, _, _ in PHASES:
+        samples[name] = []
+
+    for i, boot in enumerate(boots):
+        if "qemu_start" in boot and "banner" in boot:
+            samples["cold_boot"].append(boot["banner"] - boot["qemu_start"])
+        for name, first, last in PHASES:
+            end = boot
+            if last == "banner":
+                # The handover ends with the banner of the next kernel
+                if i + 1 >= len(boots):
+                    continue
+                end = boots[i + 1]
+            if first in boot and last in end:
+                samples[name].append(end[last] - boot[first])
+
+    results = []
+    print("{:<12} {:>6} {:>12} {:>12}".format("phase", "count", "median ms", "p99 ms"))
+    for name in ["cold_boot"] + [phase[0] for phase in PHASES]:
+        values = samples[name]
+        if not values:
+            print("{:<12} {:>6} {:>12} {:>12}".format(name, 0, "-", "-"))
+            continue
+        median = percentile(values, 50) * 1000
+        p99 = percentile(values, 99) * 1000
+        print("{:<12} {:>6} {:>12.2f} {:>12.2f}".format(name, len(values), median, p99))
+        results.append({ "phase": name, "count": len(values), "median_ms": median,
+            "p99_ms": p99 })
+
+    soft_reboots = len(samples["handover"])
+    failed = False
+    if args.mode == "soft" and soft_reboots < args.runs:
+        print("Only {} of {} soft reboots completed".format(soft_reboots, args.runs))
+        failed = True
+
+    # Each soft reboot stages one image. Count the ones built from the delta
+    deltas = []
+    fallbacks = 0
+    if log:
+        for _, line in log.lines:
+            match = DELTA_DONE.search(line)
+            if match:
+                deltas.append((int(match.group(1)), int(match.group(2))))
+            elif DELTA_FAILED.search(line):
+                fallbacks += 1
+
+    if deltas or fallbacks:
+        received = sum(d[0] for d in deltas)
+        total = sum(d[1] for d in deltas)
+        print("{} images from the delta, {} full. Delta received {} of {} bytes".format(
+            len(deltas), fallbacks, received, total))
+
+    if args.expect_delta and (fallbacks or len(deltas) < soft_reboots or not deltas):
+        print("Not every soft reboot used the delta server")
+        failed = True
+
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump({ "mode": args.mode, "machine": args.machine, "runs": args.runs,
+                "phases": results, "delta_images": len(deltas),
+                "full_images": fallbacks }, f, indent=4)
+
+    if failed:
+        sys.exit(1)
+
+main()
@@ -0,0 +1,22 @@
+# Copyright (C) strawberryhacker
+
+import argparse
+import socket
+
+# Tells a kernel built with soft_reboot_prefetch to start the kernel it has prefetched.
+# The command must match TFTP_SWITCH_COMMAND in drivers/tftp.c
+
+SWITCH_COMMAND = b"switch"
+
+def main():
+    parser = argparse.ArgumentParser(description="Starts the prefetched kernel")
+    parser.add_argument("--ip", required=True, help="IP address of the running kernel")
+    parser.add_argument("--port", type=int, default=6971)
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.sendto(SWITCH_COMMAND, (args.ip, args.port))
+    sock.close()
+    print("Sent switch to {}:{}".format(args.ip, args.port))
+
+main()